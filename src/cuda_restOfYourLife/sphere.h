@@ -133,7 +133,7 @@ private:
 
   void calculate_bbox() {
     vec3 r(radius, radius, radius);
-    aabb bbox_t0 = aabb(center.at(0) - r, center.at(1) + r);
+    aabb bbox_t0 = aabb(center.at(0) - r, center.at(0) + r);
     aabb bbox_t1 = aabb(center.at(1) - r, center.at(1) + r);
     bbox = aabb(bbox_t0, bbox_t1);
   }
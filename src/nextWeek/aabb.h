@@ -41,6 +41,21 @@ public:
     }
   }
 
+  point3 centroid() const {
+    return point3(0.5 * (x_interval.min + x_interval.max),
+                  0.5 * (y_interval.min + y_interval.max),
+                  0.5 * (z_interval.min + z_interval.max));
+  }
+
+  double surface_area() const {
+    auto lx = x_interval.length();
+    auto ly = y_interval.length();
+    auto lz = z_interval.length();
+    if (lx < 0 || ly < 0 || lz < 0) // empty box
+      return 0.0;
+    return 2.0 * (lx * ly + ly * lz + lz * lx);
+  }
+
   int longest_axis() const {
     auto lx = x_interval.length();
     auto ly = y_interval.length();
@@ -6,84 +6,300 @@
 #include "hittable_list.h"
 #include "interval.h"
 #include <algorithm>
+#include <chrono>
 #include <cstddef>
 #include <memory>
+#include <ostream>
+#include <string>
 #include <vector>
 
+enum class bvh_split_method { median, sah };
+
+class bvh_build_options {
+public:
+  bvh_split_method split_method = bvh_split_method::sah;
+  int max_leaf_size = 4; // nodes with more primitives are always split
+  int bin_count = 16;    // centroid bins per axis for the sah sweep
+  double traversal_cost = 1.0; // relative to one primitive intersection
+};
+
+// bounds and centroid are looked up once per primitive, instead of a virtual
+// bounding_box() call on every comparison of the build
+class bvh_primitive {
+public:
+  shared_ptr<hittable> object;
+  aabb bbox;
+  point3 centroid;
+};
+
+class bvh_build_stats {
+public:
+  size_t node_count = 0, leaf_count = 0, primitive_count = 0;
+  int max_depth = 0;
+  double sah_cost = 0.0; // expected cost of a ray hitting the root box
+  std::vector<size_t> leaf_size_histogram; // [n]: leaves holding n primitives
+  double build_seconds = 0.0;
+
+  void print(std::ostream &out, std::string const &name) const {
+    out << name << ": " << primitive_count << " primitives, " << node_count
+        << " nodes, " << leaf_count << " leaves, depth " << max_depth
+        << ", sah cost " << sah_cost << ", built in " << build_seconds * 1e3
+        << " ms\n  leaf sizes:";
+    for (size_t size = 0; size < leaf_size_histogram.size(); size++)
+      if (leaf_size_histogram[size] > 0)
+        out << " " << size << ":" << leaf_size_histogram[size];
+    out << "\n";
+  }
+};
+
 class bvh_node : public hittable {
 public:
-  bvh_node(hittable_list hittable_list)
-      : bvh_node(hittable_list.objects, 0, hittable_list.objects.size()){};
-  bvh_node(std::vector<std::shared_ptr<hittable>> &objects, size_t start,
-           size_t end) {
-    bbox = aabb::Empty_bbox;
+  bvh_node(hittable_list hittable_list,
+           bvh_build_options const &options = bvh_build_options()) {
+    auto start = std::chrono::steady_clock::now();
 
-    for (size_t ith_object = start; ith_object < end; ith_object++) {
-      aabb ith_bbox = objects[ith_object]->bounding_box();
-      bbox = aabb(bbox, ith_bbox);
+    std::vector<bvh_primitive> primitives;
+    primitives.reserve(hittable_list.objects.size());
+    for (auto const &object : hittable_list.objects) {
+      bvh_primitive primitive;
+      primitive.object = object;
+      primitive.bbox = object->bounding_box();
+      primitive.centroid = primitive.bbox.centroid();
+      primitives.push_back(primitive);
     }
+    build(primitives, 0, primitives.size(), options);
 
-    int longest = bbox.longest_axis();
+    build_seconds = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+  }
 
-    auto comparator = (longest == 0)
-                          ? box_x_compare
-                          : ((longest == 1) ? box_y_compare : box_z_compare);
+  bvh_node(std::vector<bvh_primitive> &primitives, size_t start, size_t end,
+           bvh_build_options const &options) {
+    build(primitives, start, end, options);
+  }
 
-    size_t object_span = end - start;
+  bool intersect(const Ray &ray_in, interval ray_range,
+                 hit_info &info) const override {
+    if (!bbox.hit(ray_in, ray_range))
+      return false;
 
-    if (object_span == 1) {
-      left = right = objects[start];
-    } else if (object_span == 2) {
-      left = objects[start];
-      right = objects[start + 1];
-    } else {
-      std::sort(objects.begin() + start, objects.begin() + end, comparator);
-      auto mid = start + object_span / 2;
-      left = std::make_shared<bvh_node>(objects, start, mid);
-      right = std::make_shared<bvh_node>(objects, mid, end);
+    if (is_leaf()) {
+      bool hit_anything = false;
+      for (auto const &object : objects) {
+        if (object->intersect(ray_in, ray_range, info)) {
+          hit_anything = true;
+          ray_range.max = info.factorOfDirection;
+        }
+      }
+      return hit_anything;
     }
-  };
 
-  virtual bool hit(const Ray &ray_in, interval ray_range,
-                   hit_record &record) const override {
+    bool hit_left = left->intersect(ray_in, ray_range, info);
+    bool hit_right = right->intersect(
+        ray_in,
+        hit_left ? interval(ray_range.min, info.factorOfDirection) : ray_range,
+        info);
+
+    return hit_left || hit_right;
+  }
+
+  bool occluded(const Ray &ray_in, interval ray_range) const override {
     if (!bbox.hit(ray_in, ray_range))
       return false;
 
-    bool hit_left = left->hit(ray_in, ray_range, record);
-    bool hit_right =
-        right->hit(ray_in,
-                   hit_left ? interval(ray_range.min, record.factorOfDirection)
-                            : ray_range,
-                   record);
+    if (is_leaf()) {
+      for (auto const &object : objects)
+        if (object->occluded(ray_in, ray_range))
+          return true;
+      return false;
+    }
 
-    return hit_left || hit_right;
+    return left->occluded(ray_in, ray_range) ||
+           right->occluded(ray_in, ray_range);
   }
 
   virtual aabb bounding_box() const override { return bbox; };
 
+  bool is_leaf() const { return !left; }
+
+  // tree access for the flattening builders (linear_bvh)
+  bvh_node const &left_child() const { return *left; }
+  bvh_node const &right_child() const { return *right; }
+  int axis() const { return split_axis; } // left child is below on this axis
+  std::vector<shared_ptr<hittable>> const &leaf_objects() const {
+    return objects;
+  }
+
+  bvh_build_stats build_stats(double traversal_cost = 1.0) const {
+    bvh_build_stats stats;
+    accumulate_stats(stats, 1, bbox.surface_area(), traversal_cost);
+    stats.build_seconds = build_seconds;
+    return stats;
+  }
+
 private:
   aabb bbox;
-  shared_ptr<hittable> left, right;
-
-  static bool box_compare(const shared_ptr<hittable> &a,
-                          const shared_ptr<hittable> &b, int ith_axis) {
-    auto a_bbox = a->bounding_box();
-    auto b_bbox = b->bounding_box();
-    return a_bbox.get_axis_interval(ith_axis).min <
-           b_bbox.get_axis_interval(ith_axis).min;
+  shared_ptr<bvh_node> left, right;
+  std::vector<shared_ptr<hittable>> objects; // only filled in leaves
+  int split_axis = 0;
+  double build_seconds = 0.0;
+
+  void build(std::vector<bvh_primitive> &primitives, size_t start, size_t end,
+             bvh_build_options const &options) {
+    bbox = aabb::Empty_bbox;
+    aabb centroid_bounds = aabb::Empty_bbox;
+    for (size_t ith_object = start; ith_object < end; ith_object++) {
+      bbox = aabb(bbox, primitives[ith_object].bbox);
+      point3 const &centroid = primitives[ith_object].centroid;
+      centroid_bounds = aabb(centroid_bounds, aabb(centroid, centroid));
+    }
+
+    size_t mid;
+    bool split = options.split_method == bvh_split_method::sah
+                     ? sah_split(primitives, start, end, centroid_bounds,
+                                 options, mid)
+                     : median_split(primitives, start, end, options, mid);
+
+    if (!split) {
+      for (size_t ith_object = start; ith_object < end; ith_object++)
+        objects.push_back(primitives[ith_object].object);
+      return;
+    }
+
+    left = std::make_shared<bvh_node>(primitives, start, mid, options);
+    right = std::make_shared<bvh_node>(primitives, mid, end, options);
   }
-  static bool box_x_compare(const shared_ptr<hittable> &a,
-                            const shared_ptr<hittable> &b) {
-    return box_compare(a, b, 0);
+
+  bool median_split(std::vector<bvh_primitive> &primitives, size_t start,
+                    size_t end, bvh_build_options const &options,
+                    size_t &mid) {
+    size_t object_span = end - start;
+    if (object_span <= size_t(std::max(1, options.max_leaf_size)))
+      return false;
+
+    // only the two halves matter, not the order inside them
+    int longest = bbox.longest_axis();
+    split_axis = longest;
+    mid = start + object_span / 2;
+    std::nth_element(primitives.begin() + start, primitives.begin() + mid,
+                     primitives.begin() + end,
+                     [longest](bvh_primitive const &a, bvh_primitive const &b) {
+                       return a.bbox.get_axis_interval(longest).min <
+                              b.bbox.get_axis_interval(longest).min;
+                     });
+    return true;
+  }
+
+  bool sah_split(std::vector<bvh_primitive> &primitives, size_t start,
+                 size_t end, aabb const &centroid_bounds,
+                 bvh_build_options const &options, size_t &mid) {
+    size_t object_span = end - start;
+    if (object_span <= 1)
+      return false;
+
+    int bin_count = std::max(2, options.bin_count);
+    double node_area = bbox.surface_area();
+    double best_cost = INFINITY_DOUBLE;
+    int best_axis = -1, best_bin = 0;
+
+    std::vector<size_t> bin_counts(bin_count);
+    std::vector<aabb> bin_bounds(bin_count);
+    std::vector<double> right_costs(bin_count);
+
+    for (int axis = 0; axis < 3; axis++) {
+      interval const &extent = centroid_bounds.get_axis_interval(axis);
+      if (!(extent.length() > 0.0))
+        continue;
+
+      std::fill(bin_counts.begin(), bin_counts.end(), 0);
+      std::fill(bin_bounds.begin(), bin_bounds.end(), aabb::Empty_bbox);
+      for (size_t i = start; i < end; i++) {
+        int bin = bin_index(primitives[i].centroid[axis], extent, bin_count);
+        bin_counts[bin]++;
+        bin_bounds[bin] = aabb(bin_bounds[bin], primitives[i].bbox);
+      }
+
+      // sweep from the right, then from the left: right_costs[b] is the
+      // area-weighted primitive count of bins [b, bin_count)
+      aabb accumulated = aabb::Empty_bbox;
+      size_t accumulated_count = 0;
+      for (int bin = bin_count - 1; bin > 0; bin--) {
+        accumulated = aabb(accumulated, bin_bounds[bin]);
+        accumulated_count += bin_counts[bin];
+        right_costs[bin] = accumulated_count * accumulated.surface_area();
+      }
+
+      accumulated = aabb::Empty_bbox;
+      accumulated_count = 0;
+      for (int bin = 1; bin < bin_count; bin++) {
+        accumulated = aabb(accumulated, bin_bounds[bin - 1]);
+        accumulated_count += bin_counts[bin - 1];
+        if (accumulated_count == 0 || accumulated_count == object_span)
+          continue;
+
+        double left_cost = accumulated_count * accumulated.surface_area();
+        double cost =
+            options.traversal_cost + (left_cost + right_costs[bin]) / node_area;
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_axis = axis;
+          best_bin = bin;
+        }
+      }
+    }
+
+    bool must_split = object_span > size_t(std::max(1, options.max_leaf_size));
+    if (best_axis < 0) {
+      // every centroid in the same spot: no plane separates them
+      if (!must_split)
+        return false;
+      mid = start + object_span / 2;
+      return true;
+    }
+
+    double leaf_cost = double(object_span);
+    if (!must_split && leaf_cost <= best_cost)
+      return false;
+
+    split_axis = best_axis;
+    interval const &extent = centroid_bounds.get_axis_interval(best_axis);
+    auto middle = std::partition(
+        primitives.begin() + start, primitives.begin() + end,
+        [&](bvh_primitive const &primitive) {
+          return bin_index(primitive.centroid[best_axis], extent, bin_count) <
+                 best_bin;
+        });
+    mid = size_t(middle - primitives.begin());
+    return true;
   }
-  static bool box_y_compare(const shared_ptr<hittable> &a,
-                            const shared_ptr<hittable> &b) {
-    return box_compare(a, b, 1);
+
+  static int bin_index(double centroid, interval const &extent, int bin_count) {
+    int bin = int(bin_count * (centroid - extent.min) / extent.length());
+    return std::min(std::max(bin, 0), bin_count - 1);
   }
-  static bool box_z_compare(const shared_ptr<hittable> &a,
-                            const shared_ptr<hittable> &b) {
-    return box_compare(a, b, 2);
+
+  void accumulate_stats(bvh_build_stats &stats, int depth, double root_area,
+                        double traversal_cost) const {
+    stats.node_count++;
+    stats.max_depth = std::max(stats.max_depth, depth);
+    double relative_area =
+        root_area > 0.0 ? bbox.surface_area() / root_area : 1.0;
+
+    if (is_leaf()) {
+      stats.leaf_count++;
+      stats.primitive_count += objects.size();
+      if (stats.leaf_size_histogram.size() <= objects.size())
+        stats.leaf_size_histogram.resize(objects.size() + 1, 0);
+      stats.leaf_size_histogram[objects.size()]++;
+      stats.sah_cost += relative_area * objects.size();
+      return;
+    }
+
+    stats.sah_cost += relative_area * traversal_cost;
+    left->accumulate_stats(stats, depth + 1, root_area, traversal_cost);
+    right->accumulate_stats(stats, depth + 1, root_area, traversal_cost);
   }
 };
 
-#endif // BVH_H
\ No newline at end of file
+#endif // BVH_H
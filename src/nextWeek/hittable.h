@@ -7,6 +7,7 @@
 #include "ray.h"
 #include "texture.h"
 #include <memory>
+#include <stdexcept>
 
 class Material;
 class hit_record {
@@ -24,11 +25,78 @@ public:
   }
 };
 
+class hittable;
+
+/*
+what closest-hit traversal keeps per candidate: distance, primitive and its
+local coordinates, plus the instances (translate, rotate_y) it was found
+through. the full hit_record is built once, for the final hit only.
+*/
+class hit_info {
+public:
+  static int const max_instance_depth = 8;
+
+  double factorOfDirection;
+  hittable const *primitive = nullptr;
+  double u = 0.0, v = 0.0; // primitive-local coordinates, e.g. quad's a, b
+  hittable const *instances[max_instance_depth]; // innermost first
+  int instance_count = 0;
+
+  // a closer hit replaces the previous one, along with its instance chain
+  void record_hit(hittable const *hit_primitive, double t, double local_u = 0,
+                  double local_v = 0) {
+    factorOfDirection = t;
+    primitive = hit_primitive;
+    u = local_u;
+    v = local_v;
+    instance_count = 0;
+  }
+
+  // called by an instance on the way out, after its child reported a hit
+  void push_instance(hittable const *instance) {
+    if (instance_count == max_instance_depth)
+      throw std::length_error("hit_info: instances nested too deeply");
+    instances[instance_count++] = instance;
+  }
+};
+
 class hittable {
 public:
-  virtual bool hit(const Ray &ray, interval ray_range,
-                   hit_record &record) const = 0;
+  // closest hit in ray_range, tracked in info without building a record
+  virtual bool intersect(const Ray &ray, interval ray_range,
+                         hit_info &info) const = 0;
   virtual ~hittable() = default;
+
+  // closest hit with the full shading record
+  bool hit(const Ray &ray, interval ray_range, hit_record &record) const {
+    hit_info info;
+    if (!intersect(ray, ray_range, info))
+      return false;
+
+    Ray local_ray = ray;
+    for (int i = info.instance_count - 1; i >= 0; i--)
+      local_ray = info.instances[i]->to_instance_space(local_ray);
+    info.primitive->materialize(local_ray, info, record);
+    for (int i = 0; i < info.instance_count; i++)
+      info.instances[i]->to_world_space(record);
+    return true;
+  }
+
+  // primitives: the record of a hit intersect() found, in their own space
+  virtual void materialize(const Ray &ray, hit_info const &info,
+                           hit_record &record) const {}
+
+  // instances: rays into the child's space and records back out of it
+  virtual Ray to_instance_space(const Ray &ray) const { return ray; }
+  virtual void to_world_space(hit_record &record) const {}
+
+  // any-hit query for shadow rays: true if anything is hit in ray_range.
+  // may stop at the first intersection found, and fills no hit_record
+  virtual bool occluded(const Ray &ray, interval ray_range) const {
+    hit_record record;
+    return hit(ray, ray_range, record);
+  }
+
   virtual aabb bounding_box() const = 0;
 };
 
@@ -36,16 +104,27 @@ class translate : public hittable {
 public:
   translate(shared_ptr<hittable> object, const vec3 &offset)
       : object(object), offset(offset) {}
-  bool hit(const Ray &ray, interval ray_range,
-           hit_record &record) const override {
-    Ray offset_ray(ray.getOrigin() - offset, ray.getDirection(), ray.getTime());
-    if (!object->hit(offset_ray, ray_range, record))
+  bool intersect(const Ray &ray, interval ray_range,
+                 hit_info &info) const override {
+    if (!object->intersect(to_instance_space(ray), ray_range, info))
       return false;
 
-    record.hitPoint += offset;
+    info.push_instance(this);
     return true;
   }
 
+  bool occluded(const Ray &ray, interval ray_range) const override {
+    return object->occluded(to_instance_space(ray), ray_range);
+  }
+
+  Ray to_instance_space(const Ray &ray) const override {
+    return Ray(ray.getOrigin() - offset, ray.getDirection(), ray.getTime());
+  }
+
+  void to_world_space(hit_record &record) const override {
+    record.hitPoint += offset;
+  }
+
   aabb bounding_box() const override {
     aabb bbox = object->bounding_box();
     bbox.x_interval = bbox.x_interval + offset.x;
@@ -93,10 +172,20 @@ public:
 
     bbox = aabb(min, max);
   }
-  bool hit(const Ray &r, interval ray_t, hit_record &rec) const override {
+  bool intersect(const Ray &r, interval ray_t, hit_info &info) const override {
+    if (!object->intersect(to_instance_space(r), ray_t, info))
+      return false;
+
+    info.push_instance(this);
+    return true;
+  }
 
-    // Transform the ray from world space to object space.
+  bool occluded(const Ray &r, interval ray_t) const override {
+    return object->occluded(to_instance_space(r), ray_t);
+  }
 
+  // Transform the ray from world space to object space.
+  Ray to_instance_space(const Ray &r) const override {
     auto origin =
         point3((cos_theta * r.getOrigin().x) - (sin_theta * r.getOrigin().z),
                r.getOrigin().y,
@@ -107,16 +196,11 @@ public:
         r.getDirection().y,
         (sin_theta * r.getDirection().x) + (cos_theta * r.getDirection().z));
 
-    Ray rotated_r(origin, direction, r.getTime());
-
-    // Determine whether an intersection exists in object space (and if so,
-    // where).
-
-    if (!object->hit(rotated_r, ray_t, rec))
-      return false;
-
-    // Transform the intersection from object space back to world space.
+    return Ray(origin, direction, r.getTime());
+  }
 
+  // Transform the intersection from object space back to world space.
+  void to_world_space(hit_record &rec) const override {
     rec.hitPoint =
         point3((cos_theta * rec.hitPoint.x) + (sin_theta * rec.hitPoint.z),
                rec.hitPoint.y,
@@ -127,9 +211,8 @@ public:
                                 rec.normalAgainstRay.y,
                                 (-sin_theta * rec.normalAgainstRay.x) +
                                     (cos_theta * rec.normalAgainstRay.z));
-
-    return true;
   }
+
   aabb bounding_box() const override { return bbox; }
 
 private:
@@ -26,20 +26,25 @@ public:
     bbox = aabb(bbox, object->bounding_box());
   }
 
-  bool hit(Ray const &ray, interval ray_range,
-           hit_record &record) const override {
-    hit_record temp_record;
+  bool intersect(Ray const &ray, interval ray_range,
+                 hit_info &info) const override {
     bool hit_anything = false;
     for (const auto &object : objects) {
-      if (object->hit(ray, ray_range, temp_record)) {
+      if (object->intersect(ray, ray_range, info)) {
         hit_anything = true;
-        ray_range.max = temp_record.factorOfDirection;
-        record = temp_record;
+        ray_range.max = info.factorOfDirection;
       }
     }
     return hit_anything;
   }
 
+  bool occluded(Ray const &ray, interval ray_range) const override {
+    for (const auto &object : objects)
+      if (object->occluded(ray, ray_range))
+        return true;
+    return false;
+  }
+
   aabb bounding_box() const override { return bbox; }
 
 private:
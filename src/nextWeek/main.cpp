@@ -1,5 +1,6 @@
 #include "bvh.h"
 #include "camera.h"
+#include "linear_bvh.h"
 
 #include <algorithm>
 #include <cassert>
@@ -84,7 +85,7 @@ hittable_list initialize_world_object_forBouncingSpheres() { // material
   world_objects.add(left_sphere);
   world_objects.add(right_sphere);
   generate_random_world_objects(world_objects);
-  world_objects = hittable_list(make_shared<bvh_node>(world_objects));
+  world_objects = hittable_list(make_shared<linear_bvh>(world_objects));
   ;
   return world_objects;
 }
@@ -467,7 +468,7 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
 
   hittable_list world;
 
-  world.add(make_shared<bvh_node>(boxes1));
+  world.add(make_shared<linear_bvh>(boxes1));
 
   // light
   auto light = make_shared<diffuse_light>(color3(7, 7, 7));
@@ -515,7 +516,7 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
   }
 
   world.add(make_shared<translate>(
-      make_shared<rotate_y>(make_shared<bvh_node>(boxes2), 15),
+      make_shared<rotate_y>(make_shared<linear_bvh>(boxes2), 15),
       vec3(-100, 270, 395)));
 
   Camera camera;
@@ -10,6 +10,7 @@
 #include "nextWeek/vec3.h"
 #include <cmath>
 #include <memory>
+#include <utility>
 class quad : public hittable {
 public:
   quad(point3 _p0, vec3 _u, vec3 _v, std::shared_ptr<Material> _material)
@@ -22,19 +23,33 @@ public:
     calculate_bbox();
   };
 
-  bool hit(const Ray &ray, interval ray_range,
-           hit_record &record) const override {
+  bool intersect(const Ray &ray, interval ray_range,
+                 hit_info &info) const override {
     double factroOfDirection;
     if (solveIntersection(ray, ray_range, factroOfDirection)) {
       auto intersection = ray.at(factroOfDirection);
-      if (is_interior(intersection, record)) {
-        generate_hit_record(record, ray, factroOfDirection);
+      double a, b;
+      if (is_interior(intersection, a, b)) {
+        info.record_hit(this, factroOfDirection, a, b);
         return true;
       }
     }
     return false;
   }
 
+  void materialize(const Ray &ray, hit_info const &info,
+                   hit_record &record) const override {
+    record.textureCoordinate.u = info.u;
+    record.textureCoordinate.v = info.v;
+    generate_hit_record(record, ray, info.factorOfDirection);
+  }
+
+  bool occluded(const Ray &ray, interval ray_range) const override {
+    double factorOfDirection, a, b;
+    return solveIntersection(ray, ray_range, factorOfDirection) &&
+           is_interior(ray.at(factorOfDirection), a, b);
+  }
+
   aabb bounding_box() const override { return bbox; }
 
   void generate_hit_record(hit_record &record, Ray const &ray,
@@ -77,53 +92,143 @@ private:
     return true;
   }
 
-  bool is_interior(point3 const &intersection, hit_record &record) const {
+  bool is_interior(point3 const &intersection, double &a, double &b) const {
     vec3 p0_to_hitpoint = intersection - p0;
-    auto a = dotProduct(w, crossProduct(p0_to_hitpoint, v));
-    auto b = dotProduct(w, crossProduct(u, p0_to_hitpoint));
+    a = dotProduct(w, crossProduct(p0_to_hitpoint, v));
+    b = dotProduct(w, crossProduct(u, p0_to_hitpoint));
 
     interval unit_interval = interval(0, 1);
 
-    if (!unit_interval.contain(a) || !unit_interval.contain(b))
-      return false;
+    return unit_interval.contain(a) && unit_interval.contain(b);
+  }
+};
+/*
+an axis-aligned box as one primitive: a single slab test finds the hit and
+its face, instead of six quad tests. faces are numbered 2 * axis, plus one for
+the max side; texture coordinates run over each face the way the six quads
+box() used to build had them. a ray starting inside hits the face it leaves by,
+as media and dielectrics need.
+*/
+class aa_box : public hittable {
+public:
+  aa_box(point3 const &a, point3 const &b, std::shared_ptr<Material> material)
+      : minimum(std::fmin(a.x, b.x), std::fmin(a.y, b.y), std::fmin(a.z, b.z)),
+        maximum(std::fmax(a.x, b.x), std::fmax(a.y, b.y), std::fmax(a.z, b.z)),
+        bbox(a, b), material(material) {
+    for (int axis = 0; axis < 3; axis++) {
+      double size = maximum[axis] - minimum[axis];
+      inverse_size[axis] = size > 0.0 ? 1.0 / size : 0.0;
+    }
+  }
 
-    record.textureCoordinate.u = a;
-    record.textureCoordinate.v = b;
+  // the face goes through hit_info::u, the coordinates are only needed for
+  // the final hit
+  bool intersect(const Ray &ray, interval ray_range,
+                 hit_info &info) const override {
+    double factorOfDirection;
+    int face;
+    if (!slab_hit(ray, ray_range, factorOfDirection, face))
+      return false;
+    info.record_hit(this, factorOfDirection, face);
     return true;
   }
+
+  void materialize(const Ray &ray, hit_info const &info,
+                   hit_record &record) const override {
+    int face = int(info.u);
+    record.material = material;
+    record.factorOfDirection = info.factorOfDirection;
+    record.hitPoint = ray.at(info.factorOfDirection);
+    record.textureCoordinate = face_coordinate(face, record.hitPoint);
+    record.set_surface_normal(ray, face_normal(face));
+  }
+
+  bool occluded(const Ray &ray, interval ray_range) const override {
+    double factorOfDirection;
+    int face;
+    return slab_hit(ray, ray_range, factorOfDirection, face);
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+private:
+  point3 minimum, maximum;
+  vec3 inverse_size;
+  aabb bbox;
+  std::shared_ptr<Material> material;
+
+  // entry and exit through the three slabs: the hit is the entry, or the
+  // exit when the entry is behind ray_range
+  bool slab_hit(Ray const &ray, interval ray_range, double &factorOfDirection,
+                int &face) const {
+    double t_near = -INFINITY_DOUBLE, t_far = INFINITY_DOUBLE;
+    int near_face = 0, far_face = 0;
+    for (int axis = 0; axis < 3; axis++) {
+      double origin = ray.getOrigin()[axis];
+      double inverse_direction = 1.0 / ray.getDirection()[axis];
+      double t_min = (minimum[axis] - origin) * inverse_direction;
+      double t_max = (maximum[axis] - origin) * inverse_direction;
+      int min_face = 2 * axis, max_face = 2 * axis + 1;
+      if (t_min > t_max) {
+        std::swap(t_min, t_max);
+        std::swap(min_face, max_face);
+      }
+      if (t_min > t_near) {
+        t_near = t_min;
+        near_face = min_face;
+      }
+      if (t_max < t_far) {
+        t_far = t_max;
+        far_face = max_face;
+      }
+    }
+    if (t_near > t_far)
+      return false;
+
+    if (ray_range.contain(t_near)) {
+      factorOfDirection = t_near;
+      face = near_face;
+      return true;
+    }
+    if (t_near < ray_range.min && ray_range.contain(t_far)) {
+      factorOfDirection = t_far;
+      face = far_face;
+      return true;
+    }
+    return false;
+  }
+
+  static vec3 face_normal(int face) {
+    vec3 normal(0, 0, 0);
+    normal[face / 2] = face % 2 ? 1.0 : -1.0;
+    return normal;
+  }
+
+  texture_coordinate face_coordinate(int face, point3 const &point) const {
+    double x = (point.x - minimum.x) * inverse_size.x;
+    double y = (point.y - minimum.y) * inverse_size.y;
+    double z = (point.z - minimum.z) * inverse_size.z;
+    switch (face) {
+    case 0: // left
+      return texture_coordinate(z, y);
+    case 1: // right
+      return texture_coordinate(1.0 - z, y);
+    case 2: // bottom
+      return texture_coordinate(x, z);
+    case 3: // top
+      return texture_coordinate(x, 1.0 - z);
+    case 4: // back
+      return texture_coordinate(1.0 - x, y);
+    default: // front
+      return texture_coordinate(x, y);
+    }
+  }
 };
-inline shared_ptr<hittable_list> box(const point3 &a, const point3 &b,
-                                     shared_ptr<Material> mat) {
-  // Returns the 3D box (six sides) that contains the two opposite vertices a &
-  // b.
-
-  auto sides = make_shared<hittable_list>();
-
-  // Construct the two opposite vertices with the minimum and maximum
-  // coordinates.
-  auto min =
-      point3(std::fmin(a.x, b.x), std::fmin(a.y, b.y), std::fmin(a.z, b.z));
-  auto max =
-      point3(std::fmax(a.x, b.x), std::fmax(a.y, b.y), std::fmax(a.z, b.z));
-
-  auto dx = vec3(max.x - min.x, 0, 0);
-  auto dy = vec3(0, max.y - min.y, 0);
-  auto dz = vec3(0, 0, max.z - min.z);
-
-  sides->add(make_shared<quad>(point3(min.x, min.y, max.z), dx, dy,
-                               mat)); // front
-  sides->add(make_shared<quad>(point3(max.x, min.y, max.z), -dz, dy,
-                               mat)); // right
-  sides->add(make_shared<quad>(point3(max.x, min.y, min.z), -dx, dy,
-                               mat)); // back
-  sides->add(make_shared<quad>(point3(min.x, min.y, min.z), dz, dy,
-                               mat)); // left
-  sides->add(make_shared<quad>(point3(min.x, max.y, max.z), dx, -dz,
-                               mat)); // top
-  sides->add(make_shared<quad>(point3(min.x, min.y, min.z), dx, dz,
-                               mat)); // bottom
-
-  return sides;
+
+// the 3D box that contains the two opposite vertices a & b, as one aa_box
+inline shared_ptr<hittable> box(const point3 &a, const point3 &b,
+                                shared_ptr<Material> mat) {
+  return make_shared<aa_box>(a, b, mat);
 }
 
 #endif // QUAD_H
\ No newline at end of file
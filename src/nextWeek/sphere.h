@@ -50,18 +50,25 @@ public:
     return record;
   }
 
-  virtual bool hit(const Ray &ray, interval ray_range,
-                   hit_record &record) const override {
-
+  bool intersect(const Ray &ray, interval ray_range,
+                 hit_info &info) const override {
     double factorOfDirection;
-    if (solveIntersection(ray, ray_range, factorOfDirection)) {
-      record = generate_hit_record(ray, factorOfDirection);
+    if (!solveIntersection(ray, ray_range, factorOfDirection))
+      return false;
 
-      return true;
-    }
+    info.record_hit(this, factorOfDirection);
+    return true;
+  }
 
-    return false;
-  };
+  void materialize(const Ray &ray, hit_info const &info,
+                   hit_record &record) const override {
+    record = generate_hit_record(ray, info.factorOfDirection);
+  }
+
+  bool occluded(const Ray &ray, interval ray_range) const override {
+    double factorOfDirection;
+    return solveIntersection(ray, ray_range, factorOfDirection);
+  }
 
   static void get_sphere_uv(texture_coordinate &tex_coordinate) {
     auto point = tex_coordinate.point;
@@ -106,7 +113,7 @@ private:
 
   void calculate_bbox() {
     vec3 r(radius, radius, radius);
-    aabb bbox_t0 = aabb(center.at(0) - r, center.at(1) + r);
+    aabb bbox_t0 = aabb(center.at(0) - r, center.at(0) + r);
     aabb bbox_t1 = aabb(center.at(1) - r, center.at(1) + r);
     bbox = aabb(bbox_t0, bbox_t1);
   }
@@ -0,0 +1,33 @@
+#include "allocation_counter.h"
+
+#ifdef RT_COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// out of line, so callers never see new and free inlined together
+
+static std::atomic<uint64_t> &allocation_counter() {
+  static std::atomic<uint64_t> counter(0);
+  return counter;
+}
+
+uint64_t allocation_count() {
+  return allocation_counter().load(std::memory_order_relaxed);
+}
+
+void *operator new(size_t size) {
+  allocation_counter().fetch_add(1, std::memory_order_relaxed);
+  if (void *memory = std::malloc(size ? size : 1))
+    return memory;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept { std::free(memory); }
+
+#else
+
+uint64_t allocation_count() { return 0; }
+
+#endif
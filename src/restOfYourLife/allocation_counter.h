@@ -0,0 +1,22 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <cstdint>
+
+/*
+instrumentation hook: with RT_COUNT_ALLOCATIONS defined (cmake
+-DRT_COUNT_ALLOCATIONS=ON), every global operator new is counted, so benchmarks
+can check that the render loop does not touch the heap. the replaced
+allocation functions live in allocation_counter.cpp; without the define they
+are not compiled and allocation_count() stays 0.
+*/
+
+#ifdef RT_COUNT_ALLOCATIONS
+bool constexpr allocation_counting = true;
+#else
+bool constexpr allocation_counting = false;
+#endif
+
+uint64_t allocation_count();
+
+#endif // ALLOCATION_COUNTER_H
@@ -0,0 +1,1699 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "allocation_counter.h"
+#include "bvh.h"
+#include "camera.h"
+#include "common.h"
+#include "constant_medium.h"
+#include "hittable_list.h"
+#include "image_writer.h"
+#include "lbvh.h"
+#include "light_tree.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "mesh.h"
+#include "mesh_io.h"
+#include "motion_bvh.h"
+#include "quad.h"
+#include "rng.h"
+#include "sampler.h"
+#include "scene.h"
+#include "scenes.h"
+#include "sphere.h"
+#include "tlas.h"
+#include "transform.h"
+#include "wide_bvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+micro benchmarks, run with `restOfYourLife --bench <name>`.
+results go to std::clog so they never end up in a redirected image.
+*/
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+// runs work(thread_id) on thread_count threads, returns wall time in seconds
+double time_on_threads(int thread_count,
+                       std::function<void(int)> const &work) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int id = 1; id < thread_count; id++)
+    threads.push_back(std::thread(work, id));
+  work(0);
+  for (auto &thread : threads)
+    thread.join();
+  return seconds_since(start);
+}
+
+void report_rate(std::string const &name, double count, double seconds,
+                 char const *unit) {
+  std::clog << "  " << std::left << std::setw(36) << name << std::right
+            << std::setw(10) << std::fixed << std::setprecision(2)
+            << count / seconds * 1e-6 << " M" << unit << "/s" << std::endl
+            << std::defaultfloat << std::setprecision(6);
+}
+
+void benchmark_rng(int thread_count) {
+  long const samples_per_thread = 20000000;
+  std::clog << "rng: " << samples_per_thread << " doubles per thread, "
+            << thread_count << " thread(s)" << std::endl;
+
+  // results are summed and printed so the loops can't be optimized away
+  std::vector<double> sinks(thread_count, 0.0);
+
+  double rand_time = time_on_threads(thread_count, [&](int id) {
+    double sum = 0.0;
+    for (long i = 0; i < samples_per_thread; i++)
+      sum += std::rand() / (RAND_MAX + 1.0);
+    sinks[id] = sum;
+  });
+
+  double stream_time = time_on_threads(thread_count, [&](int id) {
+    rng_stream rng(0, uint64_t(id), 0);
+    double sum = 0.0;
+    for (long i = 0; i < samples_per_thread; i++)
+      sum += rng.next_double();
+    sinks[id] += sum;
+  });
+
+  double bound_time = time_on_threads(thread_count, [&](int id) {
+    bind_random_stream(rng_stream(0, uint64_t(id), 0));
+    double sum = 0.0;
+    for (long i = 0; i < samples_per_thread; i++)
+      sum += random_double();
+    sinks[id] += sum;
+  });
+
+  // what the camera pays per (pixel, sample): a fresh stream and a few draws
+  double reseed_time = time_on_threads(thread_count, [&](int id) {
+    double sum = 0.0;
+    for (long i = 0; i < samples_per_thread / 8; i++) {
+      rng_stream rng(0, uint64_t(id), uint64_t(i), 1);
+      for (int j = 0; j < 8; j++)
+        sum += rng.next_double();
+    }
+    sinks[id] += sum;
+  });
+
+  double total = double(samples_per_thread) * thread_count;
+  report_rate("std::rand (global, locked)", total, rand_time, "samples");
+  report_rate("rng_stream::next_double", total, stream_time, "samples");
+  report_rate("random_double (thread-bound)", total, bound_time, "samples");
+  report_rate("rng_stream per sample, 8 draws", total, reseed_time, "samples");
+
+  double checksum = 0.0;
+  for (double sink : sinks)
+    checksum += sink;
+  std::clog << "  (checksum " << checksum << ")" << std::endl;
+}
+
+// the geometry of nextWeek's final_scene as loose primitives: 400 ground
+// boxes as 2400 quads (or 400 aa_boxes) plus the cluster of 1000 spheres
+hittable_list final_scene_primitives(bool box_primitives = false) {
+  bind_random_stream(rng_stream(0, 0, 0));
+  hittable_list primitives;
+
+  auto ground = make_shared<lambertian>(color3(0.48, 0.83, 0.53));
+  int boxes_per_side = 20;
+  for (int i = 0; i < boxes_per_side; i++) {
+    for (int j = 0; j < boxes_per_side; j++) {
+      auto w = 100.0;
+      auto x0 = -1000.0 + i * w;
+      auto z0 = -1000.0 + j * w;
+      point3 a(x0, 0.0, z0), b(x0 + w, random_double(1, 101), z0 + w);
+      if (box_primitives) {
+        primitives.add(box(a, b, ground));
+        continue;
+      }
+      auto sides = box_sides(a, b, ground);
+      for (auto const &side : sides->objects)
+        primitives.add(side);
+    }
+  }
+
+  auto white = make_shared<lambertian>(color3(.73, .73, .73));
+  for (int j = 0; j < 1000; j++)
+    primitives.add(make_shared<sphere>(
+        generate_random_vector(0, 165) + vec3(-100, 270, 395), 10, white));
+
+  return primitives;
+}
+
+// primary rays of final_scene's camera, rows split across threads.
+// returns wall time; hit_count is the number of rays that hit something
+double trace_primary_rays(hittable const &world, int resolution,
+                          int thread_count, size_t &hit_count) {
+  point3 lookfrom(478, 278, -600), lookat(278, 278, 0);
+  vec3 w = unit_vector(lookfrom - lookat);
+  vec3 u = unit_vector(crossProduct(vec3(0, 1, 0), w));
+  vec3 v = crossProduct(w, u);
+  double half_height = std::tan(degrees_to_radians(40) / 2);
+
+  std::vector<size_t> hits(thread_count, 0);
+  double seconds = time_on_threads(thread_count, [&](int id) {
+    for (int y = id; y < resolution; y += thread_count) {
+      for (int x = 0; x < resolution; x++) {
+        double px = (2.0 * (x + 0.5) / resolution - 1.0) * half_height;
+        double py = (1.0 - 2.0 * (y + 0.5) / resolution) * half_height;
+        Ray ray(lookfrom, px * u + py * v - w);
+        hit_record record;
+        if (world.hit(ray, interval(0.001, INFINITY_DOUBLE), record))
+          hits[id]++;
+      }
+    }
+  });
+
+  hit_count = 0;
+  for (size_t h : hits)
+    hit_count += h;
+  return seconds;
+}
+
+void benchmark_bvh(int thread_count) {
+  hittable_list primitives = final_scene_primitives();
+  int const resolution = 512;
+  std::clog << "bvh: final_scene geometry, " << primitives.objects.size()
+            << " primitives, " << resolution << "x" << resolution
+            << " primary rays, " << thread_count << " thread(s)" << std::endl;
+
+  struct variant {
+    char const *name;
+    bvh_split_method split_method;
+    int max_leaf_size;
+  } const variants[] = {{"median, leaf 1", bvh_split_method::median, 1},
+                        {"sah, leaf 1", bvh_split_method::sah, 1},
+                        {"sah, leaf 4", bvh_split_method::sah, 4},
+                        {"sah, leaf 8", bvh_split_method::sah, 8}};
+
+  for (auto const &v : variants) {
+    bvh_build_options options;
+    options.split_method = v.split_method;
+    options.max_leaf_size = v.max_leaf_size;
+    bvh_node bvh(primitives, options);
+    bvh.build_stats().print(std::clog, v.name);
+
+    size_t hit_count;
+    double seconds =
+        trace_primary_rays(bvh, resolution, thread_count, hit_count);
+    report_rate("traversal", double(resolution) * resolution, seconds, "rays");
+
+    linear_bvh flat(bvh);
+    seconds = trace_primary_rays(flat, resolution, thread_count, hit_count);
+    report_rate("traversal, flattened", double(resolution) * resolution,
+                seconds, "rays");
+    std::clog << "  (" << hit_count << " hits)" << std::endl;
+  }
+}
+
+// rays from random points inside the scene in random directions, which
+// exercise far more grazing and interior cases than camera rays
+std::vector<Ray> random_scene_rays(aabb const &bounds, size_t count) {
+  bind_random_stream(rng_stream(1, 0, 0));
+  std::vector<Ray> rays;
+  for (size_t i = 0; i < count; i++) {
+    point3 origin(random_double(bounds.x_interval.min, bounds.x_interval.max),
+                  random_double(bounds.y_interval.min, bounds.y_interval.max),
+                  random_double(bounds.z_interval.min, bounds.z_interval.max));
+    rays.push_back(Ray(origin, generate_random_diffused_unitVector()));
+  }
+  return rays;
+}
+
+// closest-hit distances of `candidate` must match the reference exactly
+size_t count_mismatches(hittable const &reference, hittable const &candidate,
+                        std::vector<Ray> const &rays) {
+  size_t mismatches = 0;
+  for (auto const &ray : rays) {
+    hit_record expected, actual;
+    bool expected_hit =
+        reference.hit(ray, interval(0.001, INFINITY_DOUBLE), expected);
+    bool actual_hit =
+        candidate.hit(ray, interval(0.001, INFINITY_DOUBLE), actual);
+    if (expected_hit != actual_hit ||
+        (expected_hit &&
+         expected.factorOfDirection != actual.factorOfDirection))
+      mismatches++;
+  }
+  return mismatches;
+}
+
+template <int width>
+bool benchmark_wide_variant(bvh_node const &tree, bool use_simd,
+                            std::vector<Ray> const &validation_rays,
+                            int resolution, int thread_count) {
+  wide_bvh<width> wide(tree, use_simd);
+  std::string name = "bvh" + std::to_string(width) + " (" +
+                     simd_level_name(wide.kernel_level()) + ")";
+  std::clog << name << ": " << wide.node_count() << " nodes, "
+            << wide.memory_bytes() / 1024 << " KiB" << std::endl;
+
+  size_t hit_count;
+  double seconds =
+      trace_primary_rays(wide, resolution, thread_count, hit_count);
+  report_rate("traversal", double(resolution) * resolution, seconds, "rays");
+
+  size_t mismatches = count_mismatches(tree, wide, validation_rays);
+  std::clog << "  validation against bvh_node: " << mismatches << " of "
+            << validation_rays.size() << " rays differ" << std::endl;
+  return mismatches == 0;
+}
+
+// spheres 1.25x further out and larger each step along x: sah peels them off
+// one level at a time, deeper than wide_bvh<8> can traverse
+hittable_list geometric_chain_spheres(int count) {
+  hittable_list spheres;
+  auto white = make_shared<lambertian>(color3(.73, .73, .73));
+  for (int k = 0; k < count; k++) {
+    double x = std::pow(1.25, k);
+    spheres.add(make_shared<sphere>(point3(x, 0, 0), x / 16, white));
+  }
+  return spheres;
+}
+
+// the median fallback must still find every hit of the deep sah tree
+template <int width>
+size_t deep_tree_mismatches(bvh_node const &tree, hittable_list const &list) {
+  wide_bvh<width> wide(tree);
+  bind_random_stream(rng_stream(3, 0, 0));
+  std::vector<Ray> rays;
+  for (auto const &object : list.objects) {
+    aabb const box = object->bounding_box();
+    point3 center = box.centroid();
+    double size = box.x_interval.length();
+    for (int i = 0; i < 16; i++)
+      rays.push_back(Ray(center + size * vec3(random_double(-1, 1),
+                                              random_double(-1, 1), 4),
+                         vec3(0, 0, -1)));
+  }
+  size_t mismatches = count_mismatches(tree, wide, rays);
+  std::clog << "  bvh" << width << ": " << wide.node_count() << " nodes, "
+            << mismatches << " of " << rays.size() << " rays differ"
+            << std::endl;
+  return mismatches;
+}
+
+void benchmark_wide_bvh(int thread_count) {
+  hittable_list primitives = final_scene_primitives();
+  int const resolution = 512;
+  std::clog << "wide bvh: final_scene geometry, " << primitives.objects.size()
+            << " primitives, cpu supports "
+            << simd_level_name(detect_simd_level()) << std::endl;
+
+  bvh_node tree(primitives);
+  tree.build_stats().print(std::clog, "binary (sah, leaf 4)");
+
+  linear_bvh flat(tree);
+  size_t hit_count;
+  double seconds =
+      trace_primary_rays(flat, resolution, thread_count, hit_count);
+  std::clog << "linear_bvh: " << flat.node_count() << " nodes, "
+            << flat.node_count() * sizeof(linear_bvh_node) / 1024 << " KiB"
+            << std::endl;
+  report_rate("traversal", double(resolution) * resolution, seconds, "rays");
+
+  std::vector<Ray> validation_rays =
+      random_scene_rays(tree.bounding_box(), 200000);
+  bool valid = true;
+  valid &= benchmark_wide_variant<4>(tree, false, validation_rays, resolution,
+                                     thread_count);
+  valid &= benchmark_wide_variant<4>(tree, true, validation_rays, resolution,
+                                     thread_count);
+  valid &= benchmark_wide_variant<8>(tree, false, validation_rays, resolution,
+                                     thread_count);
+  valid &= benchmark_wide_variant<8>(tree, true, validation_rays, resolution,
+                                     thread_count);
+
+  hittable_list chain = geometric_chain_spheres(370);
+  bvh_node deep_tree(chain);
+  std::clog << "deep tree: " << chain.objects.size()
+            << " geometric chain spheres, sah depth "
+            << deep_tree.build_stats().max_depth << std::endl;
+  valid &= deep_tree_mismatches<4>(deep_tree, chain) == 0;
+  valid &= deep_tree_mismatches<8>(deep_tree, chain) == 0;
+  std::clog << (valid ? "validation passed" : "VALIDATION FAILED")
+            << std::endl;
+}
+
+// many small spheres scattered through a cube, for builders meant for
+// millions of primitives
+hittable_list random_spheres(size_t count) {
+  bind_random_stream(rng_stream(2, 0, 0));
+  hittable_list spheres;
+  auto white = make_shared<lambertian>(color3(.73, .73, .73));
+  double radius = 0.5 / std::cbrt(double(count));
+  for (size_t i = 0; i < count; i++)
+    spheres.add(make_shared<sphere>(
+        point3(random_double(), random_double(), random_double()),
+        radius * random_double(0.5, 1.5), white));
+  return spheres;
+}
+
+// small spheres whose 63-bit morton codes each have a single bit set, one per
+// level, above many copies of one sphere: an lbvh chain deeper than
+// linear_bvh::max_depth. centers are in units of the 21-bit grid
+hittable_list morton_chain_spheres(size_t duplicate_count) {
+  hittable_list spheres;
+  auto white = make_shared<lambertian>(color3(.73, .73, .73));
+  double const far = double((1 << 21) - 1);
+  spheres.add(make_shared<sphere>(point3(far, far, far), 0.4, white));
+  for (int k = 0; k < 63; k++) {
+    point3 center(0, 0, 0);
+    center[k % 3] = double(1 << (20 - k / 3)) + 0.25;
+    spheres.add(make_shared<sphere>(center, 0.4, white));
+  }
+  for (size_t i = 0; i < duplicate_count; i++)
+    spheres.add(make_shared<sphere>(point3(0, 0, 0), 0.4, white));
+  return spheres;
+}
+
+double trace_rays(hittable const &world, std::vector<Ray> const &rays,
+                  int thread_count) {
+  return time_on_threads(thread_count, [&](int id) {
+    for (size_t i = id; i < rays.size(); i += thread_count) {
+      hit_record record;
+      world.hit(rays[i], interval(0.001, INFINITY_DOUBLE), record);
+    }
+  });
+}
+
+void benchmark_lbvh(int thread_count) {
+  size_t const primitive_count = 1 << 20;
+  hittable_list spheres = random_spheres(primitive_count);
+  std::vector<Ray> rays = random_scene_rays(spheres.bounding_box(), 500000);
+  std::clog << "lbvh: " << primitive_count << " random spheres, "
+            << rays.size() << " random rays, " << thread_count
+            << " thread(s)" << std::endl;
+
+  bvh_build_options sah_options;
+  linear_bvh reference(bvh_node(spheres, sah_options));
+  std::vector<Ray> validation_rays(rays.begin(), rays.begin() + 20000);
+
+  auto report = [&](std::string const &name, linear_bvh const &bvh,
+                    double build_seconds) {
+    std::clog << name << ": " << bvh.node_count() << " nodes, sah cost "
+              << bvh.sah_cost() << ", built in " << build_seconds * 1e3
+              << " ms" << std::endl;
+    report_rate("traversal", double(rays.size()),
+                trace_rays(bvh, rays, thread_count), "rays");
+    std::clog << "  validation against sah: "
+              << count_mismatches(reference, bvh, validation_rays) << " of "
+              << validation_rays.size() << " rays differ" << std::endl;
+  };
+
+  for (auto split_method : {bvh_split_method::median, bvh_split_method::sah}) {
+    bvh_build_options options;
+    options.split_method = split_method;
+    auto start = std::chrono::steady_clock::now();
+    bvh_node tree(spheres, options);
+    double build_seconds = seconds_since(start);
+    report(split_method == bvh_split_method::sah ? "bvh_node sah, leaf 4"
+                                                 : "bvh_node median, leaf 4",
+           linear_bvh(tree), build_seconds);
+  }
+
+  struct variant {
+    char const *name;
+    int morton_bits;
+    int treelet_passes;
+  } const variants[] = {{"lbvh 30-bit", 30, 0},
+                        {"lbvh 63-bit", 63, 0},
+                        {"lbvh 30-bit, 1 treelet pass", 30, 1},
+                        {"lbvh 30-bit, 3 treelet passes", 30, 3}};
+  for (auto const &v : variants) {
+    lbvh_build_options options;
+    options.morton_bits = v.morton_bits;
+    options.treelet_passes = v.treelet_passes;
+    options.thread_count = thread_count;
+    lbvh_build_stats stats;
+    auto bvh = build_lbvh(spheres, options, &stats);
+    stats.print(std::clog, v.name);
+    report(v.name, *bvh, stats.total_seconds());
+  }
+
+  hittable_list chain = morton_chain_spheres(4096);
+  lbvh_build_options chain_options;
+  chain_options.morton_bits = 63;
+  chain_options.thread_count = thread_count;
+  lbvh_build_stats chain_stats;
+  auto chain_bvh = build_lbvh(chain, chain_options, &chain_stats);
+  chain_stats.print(std::clog, "lbvh 63-bit, single-bit codes");
+  std::vector<Ray> chain_rays; // aimed at the spheres, random ones miss them
+  bind_random_stream(rng_stream(2, 1, 0));
+  for (size_t i = 0; i < validation_rays.size(); i++) {
+    auto const &target = chain.objects[i % chain.objects.size()];
+    point3 center = target->bounding_box().centroid();
+    point3 origin =
+        center + vec3(random_double(-3, 3), random_double(-3, 3), 4);
+    chain_rays.push_back(Ray(origin, center - origin));
+  }
+  std::clog << "  validation against sah: "
+            << count_mismatches(linear_bvh(chain), *chain_bvh, chain_rays)
+            << " of " << chain_rays.size() << " rays differ" << std::endl;
+}
+
+// shadow-ray style queries: occluded() must agree with hit() on every ray,
+// and should be cheaper since it stops at the first intersection
+void benchmark_occlusion(int thread_count) {
+  hittable_list primitives = final_scene_primitives();
+  bvh_node tree(primitives);
+  std::vector<Ray> rays = random_scene_rays(tree.bounding_box(), 500000);
+  interval const segment(0.001, 200.0);
+  std::clog << "occlusion: final_scene geometry, " << rays.size()
+            << " random rays of length " << segment.max << ", "
+            << thread_count << " thread(s)" << std::endl;
+
+  linear_bvh flat(tree);
+  bvh4 wide4(tree);
+  bvh8 wide8(tree);
+  struct variant {
+    char const *name;
+    hittable const *world;
+  } const variants[] = {{"bvh_node", &tree},
+                        {"linear_bvh", &flat},
+                        {"bvh4", &wide4},
+                        {"bvh8", &wide8}};
+
+  bool valid = true;
+  for (auto const &v : variants) {
+    std::clog << v.name << ":" << std::endl;
+    double seconds = time_on_threads(thread_count, [&](int id) {
+      for (size_t i = id; i < rays.size(); i += thread_count) {
+        hit_record record;
+        v.world->hit(rays[i], segment, record);
+      }
+    });
+    report_rate("closest hit", double(rays.size()), seconds, "rays");
+    seconds = time_on_threads(thread_count, [&](int id) {
+      for (size_t i = id; i < rays.size(); i += thread_count)
+        v.world->occluded(rays[i], segment);
+    });
+    report_rate("occluded", double(rays.size()), seconds, "rays");
+
+    size_t mismatches = 0;
+    for (auto const &ray : rays) {
+      hit_record record;
+      if (v.world->hit(ray, segment, record) != v.world->occluded(ray, segment))
+        mismatches++;
+    }
+    std::clog << "  " << mismatches << " rays disagree with hit()" << std::endl;
+    valid &= mismatches == 0;
+  }
+  std::clog << (valid ? "validation passed" : "VALIDATION FAILED")
+            << std::endl;
+}
+
+// the Cornell box camera of main.cpp at a small size
+Camera cornell_box_camera(int width, int samples_per_pixel, int thread_count) {
+  Camera camera;
+  camera.image_width = width;
+  camera.sample_per_pixel = samples_per_pixel;
+  camera.max_depth = 50;
+  camera.background = color3(0, 0, 0);
+  camera.vFov = 40;
+  camera.lookfrom = point3(278, 278, -800);
+  camera.lookat = point3(278, 278, 0);
+  camera.thread_count = thread_count;
+  return camera;
+}
+
+// a texture that counts how many of its kind are alive
+class counted_texture : public solid_color {
+public:
+  static std::atomic<int> &alive() {
+    static std::atomic<int> count(0);
+    return count;
+  }
+
+  counted_texture() : solid_color(color3(0.5, 0.5, 0.5)) { alive()++; }
+  ~counted_texture() override { alive()--; }
+};
+
+// textures of a scene still alive after it is gone, referenced from its
+// materials the way scene objects keep each other: 0 unless the arena leaks
+int scene_objects_left() {
+  int before = counted_texture::alive();
+  {
+    scene objects;
+    for (int i = 0; i < 100; i++)
+      objects.create<lambertian>(objects.create<counted_texture>());
+  }
+  return counted_texture::alive() - before;
+}
+
+// heap allocations of a whole Cornell box render at two sample counts: with
+// allocation-free bounces the difference is zero
+void benchmark_allocations(int thread_count) {
+  scene objects;
+  hittable_list lights;
+  hittable_list world = cornell_box_world(objects, lights);
+
+  Camera camera = cornell_box_camera(64, 4, thread_count);
+
+  std::clog << "allocations: Cornell box, 64x64, " << thread_count
+            << " thread(s)" << std::endl;
+  if (!allocation_counting)
+    std::clog << "  allocation counting is off, configure with "
+                 "-DRT_COUNT_ALLOCATIONS=ON"
+              << std::endl;
+  uint64_t counts[2];
+  int const sample_counts[2] = {4, 64};
+  for (int i = 0; i < 2; i++) {
+    camera.sample_per_pixel = sample_counts[i];
+    uint64_t before = allocation_count();
+    camera.render_image(world, lights);
+    counts[i] = allocation_count() - before;
+    std::clog << "  " << sample_counts[i] << " spp: " << counts[i]
+              << " allocations" << std::endl;
+  }
+
+  if (allocation_counting) {
+    double samples = 64.0 * 64.0 * (sample_counts[1] - sample_counts[0]);
+    std::clog << "  " << double(counts[1] - counts[0]) / samples
+              << " allocations per sample" << std::endl;
+  }
+  std::clog << "  scene objects left after their scene: "
+            << scene_objects_left() << std::endl;
+}
+
+// direct light reaching points on the many_lights floor, without shadows:
+// one light sample estimates cos * emission / pdf. both samplers must agree
+// on the mean; the tree should need far fewer samples for the same noise
+void benchmark_light_sampling(int thread_count) {
+  scene objects;
+  hittable_list lights;
+  many_lights_world(objects, lights, 1024);
+  light_tree tree(lights);
+
+  size_t const point_count = 2048;
+  int const samples_per_point = 64;
+  std::clog << "lights: " << lights.objects.size() << " ceiling panels, "
+            << point_count << " floor points, " << samples_per_point
+            << " samples each, " << thread_count << " thread(s)" << std::endl;
+  std::clog << "  light_tree: " << tree.node_count() << " nodes" << std::endl;
+
+  std::vector<point3> points;
+  bind_random_stream(rng_stream(6, 0, 0));
+  for (size_t i = 0; i < point_count; i++)
+    points.push_back(point3(random_double(-50, 50), 0, random_double(-50, 50)));
+
+  struct variant {
+    char const *name;
+    hittable const *lights;
+  } const variants[] = {{"uniform (hittable_list)", &lights},
+                        {"light_tree", &tree}};
+
+  double means[2], standard_errors[2];
+  for (int v = 0; v < 2; v++) {
+    std::vector<double> sums(point_count), squares(point_count);
+    double seconds = time_on_threads(thread_count, [&](int id) {
+      for (size_t i = id; i < point_count; i += thread_count) {
+        bind_random_stream(rng_stream(7, i, 0));
+        double sum = 0.0, square = 0.0;
+        for (int s = 0; s < samples_per_point; s++) {
+          vec3 direction = variants[v].lights->random(points[i]);
+          double pdf = variants[v].lights->pdf_value(points[i], direction);
+          Ray ray(points[i], direction);
+          hit_record record;
+          double estimate = 0.0;
+          if (pdf > 0.0 && direction.y > 0.0 &&
+              variants[v].lights->hit(ray, interval(0.001, INFINITY_DOUBLE),
+                                      record)) {
+            color3 emission = record.material->emitted(
+                ray, record, record.textureCoordinate.u,
+                record.textureCoordinate.v, record.hitPoint);
+            double cosine = direction.y / direction.norm();
+            estimate = (emission.x + emission.y + emission.z) / 3.0 *
+                       cosine / pdf;
+          }
+          sum += estimate;
+          square += estimate * estimate;
+        }
+        sums[i] = sum;
+        squares[i] = square;
+      }
+    });
+
+    // noise of a single sample relative to the point's mean, averaged
+    double mean = 0.0, mean_variance = 0.0, relative_deviation = 0.0;
+    size_t lit_points = 0;
+    for (size_t i = 0; i < point_count; i++) {
+      double point_mean = sums[i] / samples_per_point;
+      double variance = std::max(0.0, squares[i] / samples_per_point -
+                                          point_mean * point_mean);
+      mean += point_mean / point_count;
+      mean_variance += variance / samples_per_point / point_count / point_count;
+      if (point_mean > 0.0) {
+        relative_deviation += std::sqrt(variance) / point_mean;
+        lit_points++;
+      }
+    }
+    relative_deviation /= std::max<size_t>(1, lit_points);
+    means[v] = mean;
+    standard_errors[v] = std::sqrt(mean_variance);
+
+    std::clog << variants[v].name << ":" << std::endl;
+    report_rate("light samples", double(point_count) * samples_per_point,
+                seconds, "samples");
+    std::clog << "  mean irradiance " << mean
+              << ", relative deviation per sample " << relative_deviation
+              << std::endl;
+  }
+
+  // unbiased samplers differ by noise only, a few standard errors at most
+  double difference = std::fabs(means[1] - means[0]);
+  double tolerance = 4 * std::sqrt(standard_errors[0] * standard_errors[0] +
+                                   standard_errors[1] * standard_errors[1]);
+  std::clog << "  means differ by " << difference << " (tolerance "
+            << tolerance << ")" << std::endl;
+  std::clog << (difference < tolerance ? "validation passed"
+                                       : "VALIDATION FAILED")
+            << std::endl;
+}
+
+// root mean square error of linear radiance over all pixels and channels
+double image_rmse(framebuffer const &image, framebuffer const &reference) {
+  double sum = 0.0;
+  for (int y = 0; y < image.get_height(); y++) {
+    for (int x = 0; x < image.get_width(); x++) {
+      color3 a = image.get(x, y), b = reference.get(x, y);
+      for (int c = 0; c < 3; c++)
+        sum += (a[c] - b[c]) * (a[c] - b[c]);
+    }
+  }
+  return std::sqrt(sum / (3.0 * image.get_width() * image.get_height()));
+}
+
+// independent samples with their own seed, uncorrelated with any test render
+framebuffer cornell_box_reference(hittable_list const &world,
+                                  hittable_list const &lights, int width,
+                                  int samples_per_pixel, int thread_count) {
+  Camera camera = cornell_box_camera(width, samples_per_pixel, thread_count);
+  camera.sampler_type = sampler_kind::independent;
+  camera.seed = 1000;
+  return camera.render_image(world, lights);
+}
+
+// error against a high sample count reference as the sample count grows,
+// for every sampler. 100 spp checks a count that is no power of two
+void benchmark_convergence(int thread_count) {
+  int const width = 64, reference_samples = 4096;
+  int const sample_counts[] = {1, 4, 16, 64, 100, 256};
+  std::clog << "convergence: Cornell box " << width << "x" << width
+            << ", reference " << reference_samples << " spp (independent), "
+            << thread_count << " thread(s)" << std::endl;
+
+  scene objects;
+  hittable_list lights;
+  hittable_list world = cornell_box_world(objects, lights);
+  framebuffer reference = cornell_box_reference(
+      world, lights, width, reference_samples, thread_count);
+  Camera camera = cornell_box_camera(width, 1, thread_count);
+
+  sampler_kind const kinds[] = {sampler_kind::independent,
+                                sampler_kind::stratified, sampler_kind::sobol,
+                                sampler_kind::halton};
+  std::vector<std::vector<double>> errors;
+  for (int samples : sample_counts) {
+    std::vector<double> row;
+    for (sampler_kind kind : kinds) {
+      camera.sample_per_pixel = samples;
+      camera.sampler_type = kind;
+      camera.seed = 0;
+      row.push_back(image_rmse(camera.render_image(world, lights),
+                                 reference));
+    }
+    errors.push_back(row);
+  }
+
+  // the table goes after the renders' own progress output
+  std::clog << std::left << std::setw(13) << "  spp";
+  for (sampler_kind kind : kinds)
+    std::clog << std::setw(13) << sampler_name(kind);
+  std::clog << std::right << std::endl;
+  for (size_t i = 0; i < errors.size(); i++) {
+    std::clog << "  " << std::left << std::setw(11) << sample_counts[i];
+    for (double error : errors[i])
+      std::clog << std::setw(13) << std::fixed << std::setprecision(3)
+                << error;
+    std::clog << std::right << std::defaultfloat << std::setprecision(6)
+              << std::endl;
+  }
+}
+
+// adaptive sampling against uniform sampling with the same total number of
+// samples, both compared with the reference
+void benchmark_adaptive(int thread_count) {
+  int const width = 64, reference_samples = 4096;
+  int const base_samples = 16, max_samples = 512;
+  double const target_error = 0.2;
+  std::clog << "adaptive: Cornell box " << width << "x" << width
+            << ", reference " << reference_samples << " spp, " << base_samples
+            << " spp base, up to " << max_samples << " spp, target error "
+            << target_error << ", " << thread_count << " thread(s)"
+            << std::endl;
+
+  scene objects;
+  hittable_list lights;
+  hittable_list world = cornell_box_world(objects, lights);
+  framebuffer reference = cornell_box_reference(
+      world, lights, width, reference_samples, thread_count);
+
+  Camera camera = cornell_box_camera(width, base_samples, thread_count);
+  camera.adaptive_max_spp = max_samples;
+  camera.adaptive_error = target_error;
+  auto start = std::chrono::steady_clock::now();
+  framebuffer adaptive = camera.render_image(world, lights);
+  double adaptive_seconds = seconds_since(start);
+  double average_samples =
+      double(camera.last_sample_count()) / (double(width) * width);
+
+  camera.adaptive_max_spp = 0;
+  camera.sample_per_pixel = int(average_samples + 0.5);
+  start = std::chrono::steady_clock::now();
+  framebuffer uniform = camera.render_image(world, lights);
+  double uniform_seconds = seconds_since(start);
+
+  std::clog << "  uniform  " << camera.sample_per_pixel << " spp: rmse "
+            << image_rmse(uniform, reference) << ", " << uniform_seconds
+            << " s" << std::endl;
+  std::clog << "  adaptive " << average_samples << " spp on average: rmse "
+            << image_rmse(adaptive, reference) << ", " << adaptive_seconds
+            << " s" << std::endl;
+}
+
+// closest-hit distances of two different intersection routines for the same
+// geometry, which only agree up to rounding
+size_t count_distance_mismatches(hittable const &reference,
+                                 hittable const &candidate,
+                                 std::vector<Ray> const &rays) {
+  size_t mismatches = 0;
+  for (auto const &ray : rays) {
+    hit_record expected, actual;
+    bool expected_hit =
+        reference.hit(ray, interval(0.001, INFINITY_DOUBLE), expected);
+    bool actual_hit =
+        candidate.hit(ray, interval(0.001, INFINITY_DOUBLE), actual);
+    if (expected_hit != actual_hit ||
+        (expected_hit &&
+         (std::fabs(expected.factorOfDirection - actual.factorOfDirection) >
+              1e-6 * expected.factorOfDirection ||
+          dotProduct(expected.normalAgainstRay, actual.normalAgainstRay) <
+              0.999)))
+      mismatches++;
+  }
+  return mismatches;
+}
+
+// the two rotated boxes of the Cornell box, built by make_box
+hittable_list cornell_boxes(
+    std::function<shared_ptr<hittable>(point3 const &, point3 const &,
+                                       shared_ptr<Material>)> const &make_box) {
+  auto white = make_shared<lambertian>(color3(.73, .73, .73));
+  hittable_list boxes;
+  boxes.add(make_shared<translate>(
+      make_shared<rotate_y>(make_box(point3(0, 0, 0), point3(165, 330, 165),
+                                     white),
+                            15),
+      vec3(265, 0, 295)));
+  boxes.add(make_shared<translate>(
+      make_shared<rotate_y>(make_box(point3(0, 0, 0), point3(165, 165, 165),
+                                     white),
+                            -18),
+      vec3(130, 0, 65)));
+  return boxes;
+}
+
+// 1 / pdf averaged over the light's own samples is the solid angle it
+// covers, which hits of uniform directions estimate independently
+void report_solid_angle(hittable const &light, point3 const &origin,
+                        int samples) {
+  double inverse_pdf = 0.0, hits = 0.0;
+  for (int i = 0; i < samples; i++) {
+    inverse_pdf += 1.0 / light.pdf_value(origin, light.random(origin));
+    hit_record record;
+    hits += light.hit(Ray(origin, generate_random_diffused_unitVector()),
+                      interval(0.001, INFINITY_DOUBLE), record);
+  }
+  std::clog << "  solid angle from " << origin << ": " << inverse_pdf / samples
+            << " by pdf, " << 4 * PI * hits / samples << " by hits"
+            << std::endl;
+}
+
+// boxes as six quads each against one aa_box each: final_scene's ground
+// under a bvh and the Cornell box's instanced pair. then the aa_box light
+// pdf against the solid angle it covers
+void benchmark_boxes(int thread_count) {
+  int const resolution = 512;
+  size_t const ray_count = 1000000;
+  hittable_list quads = final_scene_primitives(false);
+  hittable_list boxes = final_scene_primitives(true);
+  std::clog << "boxes: final_scene geometry, " << quads.objects.size()
+            << " primitives with quad boxes, " << boxes.objects.size()
+            << " with aa_box, " << thread_count << " thread(s)" << std::endl;
+
+  linear_bvh quad_bvh(quads), box_bvh(boxes);
+  size_t quad_hits, box_hits;
+  double seconds =
+      trace_primary_rays(quad_bvh, resolution, thread_count, quad_hits);
+  report_rate("primary rays, six quads", double(resolution) * resolution,
+              seconds, "rays");
+  seconds = trace_primary_rays(box_bvh, resolution, thread_count, box_hits);
+  report_rate("primary rays, aa_box", double(resolution) * resolution,
+              seconds, "rays");
+
+  std::vector<Ray> rays = random_scene_rays(box_bvh.bounding_box(), ray_count);
+  report_rate("random rays, six quads", double(ray_count),
+              trace_rays(quad_bvh, rays, thread_count), "rays");
+  report_rate("random rays, aa_box", double(ray_count),
+              trace_rays(box_bvh, rays, thread_count), "rays");
+  std::clog << "  " << quad_hits << " and " << box_hits << " primary hits, "
+            << count_distance_mismatches(quad_bvh, box_bvh, rays) << " of "
+            << rays.size() << " random rays differ in distance or normal"
+            << std::endl;
+
+  hittable_list cornell_quads = cornell_boxes(
+      [](point3 const &a, point3 const &b, shared_ptr<Material> material) {
+        return shared_ptr<hittable>(box_sides(a, b, material));
+      });
+  hittable_list cornell_aa_boxes = cornell_boxes(
+      [](point3 const &a, point3 const &b, shared_ptr<Material> material) {
+        return box(a, b, material);
+      });
+  rays = random_scene_rays(aabb(point3(0, 0, 0), point3(555, 555, 555)),
+                           ray_count);
+  std::clog << "Cornell box pair, rotated and translated:" << std::endl;
+  report_rate("random rays, six quads", double(ray_count),
+              trace_rays(cornell_quads, rays, thread_count), "rays");
+  report_rate("random rays, aa_box", double(ray_count),
+              trace_rays(cornell_aa_boxes, rays, thread_count), "rays");
+  std::clog << "  "
+            << count_distance_mismatches(cornell_quads, cornell_aa_boxes, rays)
+            << " of " << rays.size()
+            << " random rays differ in distance or normal" << std::endl;
+
+  // as a light
+  auto light = make_shared<diffuse_light>(color3(1, 1, 1));
+  aa_box emitter(point3(-1, -0.5, -2), point3(2, 1.5, 1), light);
+  point3 const origins[] = {point3(0, 5, 6), point3(4, 0.5, -0.5),
+                            point3(0.5, 0.5, -0.5)};
+  bind_random_stream(rng_stream(2, 0, 0));
+  for (point3 const &origin : origins)
+    report_solid_angle(emitter, origin, 400000);
+}
+
+// chains of translate and rotate_y against the transform_instance they
+// collapse into: speed and agreement on the Cornell box pair, bounds of a
+// nested rotation, and light sampling through transformed lights
+void benchmark_instances(int thread_count) {
+  size_t const ray_count = 1000000;
+  std::clog << "instances: " << thread_count << " thread(s)" << std::endl;
+
+  hittable_list wrapped = cornell_boxes(
+      [](point3 const &a, point3 const &b, shared_ptr<Material> material) {
+        return box(a, b, material);
+      });
+  hittable_list collapsed;
+  for (auto const &chain : wrapped.objects)
+    collapsed.add(make_shared<transform_instance>(chain));
+
+  std::vector<Ray> rays = random_scene_rays(
+      aabb(point3(0, 0, 0), point3(555, 555, 555)), ray_count);
+  std::clog << "Cornell box pair:" << std::endl;
+  report_rate("random rays, translate(rotate_y)", double(ray_count),
+              trace_rays(wrapped, rays, thread_count), "rays");
+  report_rate("random rays, transform_instance", double(ray_count),
+              trace_rays(collapsed, rays, thread_count), "rays");
+  std::clog << "  " << count_distance_mismatches(wrapped, collapsed, rays)
+            << " of " << rays.size()
+            << " random rays differ in distance or normal" << std::endl;
+
+  auto white = make_shared<lambertian>(color3(.73, .73, .73));
+  shared_ptr<hittable> nested = box(point3(0, 0, 0), point3(1, 2, 3), white);
+  for (int level = 0; level < 4; level++)
+    nested = make_shared<rotate_y>(nested, 30);
+  transform_instance folded(nested);
+  std::clog << "box turned by 4 nested rotate_y(30): bounds area "
+            << nested->bounding_box().surface_area() << ", collapsed "
+            << folded.bounding_box().surface_area() << std::endl;
+
+  // as deep as hit_info records: traced in full. one level more is refused
+  // when it is built; a list grown deeper under an instance afterwards is
+  // traced without throwing
+  shared_ptr<hittable> deep = make_shared<sphere>(point3(0, 0, 0), 1.0, white);
+  for (int level = 0; level < hit_info::max_instance_depth; level++)
+    deep = make_shared<translate>(deep, vec3(0, 0, 1));
+  hit_record record;
+  Ray along_z(point3(0, 0, -100), vec3(0, 0, 1));
+  bool hit = deep->hit(along_z, interval(0.001, INFINITY_DOUBLE), record);
+  int refused = 0;
+  try {
+    translate too_deep(deep, vec3(0, 0, 1));
+  } catch (std::invalid_argument const &) {
+    refused++;
+  }
+  tlas forest;
+  forest.add_geometry(deep);
+  try {
+    forest.add_instance(0, affine_transform());
+  } catch (std::invalid_argument const &) {
+    refused++;
+  }
+  auto grown = make_shared<hittable_list>();
+  translate outer(grown, vec3(0, 0, 1));
+  grown->add(deep);
+  hit_record grown_record;
+  bool grown_hit =
+      outer.hit(along_z, interval(0.001, INFINITY_DOUBLE), grown_record);
+  std::clog << hit_info::max_instance_depth << " nested translate: "
+            << (hit ? "hit at z = " + std::to_string(record.hitPoint.z)
+                    : std::string("missed"))
+            << ", " << refused << " of 2 deeper instances refused, grown list "
+            << (grown_hit ? "traced" : "missed") << std::endl;
+
+  auto light = make_shared<diffuse_light>(color3(1, 1, 1));
+  bind_random_stream(rng_stream(3, 0, 0));
+  transform_instance turned_quad(
+      make_shared<quad>(point3(0, 0, 0), vec3(2, 0, 0), vec3(0, 0, 1), light),
+      affine_transform::translation(vec3(0, 4, 0)) *
+          affine_transform::rotation(vec3(1, 0, 1), 40) *
+          affine_transform::scaling(vec3(1.5, 1, 0.5)));
+  transform_instance squashed_sphere(
+      make_shared<sphere>(point3(0, 0, 0), 1.0, light),
+      affine_transform::translation(vec3(3, 1, -2)) *
+          affine_transform::scaling(vec3(2, 0.5, 1)));
+  std::clog << "rotated, scaled quad light:" << std::endl;
+  report_solid_angle(turned_quad, point3(0.5, 0, 0.5), 400000);
+  std::clog << "scaled sphere light:" << std::endl;
+  report_solid_angle(squashed_sphere, point3(0, 0, 0), 400000);
+}
+
+// writing a 4k frame: the old per-pixel write_color stream against the
+// image writer's formats, all into memory so the disk is not measured
+void benchmark_output(int thread_count) {
+  int const width = 3840, height = 2160;
+  std::clog << "output: " << width << "x" << height << " frame, "
+            << thread_count << " thread(s)" << std::endl;
+
+  rng_stream random(7, 0, 0);
+  framebuffer image(width, height);
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++) // some out of range values too
+      image.set(x, y,
+                color3(random.next_double() * 1.5 - 0.1,
+                       random.next_double() * random.next_double(),
+                       random.next_double() * 4.0));
+  image.set(0, 0, color3(std::nan(""), -1.0, 1e9));
+
+  std::ostringstream per_pixel;
+  auto start = std::chrono::steady_clock::now();
+  per_pixel << "P3\n" << width << " " << height << "\n255\n";
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++)
+      write_color(per_pixel, image.get(x, y));
+  double per_pixel_seconds = seconds_since(start);
+  std::clog << "  write_color p3  " << std::setw(8) << per_pixel_seconds * 1e3
+            << " ms " << std::setw(11) << per_pixel.str().size() << " bytes"
+            << std::endl;
+
+  image_writer writer(thread_count);
+  image_format const formats[] = {image_format::p3, image_format::p6,
+                                  image_format::pfm, image_format::raw};
+  char const *names[] = {"p3", "p6", "pfm", "raw"};
+  for (int i = 0; i < 4; i++) {
+    std::ostringstream out;
+    start = std::chrono::steady_clock::now();
+    writer.write(out, image, formats[i]);
+    double seconds = seconds_since(start);
+    std::clog << "  writer " << std::left << std::setw(9) << names[i]
+              << std::right << std::setw(8) << seconds * 1e3 << " ms "
+              << std::setw(11) << out.str().size() << " bytes";
+    if (formats[i] == image_format::p3)
+      std::clog << (out.str() == per_pixel.str() ? ", same bytes"
+                                                 : ", DIFFERENT bytes");
+    std::clog << std::endl;
+  }
+}
+
+// a closed lat-long sphere with a bumpy radius: segments * (rings - 1) * 2
+// triangles around shared vertices, poles included, with normals and uvs
+shared_ptr<mesh_data> bumpy_sphere_mesh(point3 const &center, double radius,
+                                        int segments, int rings) {
+  auto mesh = make_shared<mesh_data>();
+  auto radius_at = [&](double theta, double phi) {
+    return radius * (1.0 + 0.08 * std::sin(9 * theta) * std::sin(7 * phi));
+  };
+  mesh->positions.push_back(center + vec3(0, radius, 0));
+  mesh->uvs.insert(mesh->uvs.end(), {0.5, 1.0});
+  for (int ring = 1; ring < rings; ring++) {
+    double theta = PI * ring / rings;
+    for (int segment = 0; segment < segments; segment++) {
+      double phi = 2 * PI * segment / segments;
+      double r = radius_at(theta, phi);
+      mesh->positions.push_back(
+          center + r * vec3(std::sin(theta) * std::cos(phi), std::cos(theta),
+                            std::sin(theta) * std::sin(phi)));
+      mesh->uvs.insert(mesh->uvs.end(), {double(segment) / segments,
+                                         1.0 - double(ring) / rings});
+    }
+  }
+  mesh->positions.push_back(center - vec3(0, radius, 0));
+  mesh->uvs.insert(mesh->uvs.end(), {0.5, 0.0});
+
+  uint32_t bottom = uint32_t(mesh->positions.size() - 1);
+  auto at = [&](int ring, int segment) { // ring 1 .. rings - 1
+    return uint32_t(1 + (ring - 1) * segments + segment % segments);
+  };
+  auto add = [&](uint32_t a, uint32_t b, uint32_t c) {
+    mesh->indices.insert(mesh->indices.end(), {a, b, c});
+  };
+  for (int segment = 0; segment < segments; segment++) {
+    add(0, at(1, segment + 1), at(1, segment));
+    for (int ring = 1; ring + 1 < rings; ring++) {
+      add(at(ring, segment), at(ring, segment + 1), at(ring + 1, segment));
+      add(at(ring, segment + 1), at(ring + 1, segment + 1),
+          at(ring + 1, segment));
+    }
+    add(bottom, at(rings - 1, segment), at(rings - 1, segment + 1));
+  }
+
+  // vertex normals from the area weighted normals around each vertex
+  mesh->normals.assign(mesh->positions.size(), vec3(0, 0, 0));
+  for (size_t i = 0; i < mesh->indices.size(); i += 3) {
+    uint32_t const *corner = &mesh->indices[i];
+    vec3 normal = crossProduct(mesh->positions[corner[1]] -
+                                   mesh->positions[corner[0]],
+                               mesh->positions[corner[2]] -
+                                   mesh->positions[corner[0]]);
+    for (int k = 0; k < 3; k++)
+      mesh->normals[corner[k]] += normal;
+  }
+  for (auto &normal : mesh->normals)
+    normal = unit_vector(normal);
+  return mesh;
+}
+
+// largest distance between the corners of two meshes' triangles, which a
+// loader may number differently; infinite if the triangles don't line up
+double mesh_difference(mesh_data const &a, mesh_data const &b) {
+  if (a.indices.size() != b.indices.size() ||
+      a.normals.empty() != b.normals.empty() || a.uvs.empty() != b.uvs.empty())
+    return INFINITY_DOUBLE;
+  double difference = 0.0;
+  for (size_t i = 0; i < a.indices.size(); i++)
+    difference = std::fmax(difference, (a.positions[a.indices[i]] -
+                                        b.positions[b.indices[i]])
+                                           .norm());
+  return difference;
+}
+
+// a generated million triangle mesh: loading it back from obj and binary ply,
+// building its bvh, tracing it, and checking that no ray leaks through the
+// closed surface. the bvh is checked against testing every triangle on a
+// small mesh
+void benchmark_mesh(int thread_count) {
+  int const segments = 1000, rings = 501, resolution = 512;
+  size_t const ray_count = 1000000;
+  point3 const center(278, 278, 200);
+  std::clog << "mesh: bumpy sphere, " << 2 * segments * (rings - 1)
+            << " triangles, " << thread_count << " thread(s)" << std::endl;
+
+  auto start = std::chrono::steady_clock::now();
+  shared_ptr<mesh_data> data = bumpy_sphere_mesh(center, 250, segments, rings);
+  std::clog << "  generated in " << seconds_since(start) * 1e3 << " ms, "
+            << data->positions.size() << " vertices" << std::endl;
+
+  for (int format = 0; format < 2; format++) {
+    std::stringstream file;
+    if (format == 0)
+      write_obj(file, *data);
+    else
+      write_ply(file, *data);
+    size_t bytes = file.str().size();
+    start = std::chrono::steady_clock::now();
+    shared_ptr<mesh_data> loaded =
+        format == 0 ? read_obj(file) : read_ply(file);
+    double seconds = seconds_since(start);
+    std::clog << "  " << (format == 0 ? "obj" : "binary ply") << ": "
+              << bytes / (1 << 20) << " MiB read in " << seconds * 1e3
+              << " ms, " << loaded->triangle_count() / seconds * 1e-6
+              << " M triangles/s, corners within "
+              << mesh_difference(*data, *loaded) << std::endl;
+  }
+
+  auto white = make_shared<lambertian>(color3(.73, .73, .73));
+  triangle_mesh mesh(data, white);
+  std::clog << "  bvh: " << mesh.node_count() << " nodes built in "
+            << mesh.build_time() * 1e3 << " ms; "
+            << double(data->memory_bytes() + mesh.memory_bytes()) /
+                   mesh.triangle_count()
+            << " bytes per triangle with the vertex buffers" << std::endl;
+
+  size_t hit_count;
+  double seconds =
+      trace_primary_rays(mesh, resolution, thread_count, hit_count);
+  report_rate("primary rays", double(resolution) * resolution, seconds,
+              "rays");
+  std::vector<Ray> rays = random_scene_rays(mesh.bounding_box(), ray_count);
+  report_rate("random rays", double(ray_count),
+              trace_rays(mesh, rays, thread_count), "rays");
+
+  // from near the center every direction leaves through the surface
+  bind_random_stream(rng_stream(4, 0, 0));
+  size_t leaks = 0;
+  for (size_t i = 0; i < ray_count; i++) {
+    point3 origin = center + 100 * random_double() *
+                                 generate_random_diffused_unitVector();
+    hit_record record;
+    if (!mesh.hit(Ray(origin, generate_random_diffused_unitVector()),
+                  interval(0.001, INFINITY_DOUBLE), record))
+      leaks++;
+  }
+  std::clog << "  " << leaks << " of " << ray_count
+            << " rays from inside escaped the closed mesh" << std::endl;
+
+  // every triangle its own mesh, tested one after the other
+  shared_ptr<mesh_data> small = bumpy_sphere_mesh(center, 250, 64, 33);
+  triangle_mesh small_mesh(small, white);
+  hittable_list every_triangle;
+  for (size_t i = 0; i < small->indices.size(); i += 3) {
+    auto single = make_shared<mesh_data>();
+    for (int k = 0; k < 3; k++)
+      single->positions.push_back(small->positions[small->indices[i + k]]);
+    single->indices = {0, 1, 2};
+    every_triangle.add(make_shared<triangle_mesh>(single, white));
+  }
+  std::vector<Ray> validation_rays(rays.begin(), rays.begin() + 20000);
+  std::clog << "  " << small_mesh.triangle_count() << " triangles: "
+            << count_mismatches(every_triangle, small_mesh, validation_rays)
+            << " of " << validation_rays.size()
+            << " random rays differ from testing every triangle" << std::endl;
+}
+
+// the forest scene's 100k instances: memory against copying the geometry per
+// instance, speed and agreement against one transform_instance per instance
+// under a linear_bvh, and a small render of the whole scene
+void benchmark_tlas(int thread_count) {
+  int const tree_count = 50000;
+  size_t const ray_count = 1000000;
+  std::clog << "tlas: forest of " << tree_count << " trees, "
+            << thread_count << " thread(s)" << std::endl;
+
+  scene objects;
+  auto start = std::chrono::steady_clock::now();
+  shared_ptr<tlas> forest = forest_instances(objects, tree_count);
+  double seconds = seconds_since(start);
+
+  size_t unique_bytes = 0, copied_bytes = 0, triangles = 0;
+  std::vector<size_t> geometry_bytes, geometry_triangles;
+  for (size_t g = 0; g < forest->geometry_count(); g++) {
+    auto const &mesh =
+        dynamic_cast<triangle_mesh const &>(*forest->geometry(g));
+    geometry_bytes.push_back(mesh.get_data().memory_bytes() +
+                             mesh.memory_bytes());
+    geometry_triangles.push_back(mesh.triangle_count());
+    unique_bytes += geometry_bytes.back();
+  }
+  hittable_list separate;
+  for (size_t i = 0; i < forest->instance_count(); i++) {
+    blas_instance const &instance = forest->instance(i);
+    for (size_t g = 0; g < forest->geometry_count(); g++) {
+      if (forest->geometry(g).get() != &instance.blas())
+        continue;
+      copied_bytes += geometry_bytes[g];
+      triangles += geometry_triangles[g];
+      separate.add(make_shared<transform_instance>(
+          forest->geometry(g), instance.object_to_world()));
+    }
+  }
+  std::clog << "  " << forest->instance_count() << " instances of "
+            << forest->geometry_count() << " meshes, " << triangles
+            << " triangles placed, built in " << seconds * 1e3 << " ms"
+            << std::endl;
+  std::clog << "  meshes " << unique_bytes / 1024 << " KiB + instances and "
+            << "top level " << forest->memory_bytes() / 1024
+            << " KiB; a copy per instance would take "
+            << copied_bytes / (1 << 20) << " MiB" << std::endl;
+
+  start = std::chrono::steady_clock::now();
+  linear_bvh flat(separate);
+  std::clog << "  transform_instances under a linear_bvh built in "
+            << seconds_since(start) * 1e3 << " ms, "
+            << separate.objects.size() * sizeof(transform_instance) / 1024
+            << " KiB of instances" << std::endl;
+
+  std::vector<Ray> rays = random_scene_rays(forest->bounding_box(), ray_count);
+  report_rate("random rays, tlas", double(ray_count),
+              trace_rays(*forest, rays, thread_count), "rays");
+  report_rate("random rays, linear_bvh", double(ray_count),
+              trace_rays(flat, rays, thread_count), "rays");
+  std::clog << "  " << count_distance_mismatches(flat, *forest, rays)
+            << " of " << rays.size()
+            << " random rays differ in distance or normal" << std::endl;
+
+  hittable_list lights;
+  hittable_list world = forest_world(objects, lights, forest);
+  Camera camera;
+  camera.aspect_ratio = 16.0 / 9.0;
+  camera.image_width = 320;
+  camera.sample_per_pixel = 4;
+  camera.max_depth = 20;
+  camera.background = color3(0.5, 0.65, 0.9);
+  camera.vFov = 40;
+  camera.lookfrom = point3(0, 28, -530);
+  camera.lookat = point3(40, 0, -420);
+  camera.thread_count = thread_count;
+  start = std::chrono::steady_clock::now();
+  camera.render_image(world, lights);
+  report_rate("render, 320x180 at 4 spp", double(camera.last_sample_count()),
+              seconds_since(start), "samples");
+}
+
+// a frame loop over the forest's instances: the tlas is updated by refitting
+// (and partial rebuilds) against a full build of the same frame, for gentle
+// wind and for a storm carrying a twentieth of the trees far off. the updated
+// tree must find the same hits as a fresh one
+void benchmark_refit(int thread_count) {
+  int const tree_count = 50000, frame_count = 24;
+  double const rebuild_threshold = 1.5;
+  size_t const ray_count = 200000;
+  std::clog << "refit: forest of " << tree_count << " trees, " << frame_count
+            << " frames, rebuild threshold " << rebuild_threshold << ", "
+            << thread_count << " thread(s)" << std::endl;
+
+  for (int storm = 0; storm < 2; storm++) {
+    scene objects;
+    shared_ptr<tlas> forest = forest_instances(objects, tree_count);
+    std::vector<affine_transform> rest;
+    for (size_t i = 0; i < forest->instance_count(); i++)
+      rest.push_back(forest->instance(i).object_to_world());
+    std::vector<vec3> drift(rest.size() / 2);
+    bind_random_stream(rng_stream(7, 0, 0));
+    for (auto &velocity : drift)
+      if (random_double() < 0.05)
+        velocity = vec3(random_double(-1, 1), random_double(0, 0.5),
+                        random_double(-1, 1)) * 400.0;
+
+    double update_seconds = 0.0, build_seconds = 0.0;
+    size_t rebuilt_subtrees = 0, rebuilt_nodes = 0, full_rebuilds = 0;
+    double cost_ratio = 0.0;
+    tlas fresh = *forest;
+    for (int frame = 1; frame <= frame_count; frame++) {
+      double time = frame / 24.0;
+      sway_forest(*forest, rest, time);
+      if (storm) // crown and trunk of a tree fly together
+        for (size_t i = 0; i < forest->instance_count(); i++)
+          forest->set_transform(
+              i, affine_transform::translation(drift[i / 2] * time) *
+                     forest->instance(i).object_to_world());
+
+      auto start = std::chrono::steady_clock::now();
+      auto result = forest->update(rebuild_threshold, thread_count);
+      update_seconds += seconds_since(start);
+      rebuilt_subtrees += result.rebuilt_subtrees;
+      rebuilt_nodes += result.rebuilt_nodes;
+      full_rebuilds += result.rebuilt_all;
+
+      fresh = *forest;
+      start = std::chrono::steady_clock::now();
+      fresh.build();
+      build_seconds += seconds_since(start);
+      cost_ratio += forest->sah_cost() / fresh.sah_cost();
+    }
+
+    std::clog << (storm ? "storm" : "wind") << ":" << std::endl;
+    std::clog << "  per frame: update " << update_seconds / frame_count * 1e3
+              << " ms, full build " << build_seconds / frame_count * 1e3
+              << " ms" << std::endl;
+    std::clog << "  " << rebuilt_subtrees << " subtrees (" << rebuilt_nodes
+              << " nodes) and " << full_rebuilds
+              << " whole trees rebuilt; sah cost " << cost_ratio / frame_count
+              << "x a full build's on average" << std::endl;
+
+    std::vector<Ray> rays =
+        random_scene_rays(forest->bounding_box(), ray_count);
+    report_rate("random rays, updated", double(ray_count),
+                trace_rays(*forest, rays, thread_count), "rays");
+    report_rate("random rays, built", double(ray_count),
+                trace_rays(fresh, rays, thread_count), "rays");
+    std::clog << "  " << count_mismatches(fresh, *forest, rays) << " of "
+              << rays.size() << " random rays differ" << std::endl;
+  }
+}
+
+// nextWeek's bouncing spheres on a grid of (2 half_width)^2 cells: most
+// small spheres jump up by up to bounce during the shutter
+hittable_list bouncing_spheres(int half_width, double bounce) {
+  bind_random_stream(rng_stream(8, 0, 0));
+  hittable_list spheres;
+  auto ground = make_shared<lambertian>(color3(0.5, 0.5, 0.5));
+  spheres.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground));
+  spheres.add(make_shared<sphere>(point3(0, 1, 0), 1.0,
+                                  make_shared<dielectric>(1.5)));
+  spheres.add(make_shared<sphere>(
+      point3(-4, 1, 0), 1.0, make_shared<lambertian>(color3(0.4, 0.2, 0.1))));
+  spheres.add(make_shared<sphere>(
+      point3(4, 1, 0), 1.0, make_shared<metal>(color3(0.7, 0.6, 0.5), 0.0)));
+
+  auto diffuse = make_shared<lambertian>(color3(0.6, 0.3, 0.2));
+  auto shiny = make_shared<metal>(color3(0.8, 0.8, 0.7), 0.2);
+  for (int x = -half_width; x < half_width; x++) {
+    for (int z = -half_width; z < half_width; z++) {
+      double choose_material = random_double();
+      point3 center(x + 0.9 * random_double(), 0.2,
+                    z + 0.9 * random_double());
+      if ((center - point3(4, 0.2, 0)).norm() <= 0.9)
+        continue;
+      if (choose_material < 0.8)
+        spheres.add(make_shared<sphere>(
+            center, center + vec3(0, random_double(0, bounce), 0), 0.2,
+            diffuse));
+      else
+        spheres.add(make_shared<sphere>(center, 0.2, shiny));
+    }
+  }
+  return spheres;
+}
+
+// rays through the scene as a camera with motion blur casts them: each at
+// a random time in the shutter. camera rays from nextWeek's viewpoint, and
+// random rays among the small spheres
+void motion_blur_rays(int half_width, double bounce, size_t count,
+                      std::vector<Ray> &camera_rays,
+                      std::vector<Ray> &random_rays) {
+  point3 lookfrom(13, 2, 3), lookat(0, 0, 0);
+  vec3 w = unit_vector(lookfrom - lookat);
+  vec3 u = unit_vector(crossProduct(vec3(0, 1, 0), w));
+  vec3 v = crossProduct(w, u);
+  double half_height = std::tan(degrees_to_radians(20) / 2);
+  int resolution = int(std::sqrt(double(count)));
+
+  random_rays = random_scene_rays(
+      aabb(point3(-half_width, 0, -half_width),
+           point3(half_width, 0.4 + bounce, half_width)),
+      count);
+  for (auto &ray : random_rays)
+    ray = Ray(ray.getOrigin(), ray.getDirection(), random_double());
+
+  camera_rays.clear();
+  for (int y = 0; y < resolution; y++) {
+    for (int x = 0; x < resolution; x++) {
+      double px = (2.0 * (x + 0.5) / resolution - 1.0) * half_height * 1.5;
+      double py = (1.0 - 2.0 * (y + 0.5) / resolution) * half_height;
+      camera_rays.push_back(
+          Ray(lookfrom, px * u + py * v - w, random_double()));
+    }
+  }
+}
+
+// node boxes tested per closest-hit query, on average
+double average_node_visits(motion_bvh const &bvh,
+                           std::vector<Ray> const &rays) {
+  size_t visits = 0;
+  for (auto const &ray : rays)
+    visits += bvh.node_visits(ray, interval(0.001, INFINITY_DOUBLE));
+  return double(visits) / std::max<size_t>(1, rays.size());
+}
+
+// bouncing spheres through a motion_bvh, which interpolates node bounds at
+// the ray's time, against the same tree bounded over the whole shutter and
+// against linear_bvh. the bounces are nextWeek's and eight times as high
+void benchmark_motion(int thread_count) {
+  size_t const ray_count = 250000;
+  std::clog << "motion: bouncing spheres, rays at random shutter times, "
+            << thread_count << " thread(s)" << std::endl;
+
+  struct variant {
+    int half_width;
+    double bounce;
+  };
+  for (variant const &run : {variant{11, 0.5}, variant{50, 0.5},
+                             variant{50, 4.0}}) {
+    hittable_list spheres = bouncing_spheres(run.half_width, run.bounce);
+    std::vector<Ray> camera_rays, random_rays;
+    motion_blur_rays(run.half_width, run.bounce, ray_count, camera_rays,
+                     random_rays);
+    std::clog << spheres.objects.size() << " spheres, bounce " << run.bounce
+              << ":" << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    linear_bvh flat(spheres);
+    double flat_seconds = seconds_since(start);
+    motion_bvh swept(spheres, bvh_build_options(), false);
+    start = std::chrono::steady_clock::now();
+    motion_bvh moving(spheres);
+    double moving_seconds = seconds_since(start);
+    std::clog << "  build: linear_bvh " << flat_seconds * 1e3
+              << " ms, motion_bvh " << moving_seconds * 1e3 << " ms ("
+              << moving.node_count() << " nodes, "
+              << moving.memory_bytes() / 1024 << " KiB)" << std::endl;
+
+    for (int set = 0; set < 2; set++) {
+      auto const &rays = set == 0 ? camera_rays : random_rays;
+      char const *name = set == 0 ? "camera" : "random";
+      std::clog << "  " << name << " rays: "
+                << average_node_visits(swept, rays)
+                << " node visits per ray with shutter bounds, "
+                << average_node_visits(moving, rays) << " interpolated"
+                << std::endl;
+      report_rate(std::string(name) + " rays, linear_bvh", double(rays.size()),
+                  trace_rays(flat, rays, thread_count), "rays");
+      report_rate(std::string(name) + " rays, shutter bounds",
+                  double(rays.size()), trace_rays(swept, rays, thread_count),
+                  "rays");
+      report_rate(std::string(name) + " rays, motion_bvh",
+                  double(rays.size()), trace_rays(moving, rays, thread_count),
+                  "rays");
+      std::clog << "  " << count_mismatches(flat, moving, rays) << " of "
+                << rays.size() << " differ from linear_bvh" << std::endl;
+    }
+  }
+}
+
+// final_scene's primary rays in blocks of 4x4 pixels, one block after the
+// other, so consecutive rays are neighbours the way a tile's are
+std::vector<Ray> blocked_primary_rays(int resolution) {
+  point3 lookfrom(478, 278, -600), lookat(278, 278, 0);
+  vec3 w = unit_vector(lookfrom - lookat);
+  vec3 u = unit_vector(crossProduct(vec3(0, 1, 0), w));
+  vec3 v = crossProduct(w, u);
+  double half_height = std::tan(degrees_to_radians(40) / 2);
+  std::vector<Ray> rays;
+  for (int block_y = 0; block_y < resolution; block_y += 4)
+    for (int block_x = 0; block_x < resolution; block_x += 4)
+      for (int y = block_y; y < block_y + 4; y++)
+        for (int x = block_x; x < block_x + 4; x++) {
+          double px = (2.0 * (x + 0.5) / resolution - 1.0) * half_height;
+          double py = (1.0 - 2.0 * (y + 0.5) / resolution) * half_height;
+          rays.push_back(Ray(lookfrom, px * u + py * v - w));
+        }
+  return rays;
+}
+
+// closest hits of consecutive rays in packets of packet_size, or one by one
+// for 1. records gets every ray's hit, hits whether there was one
+double trace_packets(hittable const &world, std::vector<Ray> const &rays,
+                     int packet_size, std::vector<hit_record> &records,
+                     std::vector<uint8_t> &hits) {
+  records.assign(rays.size(), hit_record());
+  hits.assign(rays.size(), 0);
+  auto start = std::chrono::steady_clock::now();
+  for (size_t first = 0; first < rays.size(); first += packet_size) {
+    size_t count = std::min(rays.size() - first, size_t(packet_size));
+    if (packet_size == 1) {
+      hits[first] = world.hit(rays[first], interval(0.001, INFINITY_DOUBLE),
+                              records[first]);
+      continue;
+    }
+    ray_packet packet;
+    for (size_t i = 0; i < count; i++)
+      packet.add(rays[first + i], interval(0.001, INFINITY_DOUBLE));
+    uint32_t packet_hits = world.hit(packet, &records[first]);
+    for (size_t i = 0; i < count; i++)
+      hits[first + i] = (packet_hits >> i) & 1;
+  }
+  return seconds_since(start);
+}
+
+// nextWeek's Cornell box with its two boxes as smoke and fog: media draw
+// where a ray scatters while they are intersected
+hittable_list cornell_smoke_world(scene &objects, hittable_list &lights) {
+  hittable_list world;
+
+  auto red = objects.create<lambertian>(color3(.65, .05, .05));
+  auto white = objects.create<lambertian>(color3(.73, .73, .73));
+  auto green = objects.create<lambertian>(color3(.12, .45, .15));
+  auto light = objects.create<diffuse_light>(color3(7, 7, 7));
+
+  world.add(objects.create<quad>(point3(555, 0, 0), vec3(0, 555, 0),
+                                 vec3(0, 0, 555), green));
+  world.add(objects.create<quad>(point3(0, 0, 0), vec3(0, 555, 0),
+                                 vec3(0, 0, 555), red));
+  world.add(objects.create<quad>(point3(113, 554, 127), vec3(330, 0, 0),
+                                 vec3(0, 0, 305), light));
+  world.add(objects.create<quad>(point3(0, 555, 0), vec3(555, 0, 0),
+                                 vec3(0, 0, 555), white));
+  world.add(objects.create<quad>(point3(0, 0, 0), vec3(555, 0, 0),
+                                 vec3(0, 0, 555), white));
+  world.add(objects.create<quad>(point3(0, 0, 555), vec3(555, 0, 0),
+                                 vec3(0, 555, 0), white));
+
+  auto tall = objects.create<transform_instance>(
+      box(point3(0, 0, 0), point3(165, 330, 165), white, &objects),
+      affine_transform::translation(vec3(265, 0, 295)) *
+          affine_transform::rotation_y(15));
+  auto short_box = objects.create<transform_instance>(
+      box(point3(0, 0, 0), point3(165, 165, 165), white, &objects),
+      affine_transform::translation(vec3(130, 0, 65)) *
+          affine_transform::rotation_y(-18));
+  world.add(objects.create<constant_medium>(tall, 0.01, color3(0, 0, 0)));
+  world.add(objects.create<constant_medium>(short_box, 0.01, color3(1, 1, 1)));
+
+  world = hittable_list(objects.create<linear_bvh>(world));
+
+  lights.add(objects.create<quad>(point3(113, 554, 127), vec3(330, 0, 0),
+                                  vec3(0, 0, 305), light));
+  return world;
+}
+
+// camera ray packets against single rays: the closest hits of final_scene's
+// primary rays, then whole Cornell box renders of the visibility preview and
+// of paths, whose first bounce is what packets trace, with a sampler that
+// draws everything from the sample's stream too, and of paths through smoke,
+// which must not be traced in packets. packets must find the very same
+// hits, and the renders must be the same images
+void benchmark_packets(int thread_count) {
+  int const resolution = 512;
+  std::clog << "packets: simd level " << simd_level_name(detect_simd_level())
+            << ", " << thread_count << " thread(s) for the renders"
+            << std::endl;
+
+  hittable_list primitives = final_scene_primitives();
+  linear_bvh world(primitives);
+  std::vector<Ray> rays = blocked_primary_rays(resolution);
+  std::clog << "final_scene geometry, " << rays.size() << " primary rays:"
+            << std::endl;
+  std::vector<hit_record> single_records, records;
+  std::vector<uint8_t> single_hits, hits;
+  report_rate("one by one", double(rays.size()),
+              trace_packets(world, rays, 1, single_records, single_hits),
+              "rays");
+  for (int packet_size : {8, 16}) {
+    double seconds = trace_packets(world, rays, packet_size, records, hits);
+    size_t mismatches = 0;
+    for (size_t i = 0; i < rays.size(); i++)
+      if (hits[i] != single_hits[i] ||
+          (hits[i] && (records[i].factorOfDirection !=
+                           single_records[i].factorOfDirection ||
+                       records[i].material != single_records[i].material)))
+        mismatches++;
+    report_rate("packets of " + std::to_string(packet_size),
+                double(rays.size()), seconds, "rays");
+    std::clog << "  " << mismatches << " of " << rays.size()
+              << " hits differ" << std::endl;
+  }
+
+  scene objects;
+  hittable_list lights, smoke_lights;
+  hittable_list cornell = cornell_box_world(objects, lights);
+  hittable_list smoke = cornell_smoke_world(objects, smoke_lights);
+  struct render {
+    char const *name;
+    hittable const *world, *lights;
+    bool visibility;
+    int width, spp;
+    sampler_kind sampler;
+  } const renders[] = {
+      {"Cornell box visibility preview", &cornell, &lights, true, 400, 16,
+       sampler_kind::sobol},
+      {"Cornell box paths", &cornell, &lights, false, 200, 8,
+       sampler_kind::sobol},
+      {"Cornell box paths, independent sampler", &cornell, &lights, false, 200,
+       8, sampler_kind::independent},
+      {"Cornell smoke paths", &smoke, &smoke_lights, false, 200, 8,
+       sampler_kind::sobol}};
+  for (auto const &r : renders) {
+    std::clog << r.name << ", " << r.width << "x" << r.width << " at "
+              << r.spp << " spp:" << std::endl;
+    Camera camera = cornell_box_camera(r.width, r.spp, thread_count);
+    camera.visibility_only = r.visibility;
+    camera.sampler_type = r.sampler;
+    framebuffer reference;
+    for (int packet_size : {1, 8, 16}) {
+      camera.packet_size = packet_size;
+      auto start = std::chrono::steady_clock::now();
+      framebuffer image = camera.render_image(*r.world, *r.lights);
+      double seconds = seconds_since(start);
+      if (packet_size == 1)
+        reference = image;
+      report_rate(packet_size == 1 ? std::string("one by one")
+                                   : "packets of " +
+                                         std::to_string(packet_size),
+                  double(camera.last_sample_count()), seconds, "samples");
+      if (packet_size > 1)
+        std::clog << "  image "
+                  << (image_rmse(image, reference) == 0.0 ? "identical"
+                                                          : "DIFFERS")
+                  << std::endl;
+    }
+  }
+}
+
+bool run_benchmark(std::string const &name, int thread_count) {
+  if (name == "rng")
+    benchmark_rng(thread_count);
+  else if (name == "bvh")
+    benchmark_bvh(thread_count);
+  else if (name == "wide")
+    benchmark_wide_bvh(thread_count);
+  else if (name == "lbvh")
+    benchmark_lbvh(thread_count);
+  else if (name == "occlusion")
+    benchmark_occlusion(thread_count);
+  else if (name == "alloc")
+    benchmark_allocations(thread_count);
+  else if (name == "lights")
+    benchmark_light_sampling(thread_count);
+  else if (name == "convergence")
+    benchmark_convergence(thread_count);
+  else if (name == "adaptive")
+    benchmark_adaptive(thread_count);
+  else if (name == "boxes")
+    benchmark_boxes(thread_count);
+  else if (name == "instances")
+    benchmark_instances(thread_count);
+  else if (name == "output")
+    benchmark_output(thread_count);
+  else if (name == "mesh")
+    benchmark_mesh(thread_count);
+  else if (name == "tlas")
+    benchmark_tlas(thread_count);
+  else if (name == "refit")
+    benchmark_refit(thread_count);
+  else if (name == "motion")
+    benchmark_motion(thread_count);
+  else if (name == "packets")
+    benchmark_packets(thread_count);
+  else
+    return false;
+  return true;
+}
+
+#endif // BENCHMARK_H
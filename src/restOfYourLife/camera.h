@@ -1,16 +1,29 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include "checkpoint.h"
 #include "color.h"
 #include "common.h"
+#include "framebuffer.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "image_writer.h"
 #include "material.h"
 #include "pdf.h"
 #include "ray.h"
+#include "ray_packet.h"
+#include "sampler.h"
+#include "tile_scheduler.h"
 #include "vec3.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <fstream>
 #include <memory>
+#include <string>
+#include <vector>
 
 template <typename toBlend>
 toBlend lerp(double fromStartToEnd, toBlend &startValue, toBlend &endValue) {
@@ -28,6 +41,11 @@ color3 background_color(Ray const &ray) {
   result = lerp(yFromBottomToTop, white, blue);
   return result;
 }
+enum class integrator_kind {
+  mixture, // 50/50 mixture of light and material pdfs, one ray per bounce
+  nee      // next event estimation with power-heuristic mis
+};
+
 class Camera {
 public:
   double aspect_ratio = 1.0;
@@ -41,36 +59,161 @@ public:
 
   int sample_per_pixel = 10;
   int max_depth = 10;
+  int russian_roulette_depth = 5; // max_depth or more: paths are never cut
+  integrator_kind integrator = integrator_kind::mixture;
+  sampler_kind sampler_type = sampler_kind::sobol;
 
   double focus_distance = 10;
   double defocus_angle = 0;
 
+  // adaptive sampling: after sample_per_pixel samples everywhere, pixels
+  // whose relative error (or a neighbour's) is above adaptive_error get more
+  // in rounds, up to adaptive_max_spp in total. every round adds as many as
+  // each pixel had when the rounds began, so the first doubles a pixel's
+  // count. adaptive_max_spp <= sample_per_pixel turns it off
+  int adaptive_max_spp = 0;
+  double adaptive_error = 0.1;
+  std::string heatmap_file; // where to write the samples per pixel, if set
+
+  // progressive rendering: samples are added in passes of pass_samples spp
+  // (0: all in one pass). after every pass the image so far replaces
+  // preview_file and the accumulated samples checkpoint_file, each written
+  // atomically. a render started from resume_file (a checkpoint) only adds
+  // the samples it is missing, and checkpoints back into it by default. it
+  // must be the same scene_name, resolution and sampling settings
+  int pass_samples = 0;
+  std::string preview_file, checkpoint_file, resume_file;
+  std::string scene_name;
+
+  // time-budgeted rendering: passes are sized to the throughput measured so
+  // far and the render stops between two passes once the next would not fit
+  // in time_budget seconds, so every pixel has the same spp (at most
+  // sample_per_pixel). adaptive rounds only start if they fit too.
+  // 0: no budget
+  double time_budget = 0.0;
+
+  // the final image goes to output_file (replaced atomically) or stdout
+  image_format output_format = image_format::p3;
+  std::string output_file;
+
+  int thread_count = 0; // 0: RT_THREADS environment variable or all cores
+  int tile_size = 16;
+
+  // camera rays go through the scene packet_size at a time (at most
+  // ray_packet::max_size, 1: one by one); each path goes on alone from its
+  // first hit. worlds with random_intersections() go one by one
+  int packet_size = 8;
+
+  // a preview of what the camera sees: samples are shaded by their first
+  // hit only, by its emission or by how directly it faces the camera
+  bool visibility_only = false;
+  uint64_t seed = 0;
+
   void render(hittable const &world_objects, hittable const &lights) {
-    initialize();
-    std::cout << "P3\n" << image_width << " " << image_height << "\n255\n";
+    framebuffer image = render_image(world_objects, lights);
+    image_writer writer(resolve_thread_count(thread_count));
+    if (output_file.empty())
+      writer.write(std::cout, image, output_format);
+    else
+      write_file_atomically(output_file, [&](std::ostream &out) {
+        writer.write(out, image, output_format);
+      });
+  }
 
-    for (int y = 0; y < image_height; y++) {
-      std::clog << "\rScanlines remaining: " << image_height - y << "    "
-                << std::flush;
-      for (int x = 0; x < image_width; x++) {
-        color3 pixel_color(0, 0, 0);
-        for (int stratified_y = 0; stratified_y < sqrt_spp; stratified_y++) {
-          for (int stratified_x = 0; stratified_x < sqrt_spp; stratified_x++) {
-            Ray sampleRay = getSampleRay(x, y, stratified_x, stratified_y);
-            color3 sample_pixel_color =
-                ray_color(sampleRay, max_depth, world_objects, lights);
-            pixel_color += sample_pixel_color;
-          }
-        }
+  // the image without writing it out; progress and timing go to std::clog
+  framebuffer render_image(hittable const &world_objects,
+                           hittable const &lights) {
+    initialize();
+    // a medium draws where a ray scatters while it is intersected, which
+    // needs that ray's own sample bound: no packets
+    batch_size = world_objects.random_intersections()
+                     ? 1
+                     : std::max(1, std::min(packet_size, ray_packet::max_size));
+    sample_accumulator samples(image_width, image_height);
+    if (!resume_file.empty()) {
+      samples = read_checkpoint(resume_file, progress_header());
+      std::clog << "Resuming " << resume_file << " at "
+                << samples.fewest_samples() << " spp\n";
+    }
+    uint64_t resumed_samples = samples.total_samples();
+
+    int threads = resolve_thread_count(thread_count);
+    std::vector<tile> tiles =
+        split_into_tiles(image_width, image_height, tile_size);
+    std::clog << "Rendering with " << threads << " thread(s), "
+              << tiles.size() << " tiles\n";
+    auto start = std::chrono::steady_clock::now();
+
+    // every pixel up to sample_per_pixel, pass by pass
+    uint32_t target = uint32_t(sample_per_pixel);
+    uint32_t pass = pass_samples > 0 ? uint32_t(pass_samples) : target;
+    std::vector<uint8_t> active; // empty: every pixel
+    uint64_t segments = 0;
+    double seconds_per_sample = 0.0; // wall time per pixel sample, measured
+    if (time_budget > 0.0)
+      pass = 1; // the first pass only measures the throughput
+    while (samples.fewest_samples() < target) {
+      auto pass_start = std::chrono::steady_clock::now();
+      uint64_t before = samples.total_samples();
+      segments += render_pass(tiles, threads, samples, active, pass, target,
+                              world_objects, lights);
+      save_progress(samples);
+      if (time_budget <= 0.0)
+        continue;
+
+      seconds_per_sample = seconds_since(pass_start) /
+                           double(samples.total_samples() - before);
+      pass = budgeted_pass(pass, seconds_per_sample, start);
+      if (pass == 0)
+        break;
+    }
 
-        pixel_color *= sample_scale;
-        write_color(std::cout, pixel_color);
-      }
+    // every round adds the count all pixels have now: the first doubles it
+    uint32_t batch = std::max(1u, samples.fewest_samples());
+    int rounds = 0;
+    while (adaptive_max_spp > sample_per_pixel &&
+           select_noisy_pixels(samples, active)) {
+      if (time_budget > 0.0 &&
+          seconds_per_sample * double(batch) *
+                  double(std::count(active.begin(), active.end(), 1)) >
+              budget_left(start))
+        break;
+      segments += render_pass(tiles, threads, samples, active, batch,
+                              uint32_t(adaptive_max_spp), world_objects,
+                              lights);
+      save_progress(samples);
+      rounds++;
     }
 
-    std::clog << "\rDone                              \n";
+    double seconds = seconds_since(start);
+    samples_taken = samples.total_samples() - resumed_samples;
+    double traced = double(samples_taken);
+    std::clog << "\rDone in " << seconds << " s";
+    // a resumed checkpoint may already hold every sample
+    if (samples_taken > 0)
+      std::clog << ", " << traced / seconds * 1e-6
+                << " Msamples/s, average path length " << segments / traced;
+    else
+      std::clog << ", no samples traced";
+    std::clog << "\n";
+    if (adaptive_max_spp > sample_per_pixel)
+      std::clog << "Adaptive: " << rounds << " extra round(s), average "
+                << samples.total_samples() /
+                       (double(image_width) * image_height)
+                << " spp\n";
+    if (time_budget > 0.0)
+      std::clog << "Budget: " << seconds << " of " << time_budget << " s, "
+                << samples.fewest_samples() << " spp, noise (rms relative "
+                << "error) " << samples.noise_estimate() << "\n";
+
+    if (!heatmap_file.empty())
+      write_image_file(heatmap_file, samples.heatmap(), threads);
+    return samples.resolve();
   }
 
+  // samples traced by the last render_image()
+  uint64_t last_sample_count() const { return samples_taken; }
+
 private:
   int image_height;
   point3 center;
@@ -78,11 +221,230 @@ private:
   vec3 pixel_delta_u, pixel_delta_v;
   vec3 defocus_disk_u, defocus_disk_v;
 
-  int sqrt_spp;
-  double reciprocal_sqrt_spp;
-
   vec3 u, v, w; // w指向观测方向的反方向（右手系），u指向相机右侧，v指向相机上侧
-  double sample_scale;
+  uint64_t samples_taken = 0;
+  int batch_size = 1; // camera rays per packet in this render
+
+  // one pass over the tiles: up to count more samples, but no more than
+  // limit in total, for every pixel in active (all of them if it is empty).
+  // returns the rays traced
+  uint64_t render_pass(std::vector<tile> const &tiles, int threads,
+                       sample_accumulator &samples,
+                       std::vector<uint8_t> const &active, uint32_t count,
+                       uint32_t limit, hittable const &world_objects,
+                       hittable const &lights) {
+    tile_scheduler scheduler(tiles, threads);
+    std::atomic<uint64_t> segments(0);
+    scheduler.run(
+        [&](tile const &t) {
+          segments += render_tile(t, samples, active, count, limit,
+                                  world_objects, lights);
+        },
+        [](size_t finished, size_t total) {
+          // a line per percent, not per tile: 4k frames have many tiles
+          if (finished * 100 / total != (finished - 1) * 100 / total ||
+              finished == total)
+            std::clog << "\rTiles remaining: " << total - finished << "    "
+                      << std::flush;
+        });
+    return segments;
+  }
+
+  static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+  }
+
+  // what is left of the time budget for passes, keeping a tenth of it for
+  // the variation between passes and writing the image
+  double budget_left(std::chrono::steady_clock::time_point start) const {
+    return 0.9 * time_budget - seconds_since(start);
+  }
+
+  // the spp of the next pass: what fits in the budget left, but at most
+  // twice the last pass so a wrong estimate can't overshoot much, and at
+  // most pass_samples if set. 0 when not even one spp fits
+  uint32_t budgeted_pass(uint32_t last_pass, double seconds_per_sample,
+                         std::chrono::steady_clock::time_point start) const {
+    double pixels = double(image_width) * image_height;
+    double fits = budget_left(start) / (seconds_per_sample * pixels);
+    if (!(fits >= 1.0))
+      return 0;
+    double pass = std::min(fits, 2.0 * last_pass);
+    if (pass_samples > 0)
+      pass = std::min(pass, double(pass_samples));
+    return uint32_t(pass);
+  }
+
+  checkpoint_header progress_header() const {
+    checkpoint_header header;
+    header.width = image_width;
+    header.height = image_height;
+    header.seed = seed;
+    header.sampler = uint32_t(sampler_type);
+    header.integrator = uint32_t(integrator);
+    header.samples_per_pixel = sample_per_pixel;
+    header.russian_roulette_depth = russian_roulette_depth;
+    header.scene = scene_id(scene_name);
+    return header;
+  }
+
+  // in the format its extension asks for
+  static void write_image_file(std::string const &path,
+                               framebuffer const &image, int threads) {
+    image_writer writer(threads);
+    write_file_atomically(path, [&](std::ostream &out) {
+      writer.write(out, image, image_format_for(path));
+    });
+  }
+
+  void save_progress(sample_accumulator const &samples) const {
+    std::string checkpoint =
+        checkpoint_file.empty() ? resume_file : checkpoint_file;
+    if (!checkpoint.empty())
+      write_checkpoint(checkpoint, progress_header(), samples);
+    if (!preview_file.empty())
+      write_image_file(preview_file, samples.resolve(),
+                       resolve_thread_count(thread_count));
+  }
+
+  // marks pixels below the sample limit whose own error or a neighbour's is
+  // above target; single pixels are too noisy to trust their own estimate.
+  // returns whether any pixel is left
+  bool select_noisy_pixels(sample_accumulator const &samples,
+                           std::vector<uint8_t> &active) const {
+    active.assign(size_t(image_width) * image_height, 0);
+    bool any = false;
+    for (int y = 0; y < image_height; y++) {
+      for (int x = 0; x < image_width; x++) {
+        if (samples.count(x, y) >= uint32_t(adaptive_max_spp))
+          continue;
+        int y_end = std::min(image_height - 1, y + 1);
+        int x_end = std::min(image_width - 1, x + 1);
+        double error = 0.0;
+        for (int ny = std::max(0, y - 1); ny <= y_end; ny++)
+          for (int nx = std::max(0, x - 1); nx <= x_end; nx++)
+            error = std::max(error, samples.relative_error(nx, ny));
+        if (error > adaptive_error) {
+          active[size_t(y) * image_width + x] = 1;
+          any = true;
+        }
+      }
+    }
+    return any;
+  }
+
+  // a camera sample waiting for the rest of its packet
+  class camera_sample {
+  public:
+    int x, y;
+    uint32_t index;
+  };
+
+  // returns the number of rays traced
+  uint64_t render_tile(tile const &t, sample_accumulator &samples,
+                       std::vector<uint8_t> const &active, uint32_t count,
+                       uint32_t limit, hittable const &world_objects,
+                       hittable const &lights) {
+    uint64_t segments = 0;
+    std::unique_ptr<sampler> pixel_sampler =
+        make_sampler(sampler_type, seed, sample_per_pixel);
+    bind_sampler(pixel_sampler.get());
+    camera_sample batch[ray_packet::max_size];
+    int pending = 0;
+    for (int y = t.y_begin; y < t.y_end; y++) {
+      for (int x = t.x_begin; x < t.x_end; x++) {
+        uint64_t pixel_index = uint64_t(y) * image_width + x;
+        if (!active.empty() && !active[pixel_index])
+          continue;
+
+        // sample indices carry on from earlier passes
+        uint32_t first = samples.count(x, y);
+        uint32_t last = std::max(first, std::min(first + count, limit));
+        for (uint32_t sample_index = first; sample_index < last;
+             sample_index++) {
+          batch[pending++] = camera_sample{x, y, sample_index};
+          if (pending == batch_size) {
+            segments += trace_samples(batch, pending, *pixel_sampler, samples,
+                                      world_objects, lights);
+            pending = 0;
+          }
+        }
+      }
+    }
+    if (pending > 0)
+      segments += trace_samples(batch, pending, *pixel_sampler, samples,
+                                world_objects, lights);
+    bind_sampler(nullptr);
+    return segments;
+  }
+
+  // every (pixel, sample) owns its sampler dimensions and its stream, so the
+  // image doesn't depend on which thread renders which tile, nor on which
+  // samples share a packet
+  void start_sample(camera_sample const &sample,
+                    sampler &pixel_sampler) const {
+    start_sample(sample, pixel_sampler,
+                 rng_stream(seed, sample_pixel(sample), sample.index, 1));
+  }
+
+  // the same sample with its stream where it was left, so the path goes on
+  // from the values its camera ray drew instead of drawing them again
+  void start_sample(camera_sample const &sample, sampler &pixel_sampler,
+                    rng_stream const &stream) const {
+    pixel_sampler.start_pixel_sample(sample_pixel(sample), sample.index);
+    bind_random_stream(stream);
+  }
+
+  uint64_t sample_pixel(camera_sample const &sample) const {
+    return uint64_t(sample.y) * image_width + sample.x;
+  }
+
+  // the samples' camera rays are drawn and traced as one packet, then each
+  // sample picks up where it left off to follow its path from the hit. a
+  // single sample is
+  // traced by its path, as every later bounce is. returns the rays traced
+  uint64_t trace_samples(camera_sample const *batch, int count,
+                         sampler &pixel_sampler, sample_accumulator &samples,
+                         hittable const &world_objects,
+                         hittable const &lights) const {
+    ray_packet packet;
+    rng_stream streams[ray_packet::max_size];
+    for (int i = 0; i < count; i++) {
+      start_sample(batch[i], pixel_sampler);
+      packet.add(getSampleRay(batch[i].x, batch[i].y, pixel_sampler),
+                 interval(0.001, Infinity_double));
+      streams[i] = current_random_stream();
+    }
+    hit_record records[ray_packet::max_size];
+    uint32_t hits = 0;
+    bool traced = count > 1;
+    if (traced)
+      hits = world_objects.hit(packet, records);
+
+    uint64_t segments = 0;
+    for (int i = 0; i < count; i++) {
+      if (traced)
+        start_sample(batch[i], pixel_sampler, streams[i]);
+      hit_record const *camera_hit = (hits >> i) & 1 ? &records[i] : nullptr;
+      color3 sample_pixel_color;
+      if (visibility_only) {
+        segments++;
+        if (!traced) {
+          start_bounce_dimensions(0);
+          if (world_objects.hit(packet.rays[i], packet.range(i), records[i]))
+            camera_hit = &records[i];
+        }
+        sample_pixel_color = visibility_color(packet.rays[i], camera_hit);
+      } else {
+        sample_pixel_color = ray_color(packet.rays[i], traced, camera_hit,
+                                       world_objects, lights, segments);
+      }
+      samples.add(batch[i].x, batch[i].y, sample_pixel_color);
+    }
+    return segments;
+  }
 
   void initialize() {
     // image
@@ -116,91 +478,269 @@ private:
     viewport_00_pixel_position =
         viewport_upper_left + 0.5 * (pixel_delta_u + pixel_delta_v);
 
-    // stratified sampling
-    sqrt_spp = int(std::sqrt(sample_per_pixel));
-    sample_scale = 1.0 / (sqrt_spp * sqrt_spp);
-    reciprocal_sqrt_spp = 1.0 / sqrt_spp;
+    sample_per_pixel = std::max(1, sample_per_pixel);
   }
 
-  color3 ray_color(Ray const &ray, int depth, hittable const &world_objects,
-                   hittable const &lights) {
-    if (depth <= 0)
-      return color3(0, 0, 0);
+  // if camera_traced, camera_hit is where the camera ray was found to hit,
+  // null if nowhere; else the path traces it. segments counts the rays
+  // traced, shadow rays included
+  color3 ray_color(Ray const &camera_ray, bool camera_traced,
+                   hit_record const *camera_hit, hittable const &world_objects,
+                   hittable const &lights, uint64_t &segments) const {
+    if (integrator == integrator_kind::nee)
+      return nee_path_color(camera_ray, camera_traced, camera_hit,
+                            world_objects, lights, segments);
+    return mixture_path_color(camera_ray, camera_traced, camera_hit,
+                              world_objects, lights, segments);
+  }
 
-    hit_record record;
+  // the hit of a path's ray at depth; the camera ray's may be known already
+  static bool next_hit(int depth, Ray const &ray, bool camera_traced,
+                       hit_record const *camera_hit,
+                       hittable const &world_objects, hit_record &record) {
+    if (depth > 0 || !camera_traced)
+      return world_objects.hit(ray, interval(0.001, Infinity_double), record);
+    if (camera_hit)
+      record = *camera_hit;
+    return camera_hit != nullptr;
+  }
 
-    if (!world_objects.hit(ray, interval(0.001, Infinity_double), record))
+  // light a surface gives off, else a grey by the cosine to the camera
+  color3 visibility_color(Ray const &ray, hit_record const *camera_hit) const {
+    if (!camera_hit)
       return background;
+    hit_record const &record = *camera_hit;
+    color3 emission =
+        record.material->emitted(ray, record, record.textureCoordinate.u,
+                                 record.textureCoordinate.v, record.hitPoint);
+    if (!is_black(emission))
+      return emission;
+    double facing = std::fabs(
+        dotProduct(unit_vector(ray.getDirection()), record.normalAgainstRay));
+    return color3(0.8, 0.8, 0.8) * facing;
+  }
 
-    return scattered_color(ray, depth, record, world_objects, lights);
+  // one path, bounce by bounce, carrying the product of the weights so far.
+  // directions come from a 50/50 mixture of the light and material pdfs
+  color3 mixture_path_color(Ray const &camera_ray, bool camera_traced,
+                            hit_record const *camera_hit,
+                            hittable const &world_objects,
+                            hittable const &lights, uint64_t &segments) const {
+    color3 radiance(0, 0, 0);
+    color3 throughput(1, 1, 1);
+    Ray ray = camera_ray;
+
+    for (int depth = 0; depth < max_depth; depth++) {
+      start_bounce_dimensions(depth);
+      segments++;
+      hit_record record;
+      if (!next_hit(depth, ray, camera_traced, camera_hit, world_objects,
+                    record)) {
+        radiance += cwiseProduct(throughput, background);
+        break;
+      }
+
+      color3 color_from_emission =
+          record.material->emitted(ray, record, record.textureCoordinate.u,
+                                   record.textureCoordinate.v, record.hitPoint);
+      radiance += cwiseProduct(throughput, color_from_emission);
+
+      scatter_record scatter_rec;
+      if (!record.material->Scatter(ray, record, scatter_rec))
+        break;
+
+      if (scatter_rec.skip_pdf) {
+        throughput = cwiseProduct(throughput, scatter_rec.attenuation);
+        ray = scatter_rec.skip_pdf_ray;
+      } else {
+        mixture_pdf p(hittable_pdf(lights, record.hitPoint),
+                      scatter_rec.direction_pdf);
+
+        Ray scattered_ray(record.hitPoint, p.generate(), ray.getTime());
+        auto pdf_value = p.value(scattered_ray.getDirection());
+        auto scattering_pdf =
+            record.material->Scatter_pdf(ray, record, scattered_ray);
+
+        throughput = cwiseProduct(throughput, scatter_rec.attenuation) *
+                     (scattering_pdf / pdf_value);
+        ray = scattered_ray;
+      }
+
+      if (!survives_roulette(depth, throughput))
+        break;
+    }
+
+    return radiance;
   }
 
-  color3 scattered_color(Ray const &ray, int depth, hit_record &record,
-                         hittable const &world_objects,
-                         hittable const &lights) {
-    color3 attenuation;
-    Ray scattered_ray;
-    color3 color_from_emission =
-        record.material->emitted(ray, record, record.textureCoordinate.u,
-                                 record.textureCoordinate.v, record.hitPoint);
+  // next event estimation: every diffuse vertex samples one light with a
+  // shadow ray and the material with the continuing ray. emission reached by
+  // either strategy is weighted with the power heuristic, so both can see
+  // every light without counting it twice.
+  // lights should carry their emitting material; lights without one are
+  // shaded with a full closest-hit query along the shadow ray
+  color3 nee_path_color(Ray const &camera_ray, bool camera_traced,
+                        hit_record const *camera_hit,
+                        hittable const &world_objects, hittable const &lights,
+                        uint64_t &segments) const {
+    color3 radiance(0, 0, 0);
+    color3 throughput(1, 1, 1);
+    Ray ray = camera_ray;
+    bool specular_bounce = true; // camera rays see emission unweighted
+    double material_pdf = 0.0;   // of the bounce that produced ray
+    point3 previous_point;
+
+    for (int depth = 0; depth < max_depth; depth++) {
+      start_bounce_dimensions(depth);
+      segments++;
+      hit_record record;
+      if (!next_hit(depth, ray, camera_traced, camera_hit, world_objects,
+                    record)) {
+        radiance += cwiseProduct(throughput, background);
+        break;
+      }
+
+      color3 emission =
+          record.material->emitted(ray, record, record.textureCoordinate.u,
+                                   record.textureCoordinate.v, record.hitPoint);
+      if (!is_black(emission)) {
+        double weight = 1.0;
+        if (!specular_bounce)
+          weight = power_heuristic(
+              material_pdf,
+              lights.pdf_value(previous_point, ray.getDirection()));
+        radiance += cwiseProduct(throughput, emission) * weight;
+      }
 
-    scatter_record scatter_rec;
-    if (!record.material->Scatter(ray, record, scatter_rec))
-      return color_from_emission;
+      scatter_record scatter_rec;
+      if (!record.material->Scatter(ray, record, scatter_rec))
+        break;
+
+      if (scatter_rec.skip_pdf) {
+        throughput = cwiseProduct(throughput, scatter_rec.attenuation);
+        ray = scatter_rec.skip_pdf_ray;
+        specular_bounce = true;
+      } else {
+        radiance += cwiseProduct(throughput,
+                                 sample_light(ray, record, scatter_rec,
+                                              world_objects, lights, segments));
+
+        vec3 direction = scatter_rec.direction_pdf.generate();
+        material_pdf = scatter_rec.direction_pdf.value(direction);
+        if (!(material_pdf > 0.0))
+          break;
+        Ray scattered_ray(record.hitPoint, direction, ray.getTime());
+        auto scattering_pdf =
+            record.material->Scatter_pdf(ray, record, scattered_ray);
+
+        throughput = cwiseProduct(throughput, scatter_rec.attenuation) *
+                     (scattering_pdf / material_pdf);
+        previous_point = record.hitPoint;
+        ray = scattered_ray;
+        specular_bounce = false;
+      }
 
-    if (scatter_rec.skip_pdf)
-      return cwiseProduct(scatter_rec.attenuation,
-                          ray_color(scatter_rec.skip_pdf_ray, depth - 1,
-                                    world_objects, lights));
+      if (!survives_roulette(depth, throughput))
+        break;
+    }
 
-    auto light_ptr = std::make_shared<hittable_pdf>(lights, record.hitPoint);
-    mixture_pdf p(light_ptr, scatter_rec.pdf_ptr);
+    return radiance;
+  }
 
-    scattered_ray = Ray(record.hitPoint, p.generate(), ray.getTime());
-    auto pdf_value = p.value(scattered_ray.getDirection());
-    auto scattering_pdf =
-        record.material->Scatter_pdf(ray, record, scattered_ray);
+  // the light-sampling half of next event estimation at one vertex,
+  // weighted against the chance of the material sampling the same direction
+  color3 sample_light(Ray const &ray, hit_record const &record,
+                      scatter_record const &scatter_rec,
+                      hittable const &world_objects, hittable const &lights,
+                      uint64_t &segments) const {
+    vec3 direction = lights.random(record.hitPoint);
+    double light_pdf = lights.pdf_value(record.hitPoint, direction);
+    if (!(light_pdf > 0.0))
+      return color3(0, 0, 0);
 
-    color3 sample_color =
-        ray_color(scattered_ray, depth - 1, world_objects, lights);
-    color3 color_from_scatter =
-        cwiseProduct(scatter_rec.attenuation * scattering_pdf, sample_color) /
-        pdf_value;
+    Ray shadow_ray(record.hitPoint, direction, ray.getTime());
+    double scattering_pdf =
+        record.material->Scatter_pdf(ray, record, shadow_ray);
+    if (!(scattering_pdf > 0.0))
+      return color3(0, 0, 0);
 
-    return color_from_scatter + color_from_emission;
+    segments++;
+    hit_record light_record;
+    if (!lights.hit(shadow_ray, interval(0.001, Infinity_double),
+                    light_record))
+      return color3(0, 0, 0);
+    if (light_record.material) {
+      // stop just short of the light itself, which is part of the world too
+      double distance = light_record.factorOfDirection;
+      if (world_objects.occluded(shadow_ray,
+                                 interval(0.001, distance * (1.0 - 1e-6))))
+        return color3(0, 0, 0);
+    } else if (!world_objects.hit(shadow_ray,
+                                  interval(0.001, Infinity_double),
+                                  light_record)) {
+      return color3(0, 0, 0);
+    }
+
+    color3 emission = light_record.material->emitted(
+        shadow_ray, light_record, light_record.textureCoordinate.u,
+        light_record.textureCoordinate.v, light_record.hitPoint);
+    double weight =
+        power_heuristic(light_pdf, scatter_rec.direction_pdf.value(direction));
+    return cwiseProduct(scatter_rec.attenuation, emission) *
+           (scattering_pdf * weight / light_pdf);
+  }
+
+  static double power_heuristic(double pdf, double other_pdf) {
+    double squared = pdf * pdf, other_squared = other_pdf * other_pdf;
+    return squared > 0.0 ? squared / (squared + other_squared) : 0.0;
   }
-  Ray getSampleRay(int x, int y, int stratified_x, int stratified_y) const {
-    vec3 offset = sample_stratified_square(stratified_x, stratified_y);
+
+  static bool is_black(color3 const &color) {
+    return color.r == 0.0 && color.g == 0.0 && color.b == 0.0;
+  }
+
+  // from russian_roulette_depth on a path survives each bounce with
+  // probability max(throughput) and is reweighted, which keeps it unbiased
+  bool survives_roulette(int depth, color3 &throughput) const {
+    if (depth + 1 < russian_roulette_depth)
+      return true;
+    double survival =
+        std::fmax(throughput.r, std::fmax(throughput.g, throughput.b));
+    if (survival >= 1.0)
+      return true;
+    if (random_double() >= survival)
+      return false;
+    throughput /= survival;
+    return true;
+  }
+
+  // dimensions 0-1 place the sample in the pixel, 2-3 on the lens, 4 is the
+  // time. the lens pair is drawn even without defocus, to keep time at 4
+  Ray getSampleRay(int x, int y, sampler &pixel_sampler) const {
+    vec3 offset = sample_square(pixel_sampler);
     point3 sample_pixel_center = viewport_00_pixel_position +
                                  (x + offset.x) * pixel_delta_u +
                                  (y + offset.y) * pixel_delta_v;
-    vec3 ray_origin = defocus_angle <= 0 ? center : sample_defocusDisk();
+    double lens_u = pixel_sampler.get_1d(), lens_v = pixel_sampler.get_1d();
+    vec3 ray_origin =
+        defocus_angle <= 0 ? center : sample_defocusDisk(lens_u, lens_v);
     vec3 ray_direction = sample_pixel_center - ray_origin;
-    double time = random_double();
+    double time = pixel_sampler.get_1d();
     Ray sample_ray(ray_origin, ray_direction, time);
     return sample_ray;
   }
 
-  vec3 sample_square() const {
-    vec3 offset(random_double(-0.5, 0.5), random_double(-0.5, 0.5), 0.0);
-    return offset;
+  vec3 sample_square(sampler &pixel_sampler) const {
+    double x = pixel_sampler.get_1d() - 0.5;
+    double y = pixel_sampler.get_1d() - 0.5;
+    return vec3(x, y, 0.0);
   }
 
-  vec3 sample_stratified_square(int stratified_x, int stratified_y) const {
-    double x = (random_double(0, 1) + stratified_x) * reciprocal_sqrt_spp - 0.5;
-    double y = (random_double(0, 1) + stratified_y) * reciprocal_sqrt_spp - 0.5;
-    vec3 offset(x, y, 0.0);
-    return offset;
-  };
-
-  point3 sample_defocusDisk() const {
-
-    vec3 random_distribution_onUnitDisk =
-        vec3::generate_random_vector_onUnitDisk();
-    point3 random_point_onDefocusDisk =
-        center + defocus_disk_u * random_distribution_onUnitDisk[0] +
-        defocus_disk_v * random_distribution_onUnitDisk[1];
-    return random_point_onDefocusDisk;
+  // polar mapping instead of rejection, so one pair of dimensions suffices
+  point3 sample_defocusDisk(double lens_u, double lens_v) const {
+    double radius = std::sqrt(lens_u), angle = 2 * PI * lens_v;
+    return center + defocus_disk_u * (radius * std::cos(angle)) +
+           defocus_disk_v * (radius * std::sin(angle));
   }
 };
 
@@ -0,0 +1,144 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "framebuffer.h"
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX // std::min and std::max, not the macros
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// pushes a closed file's contents to the disk, so a crash right after the
+// rename below can't leave the new name on an empty or partial file
+bool sync_file(std::string const &path) {
+#if defined(_WIN32)
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  bool synced = FlushFileBuffers(file) != 0;
+  CloseHandle(file);
+  return synced;
+#else
+  int file = open(path.c_str(), O_WRONLY);
+  if (file < 0)
+    return false;
+  bool synced = fsync(file) == 0;
+  close(file);
+  return synced;
+#endif
+}
+
+// std::rename fails on windows when to exists
+bool replace_file(std::string const &from, std::string const &to) {
+#if defined(_WIN32)
+  return MoveFileExA(from.c_str(), to.c_str(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+  return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+// writes path through a temporary file renamed over it, so a reader (or a
+// killed job) only ever sees the old file or the complete new one
+void write_file_atomically(std::string const &path,
+                           std::function<void(std::ostream &)> const &write) {
+  std::string temporary = path + ".tmp";
+  {
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    write(out);
+    out.close();
+    if (!out)
+      throw std::runtime_error("could not write " + temporary);
+  }
+  if (!sync_file(temporary))
+    throw std::runtime_error("could not write " + temporary);
+  if (!replace_file(temporary, path))
+    throw std::runtime_error("could not replace " + path);
+}
+
+// fnv-1a, how checkpoints name the scene they belong to
+uint64_t scene_id(std::string const &name) {
+  uint64_t id = 0xcbf29ce484222325ULL;
+  for (char c : name)
+    id = (id ^ uint8_t(c)) * 0x100000001b3ULL;
+  return id;
+}
+
+/*
+a resumable render: the accumulated samples plus what is needed to continue
+them. samples are addressed by (seed, pixel, sample index), so the seed and
+the sampler are the whole random state; the next sample of a pixel is its
+count. the rest must match for the samples to belong to one image: the
+stratified sampler's strata depend on the spp, the integrator and roulette
+depth on what a sample estimates.
+*/
+class checkpoint_header {
+public:
+  static uint32_t const magic_number = 0x4b435452; // "RTCK"
+  static uint32_t const current_version = 2;
+
+  uint32_t magic = magic_number;
+  uint32_t version = current_version;
+  int32_t width = 0, height = 0;
+  uint64_t seed = 0;
+  uint32_t sampler = 0;    // sampler_kind
+  uint32_t integrator = 0; // integrator_kind
+  int32_t samples_per_pixel = 0;
+  int32_t russian_roulette_depth = 0;
+  uint64_t scene = 0; // scene_id of its name
+};
+
+void write_checkpoint(std::string const &path, checkpoint_header const &header,
+                      sample_accumulator const &samples) {
+  write_file_atomically(path, [&](std::ostream &out) {
+    out.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    samples.write(out);
+  });
+}
+
+// throws if the file is unreadable or doesn't match what the render expects
+sample_accumulator read_checkpoint(std::string const &path,
+                                   checkpoint_header const &expected) {
+  std::ifstream in(path, std::ios::binary);
+  checkpoint_header header;
+  if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      header.magic != checkpoint_header::magic_number ||
+      header.version != checkpoint_header::current_version)
+    throw std::runtime_error(path + " is not a render checkpoint");
+  if (header.width != expected.width || header.height != expected.height)
+    throw std::runtime_error(path + " was rendered at another resolution");
+  if (header.seed != expected.seed || header.sampler != expected.sampler)
+    throw std::runtime_error(path + " was rendered with another seed or "
+                                    "sampler");
+  if (header.samples_per_pixel != expected.samples_per_pixel)
+    throw std::runtime_error(path + " was rendered at another spp");
+  if (header.integrator != expected.integrator ||
+      header.russian_roulette_depth != expected.russian_roulette_depth)
+    throw std::runtime_error(path + " was rendered with another integrator or "
+                                    "roulette depth");
+  if (header.scene != expected.scene)
+    throw std::runtime_error(path + " is a render of another scene");
+
+  sample_accumulator samples(header.width, header.height);
+  if (!samples.read(in))
+    throw std::runtime_error(path + " is truncated");
+  return samples;
+}
+
+#endif // CHECKPOINT_H
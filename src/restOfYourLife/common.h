@@ -2,10 +2,13 @@
 #define COMMON_H
 
 #include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <limits>
 #include <memory>
 
+#include "sampler.h"
+
 using std::make_shared;
 using std::shared_ptr;
 
@@ -15,8 +18,9 @@ double constexpr PI = 3.1415926535897932385;
 double degrees_to_radians(double degrees) { return degrees * PI / 180.0; }
 
 double random_double() {
-  // return a double in [0, 1)
-  return std::rand() / (RAND_MAX + 1.0);
+  // return a double in [0, 1) from the sampler (or else the stream) bound to
+  // this thread
+  return next_sample_value();
 }
 
 double random_double(double min, double max) {
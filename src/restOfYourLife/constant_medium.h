@@ -21,13 +21,50 @@ public:
                   color3 const &albedo)
       : boundary(_boundary), negative_inverse_density(-1 / density),
         phase_function(make_shared<isotropic>(albedo)) {}
-  bool hit(const Ray &ray, interval ray_range,
-           hit_record &record) const override {
-    hit_record rec1, rec2;
+  bool intersect(const Ray &ray, interval ray_range,
+                 hit_info &info) const override {
+    double factorOfDirection;
+    if (!scatter_distance(ray, ray_range, factorOfDirection))
+      return false;
 
-    if (!boundary->hit(ray, interval::Universe, rec1))
+    info.record_hit(this, factorOfDirection);
+    return true;
+  }
+
+  void materialize(const Ray &ray, hit_info const &info,
+                   hit_record &record) const override {
+    record.factorOfDirection = info.factorOfDirection;
+    record.frontFace = true;
+    record.hitPoint = ray.at(record.factorOfDirection);
+    record.normalAgainstRay =
+        vec3(1, 0, 0); // 这个值似乎不重要，毕竟散射方向是随机的
+    record.material = phase_function.get();
+  }
+
+  // a medium blocks a shadow ray exactly when the ray scatters inside it
+  bool occluded(const Ray &ray, interval ray_range) const override {
+    double factorOfDirection;
+    return scatter_distance(ray, ray_range, factorOfDirection);
+  }
+
+  aabb bounding_box() const override { return boundary->bounding_box(); };
+
+  // where a ray scatters inside is drawn at random
+  bool random_intersections() const override { return true; }
+
+private:
+  std::shared_ptr<hittable> boundary;
+  double negative_inverse_density;
+  shared_ptr<Material> phase_function;
+
+  bool scatter_distance(const Ray &ray, interval ray_range,
+                        double &factorOfDirection) const {
+    // only the distances of the boundary crossings matter
+    hit_info rec1, rec2;
+
+    if (!boundary->intersect(ray, interval::Universe, rec1))
       return false;
-    if (!boundary->hit(
+    if (!boundary->intersect(
             ray, interval(rec1.factorOfDirection + 0.0001, INFINITY_DOUBLE),
             rec2))
       return false;
@@ -50,23 +87,9 @@ public:
     if (hit_distance > distance_inside_boundary)
       return false;
 
-    record.factorOfDirection =
-        rec1.factorOfDirection + hit_distance / ray_length;
-    record.frontFace = true;
-    record.hitPoint = ray.at(record.factorOfDirection);
-    record.normalAgainstRay =
-        vec3(1, 0, 0); // 这个值似乎不重要，毕竟散射方向是随机的
-    record.material = phase_function;
-
+    factorOfDirection = rec1.factorOfDirection + hit_distance / ray_length;
     return true;
   }
-
-  aabb bounding_box() const override { return boundary->bounding_box(); };
-
-private:
-  std::shared_ptr<hittable> boundary;
-  double negative_inverse_density;
-  shared_ptr<Material> phase_function;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,200 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "color.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+/*
+linear radiance per pixel, rgb floats row by row.
+every pixel is written by exactly one tile, so workers share it without locks.
+image_writer.h turns it into files
+*/
+class framebuffer {
+public:
+  framebuffer() : width(0), height(0) {}
+  framebuffer(int width, int height)
+      : width(width), height(height), pixels(size_t(width) * height * 3, 0.f) {}
+
+  int get_width() const { return width; }
+  int get_height() const { return height; }
+
+  void set(int x, int y, color3 const &color) {
+    float *pixel = &pixels[index(x, y)];
+    pixel[0] = float(color.r);
+    pixel[1] = float(color.g);
+    pixel[2] = float(color.b);
+  }
+
+  color3 get(int x, int y) const {
+    float const *pixel = &pixels[index(x, y)];
+    return color3(pixel[0], pixel[1], pixel[2]);
+  }
+
+private:
+  int width, height;
+  std::vector<float> pixels;
+
+  size_t index(int x, int y) const { return (size_t(y) * width + x) * 3; }
+};
+
+/*
+running sums of every pixel while its samples come in: color, luminance and
+squared luminance (for the variance of the mean) and the sample count.
+like the framebuffer, a pixel is only touched by the tile that owns it.
+*/
+class sample_accumulator {
+public:
+  sample_accumulator() : width(0), height(0) {}
+  sample_accumulator(int width, int height)
+      : width(width), height(height), pixels(size_t(width) * height) {}
+
+  int get_width() const { return width; }
+  int get_height() const { return height; }
+
+  void add(int x, int y, color3 const &sample) {
+    pixel &p = pixels[index(x, y)];
+    double sample_luminance = luminance(sample);
+    p.color_sum += sample;
+    p.luminance_sum += sample_luminance;
+    p.luminance_squares += sample_luminance * sample_luminance;
+    p.count++;
+  }
+
+  uint32_t count(int x, int y) const { return pixels[index(x, y)].count; }
+
+  uint32_t fewest_samples() const {
+    uint32_t fewest = pixels.empty() ? 0 : pixels[0].count;
+    for (auto const &p : pixels)
+      fewest = std::min(fewest, p.count);
+    return fewest;
+  }
+
+  uint64_t total_samples() const {
+    uint64_t total = 0;
+    for (auto const &p : pixels)
+      total += p.count;
+    return total;
+  }
+
+  color3 mean(int x, int y) const {
+    pixel const &p = pixels[index(x, y)];
+    color3 color = p.color_sum;
+    if (p.count > 0)
+      color *= 1.0 / p.count;
+    return color;
+  }
+
+  // standard error of the mean luminance relative to the mean itself, with
+  // a floor on the mean so black pixels don't count as infinitely noisy.
+  // below two samples nothing is known, the error is infinite
+  double relative_error(int x, int y, double darkest = 0.01) const {
+    pixel const &p = pixels[index(x, y)];
+    if (p.count < 2)
+      return INFINITY;
+    double n = p.count, mean = p.luminance_sum / n;
+    double variance =
+        std::max(0.0, (p.luminance_squares - n * mean * mean) / (n - 1));
+    return std::sqrt(variance / n) / std::max(mean, darkest);
+  }
+
+  // root mean square of the relative error over the pixels that have one:
+  // the noise level of the whole image
+  double noise_estimate(double darkest = 0.01) const {
+    double sum = 0.0;
+    size_t counted = 0;
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        double error = relative_error(x, y, darkest);
+        if (std::isfinite(error)) {
+          sum += error * error;
+          counted++;
+        }
+      }
+    }
+    return counted > 0 ? std::sqrt(sum / counted) : INFINITY;
+  }
+
+  framebuffer resolve() const {
+    framebuffer image(width, height);
+    for (int y = 0; y < height; y++)
+      for (int x = 0; x < width; x++)
+        image.set(x, y, mean(x, y));
+    return image;
+  }
+
+  // samples per pixel as black - blue - red - yellow - white, relative to
+  // the largest count
+  framebuffer heatmap() const {
+    uint32_t most = 1;
+    for (auto const &p : pixels)
+      most = std::max(most, p.count);
+    framebuffer image(width, height);
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        double t = 4.0 * count(x, y) / most; // 0..4 over the four ramps
+        double blue = t < 1.0 ? t : t < 2.0 ? 2.0 - t : t < 3.0 ? 0.0 : t - 3.0;
+        color3 color(std::min(1.0, std::max(0.0, t - 1.0)),
+                     std::min(1.0, std::max(0.0, t - 2.0)), blue);
+        image.set(x, y, color);
+      }
+    }
+    return image;
+  }
+
+  // the sums as raw doubles, six per pixel, in one block
+  void write(std::ostream &out) const {
+    std::vector<double> values;
+    values.reserve(pixels.size() * values_per_pixel);
+    for (auto const &p : pixels) {
+      double const pixel_values[values_per_pixel] = {
+          p.color_sum.r,  p.color_sum.g,      p.color_sum.b,
+          p.luminance_sum, p.luminance_squares, double(p.count)};
+      values.insert(values.end(), pixel_values,
+                    pixel_values + values_per_pixel);
+    }
+    out.write(reinterpret_cast<char const *>(values.data()),
+              std::streamsize(values.size() * sizeof(double)));
+  }
+
+  bool read(std::istream &in) {
+    std::vector<double> values(pixels.size() * values_per_pixel);
+    if (!in.read(reinterpret_cast<char *>(values.data()),
+                 std::streamsize(values.size() * sizeof(double))))
+      return false;
+    for (size_t i = 0; i < pixels.size(); i++) {
+      double const *v = &values[i * values_per_pixel];
+      pixels[i].color_sum = color3(v[0], v[1], v[2]);
+      pixels[i].luminance_sum = v[3];
+      pixels[i].luminance_squares = v[4];
+      pixels[i].count = uint32_t(v[5]);
+    }
+    return true;
+  }
+
+  static double luminance(color3 const &color) {
+    return 0.2126 * color.r + 0.7152 * color.g + 0.0722 * color.b;
+  }
+
+private:
+  class pixel {
+  public:
+    color3 color_sum = color3(0, 0, 0);
+    double luminance_sum = 0.0, luminance_squares = 0.0;
+    uint32_t count = 0;
+  };
+
+  static int const values_per_pixel = 6;
+
+  int width, height;
+  std::vector<pixel> pixels;
+
+  size_t index(int x, int y) const { return size_t(y) * width + x; }
+};
+
+#endif // FRAMEBUFFER_H
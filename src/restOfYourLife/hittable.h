@@ -5,9 +5,15 @@
 #include "common.h"
 #include "interval.h"
 #include "ray.h"
+#include "ray_packet.h"
 #include "texture.h"
 #include "vec3.h"
+#include <algorithm>
+#include <cstdint>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 class Material;
 class hit_record {
@@ -16,7 +22,7 @@ public:
   bool frontFace;
   point3 hitPoint;
   vec3 normalAgainstRay;
-  std::shared_ptr<Material> material;
+  Material const *material; // owned by the scene, never by a record
   texture_coordinate textureCoordinate;
 
   void set_surface_normal(const Ray &ray, const vec3 &unitOutwardNormal) {
@@ -25,13 +31,138 @@ public:
   }
 };
 
+class hittable;
+
+/*
+what closest-hit traversal keeps per candidate: distance, primitive and its
+local coordinates, plus the instances (translate, rotate_y) it was found
+through. the full hit_record is built once, for the final hit only.
+*/
+class hit_info {
+public:
+  static int const max_instance_depth = 8;
+
+  double factorOfDirection;
+  hittable const *primitive = nullptr;
+  double u = 0.0, v = 0.0; // primitive-local coordinates, e.g. quad's a, b
+  uint32_t element = 0;     // which part of the primitive, e.g. a triangle
+  hittable const *instances[max_instance_depth]; // innermost first
+  int instance_count = 0;
+
+  // a closer hit replaces the previous one, along with its instance chain
+  void record_hit(hittable const *hit_primitive, double t, double local_u = 0,
+                  double local_v = 0, uint32_t hit_element = 0) {
+    factorOfDirection = t;
+    primitive = hit_primitive;
+    u = local_u;
+    v = local_v;
+    element = hit_element;
+    instance_count = 0;
+  }
+
+  // called by an instance on the way out, after its child reported a hit.
+  // instances refuse deeper nesting when they are built (see
+  // nested_instance_depth); a list grown under one afterwards loses the
+  // outermost levels here rather than throwing mid-render
+  void push_instance(hittable const *instance) {
+    if (instance_count < max_instance_depth)
+      instances[instance_count++] = instance;
+  }
+};
+
+/*
+what a light sampling structure needs to know about an emitter: where it is,
+which way its surface faces and how large it is. the emission itself is looked
+up in material at point.
+*/
+class emitter_shape {
+public:
+  aabb bounds;
+  vec3 axis = vec3(0, 0, 1);
+  double cos_theta_normals = -1.0; // normals lie in this cone around axis
+  double cos_theta_emission = 0.0; // light leaves up to 90 degrees off them
+  double area = 0.0;
+  Material const *material = nullptr;
+  texture_coordinate texture_point;
+  point3 point;
+};
+
 class hittable {
 public:
-  virtual bool hit(const Ray &ray, interval ray_range,
-                   hit_record &record) const = 0;
+  // closest hit in ray_range, tracked in info without building a record
+  virtual bool intersect(const Ray &ray, interval ray_range,
+                         hit_info &info) const = 0;
   virtual ~hittable() = default;
+
+  // closest hit with the full shading record
+  bool hit(const Ray &ray, interval ray_range, hit_record &record) const {
+    hit_info info;
+    if (!intersect(ray, ray_range, info))
+      return false;
+    resolve(ray, info, record);
+    return true;
+  }
+
+  // closest hits of all the packet's rays, in their ranges; returns the
+  // lanes that hit something, their records are filled
+  uint32_t hit(ray_packet &packet, hit_record *records) const {
+    hit_info infos[ray_packet::max_size];
+    uint32_t hits = 0;
+    intersect_packet(packet, packet.all_lanes(), infos, hits);
+    uint32_t remaining = hits;
+    for (int lane; ray_packet::next_lane(remaining, lane);)
+      resolve(packet.rays[lane], infos[lane], records[lane]);
+    return hits;
+  }
+
+  // intersect() for the lanes in mask: a closer hit goes into that lane's
+  // info, shortens its range and sets its bit in hits. this default takes
+  // the rays one by one; acceleration structures and simple primitives
+  // share the work between them
+  virtual void intersect_packet(ray_packet &packet, uint32_t mask,
+                                hit_info *infos, uint32_t &hits) const {
+    for (int lane; ray_packet::next_lane(mask, lane);) {
+      if (intersect(packet.rays[lane], packet.range(lane), infos[lane])) {
+        packet.t_max[lane] = infos[lane].factorOfDirection;
+        hits |= 1u << lane;
+      }
+    }
+  }
+
+  // primitives: the record of a hit intersect() found, in their own space
+  virtual void materialize(const Ray &ray, hit_info const &info,
+                           hit_record &record) const {}
+
+  // instances: rays into the child's space and records back out of it
+  virtual Ray to_instance_space(const Ray &ray) const { return ray; }
+  virtual void to_world_space(hit_record &record) const {}
+
+  // any-hit query for shadow rays: true if anything is hit in ray_range.
+  // may stop at the first intersection found, and fills no hit_record
+  virtual bool occluded(const Ray &ray, interval ray_range) const {
+    hit_record record;
+    return hit(ray, ray_range, record);
+  }
+
   virtual aabb bounding_box() const = 0;
 
+  // bounds when the shutter opens (time 0) and closes (time 1), for
+  // motion_bvh, which interpolates between them. the box in between must
+  // hold the object at every time; things that don't move in straight lines
+  // keep the default, their box over the whole shutter at both ends
+  virtual void motion_bounds(aabb &at_open, aabb &at_close) const {
+    at_open = at_close = bounding_box();
+  }
+
+  // true if intersect() draws random numbers, as a medium does to pick where
+  // a ray scatters in it; containers ask what they hold. the camera traces
+  // worlds like that ray by ray, each after its own sample is bound
+  virtual bool random_intersections() const { return false; }
+
+  // how many instances a hit inside passes through on its way out; containers
+  // ask what they hold
+  virtual int instance_depth() const { return 0; }
+
   virtual double pdf_value(point3 const &origin, vec3 const &direction) const {
     return 0.0;
   }
@@ -39,22 +170,77 @@ public:
   virtual vec3 random(point3 const &origin) const {
     return vec3(1.0, 0.0, 0.0);
   }
+
+  // primitives that can be sampled as lights describe themselves here
+  virtual bool emitter(emitter_shape &shape) const { return false; }
+
+private:
+  // the record of a hit intersect() found, through its instances
+  static void resolve(const Ray &ray, hit_info const &info,
+                      hit_record &record) {
+    Ray local_ray = ray;
+    for (int i = info.instance_count - 1; i >= 0; i--)
+      local_ray = info.instances[i]->to_instance_space(local_ray);
+    info.primitive->materialize(local_ray, info, record);
+    for (int i = 0; i < info.instance_count; i++)
+      info.instances[i]->to_world_space(record);
+  }
 };
 
+// for containers: whether any of objects draws in intersect()
+bool any_random_intersections(
+    std::vector<shared_ptr<hittable>> const &objects) {
+  for (auto const &object : objects)
+    if (object->random_intersections())
+      return true;
+  return false;
+}
+
+// for containers: the deepest nesting of instances among objects
+int deepest_instance(std::vector<shared_ptr<hittable>> const &objects) {
+  int depth = 0;
+  for (auto const &object : objects)
+    depth = std::max(depth, object->instance_depth());
+  return depth;
+}
+
+// for instances: their depth around child, throwing if hit_info cannot record
+// that many levels
+int nested_instance_depth(hittable const &child) {
+  int depth = child.instance_depth() + 1;
+  if (depth > hit_info::max_instance_depth)
+    throw std::invalid_argument(
+        "instances nested more than " +
+        std::to_string(hit_info::max_instance_depth) + " levels deep");
+  return depth;
+}
+
 class translate : public hittable {
 public:
   translate(shared_ptr<hittable> object, const vec3 &offset)
-      : object(object), offset(offset) {}
-  bool hit(const Ray &ray, interval ray_range,
-           hit_record &record) const override {
-    Ray offset_ray(ray.getOrigin() - offset, ray.getDirection(), ray.getTime());
-    if (!object->hit(offset_ray, ray_range, record))
+      : object(object), offset(offset),
+        depth(nested_instance_depth(*object)) {}
+  bool intersect(const Ray &ray, interval ray_range,
+                 hit_info &info) const override {
+    if (!object->intersect(to_instance_space(ray), ray_range, info))
       return false;
 
-    record.hitPoint += offset;
+    info.push_instance(this);
     return true;
   }
 
+  bool occluded(const Ray &ray, interval ray_range) const override {
+    return object->occluded(to_instance_space(ray), ray_range);
+  }
+
+  Ray to_instance_space(const Ray &ray) const override {
+    return Ray(ray.getOrigin() - offset, ray.getDirection(), ray.getTime());
+  }
+
+  void to_world_space(hit_record &record) const override {
+    record.hitPoint += offset;
+  }
+
   aabb bounding_box() const override {
     aabb bbox = object->bounding_box();
     bbox.x_interval = bbox.x_interval + offset.x;
@@ -63,15 +249,27 @@ public:
     return bbox;
   }
 
+  bool random_intersections() const override {
+    return object->random_intersections();
+  }
+
+  int instance_depth() const override { return depth; }
+
+  // for transform_instance, which folds chains of wrappers into one matrix
+  shared_ptr<hittable> const &get_object() const { return object; }
+  vec3 const &get_offset() const { return offset; }
+
 private:
   shared_ptr<hittable> object; // or instance of primitive
   vec3 offset;
   aabb bbox;
+  int depth;
 };
 
 class rotate_y : public hittable { // 暂时只考虑绕y的旋转
 public:
-  rotate_y(shared_ptr<hittable> object, double angle) : object(object) {
+  rotate_y(shared_ptr<hittable> object, double angle)
+      : object(object), depth(nested_instance_depth(*object)) {
     auto radians = degrees_to_radians(angle);
     sin_theta = std::sin(radians);
     cos_theta = std::cos(radians);
@@ -102,10 +300,20 @@ public:
 
     bbox = aabb(min, max);
   }
-  bool hit(const Ray &r, interval ray_t, hit_record &rec) const override {
+  bool intersect(const Ray &r, interval ray_t, hit_info &info) const override {
+    if (!object->intersect(to_instance_space(r), ray_t, info))
+      return false;
 
-    // Transform the ray from world space to object space.
+    info.push_instance(this);
+    return true;
+  }
+
+  bool occluded(const Ray &r, interval ray_t) const override {
+    return object->occluded(to_instance_space(r), ray_t);
+  }
 
+  // Transform the ray from world space to object space.
+  Ray to_instance_space(const Ray &r) const override {
     auto origin =
         point3((cos_theta * r.getOrigin().x) - (sin_theta * r.getOrigin().z),
                r.getOrigin().y,
@@ -116,16 +324,11 @@ public:
         r.getDirection().y,
         (sin_theta * r.getDirection().x) + (cos_theta * r.getDirection().z));
 
-    Ray rotated_r(origin, direction, r.getTime());
-
-    // Determine whether an intersection exists in object space (and if so,
-    // where).
-
-    if (!object->hit(rotated_r, ray_t, rec))
-      return false;
-
-    // Transform the intersection from object space back to world space.
+    return Ray(origin, direction, r.getTime());
+  }
 
+  // Transform the intersection from object space back to world space.
+  void to_world_space(hit_record &rec) const override {
     rec.hitPoint =
         point3((cos_theta * rec.hitPoint.x) + (sin_theta * rec.hitPoint.z),
                rec.hitPoint.y,
@@ -136,16 +339,26 @@ public:
                                 rec.normalAgainstRay.y,
                                 (-sin_theta * rec.normalAgainstRay.x) +
                                     (cos_theta * rec.normalAgainstRay.z));
-
-    return true;
   }
+
   aabb bounding_box() const override { return bbox; }
 
+  bool random_intersections() const override {
+    return object->random_intersections();
+  }
+
+  int instance_depth() const override { return depth; }
+
+  shared_ptr<hittable> const &get_object() const { return object; }
+  double get_sin_theta() const { return sin_theta; }
+  double get_cos_theta() const { return cos_theta; }
+
 private:
   shared_ptr<hittable> object;
   double sin_theta;
   double cos_theta;
   aabb bbox;
+  int depth;
 };
 
 #endif
\ No newline at end of file
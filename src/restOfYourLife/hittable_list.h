@@ -29,20 +29,31 @@ public:
     bbox = aabb(bbox, object->bounding_box());
   }
 
-  bool hit(Ray const &ray, interval ray_range,
-           hit_record &record) const override {
-    hit_record temp_record;
+  bool intersect(Ray const &ray, interval ray_range,
+                 hit_info &info) const override {
     bool hit_anything = false;
     for (const auto &object : objects) {
-      if (object->hit(ray, ray_range, temp_record)) {
+      if (object->intersect(ray, ray_range, info)) {
         hit_anything = true;
-        ray_range.max = temp_record.factorOfDirection;
-        record = temp_record;
+        ray_range.max = info.factorOfDirection;
       }
     }
     return hit_anything;
   }
 
+  void intersect_packet(ray_packet &packet, uint32_t mask, hit_info *infos,
+                        uint32_t &hits) const override {
+    for (const auto &object : objects)
+      object->intersect_packet(packet, mask, infos, hits);
+  }
+
+  bool occluded(Ray const &ray, interval ray_range) const override {
+    for (const auto &object : objects)
+      if (object->occluded(ray, ray_range))
+        return true;
+    return false;
+  }
+
   double pdf_value(point3 const &origin, vec3 const &direction) const override {
     auto weight = 1.0 / objects.size();
     auto sum = 0.0;
@@ -61,6 +72,12 @@ public:
 
   aabb bounding_box() const override { return bbox; }
 
+  bool random_intersections() const override {
+    return any_random_intersections(objects);
+  }
+
+  int instance_depth() const override { return deepest_instance(objects); }
+
 private:
   aabb bbox;
 };
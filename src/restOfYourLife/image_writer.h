@@ -0,0 +1,184 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "framebuffer.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+framebuffer output. pixels are converted in parallel, row ranges per thread,
+into one buffer that goes out with a single write:
+  p3   ascii ppm, what write_color always produced
+  p6   binary ppm, same 8-bit values, a third of the size
+  pfm  linear float rgb, bottom row first (the pfm convention), little endian
+  raw  linear float rgb, top row first, no header
+*/
+enum class image_format { p3, p6, pfm, raw };
+
+bool parse_image_format(std::string const &name, image_format &format) {
+  if (name == "p3")
+    format = image_format::p3;
+  else if (name == "p6")
+    format = image_format::p6;
+  else if (name == "pfm")
+    format = image_format::pfm;
+  else if (name == "raw")
+    format = image_format::raw;
+  else
+    return false;
+  return true;
+}
+
+// by file extension: .pfm, .raw, anything else a binary ppm
+image_format image_format_for(std::string const &path) {
+  auto ends_with = [&](char const *suffix) {
+    size_t length = std::strlen(suffix);
+    return path.size() >= length &&
+           path.compare(path.size() - length, length, suffix) == 0;
+  };
+  if (ends_with(".pfm"))
+    return image_format::pfm;
+  if (ends_with(".raw"))
+    return image_format::raw;
+  return image_format::p6;
+}
+
+// the 8-bit value write_color() prints: gamma 2, clamped, NaN as 0
+inline int quantize(double linear_value) {
+  double gamma = linear_value > 0 ? std::sqrt(linear_value) : 0.0;
+  gamma = gamma < 0.0 ? 0.0 : (gamma > 0.999 ? 0.999 : gamma);
+  return int(256 * gamma);
+}
+
+class image_writer {
+public:
+  image_writer(int thread_count = 1) : thread_count(thread_count) {}
+
+  void write(std::ostream &out, framebuffer const &image,
+             image_format format) const {
+    std::string header = make_header(image, format);
+    std::vector<char> buffer(header.begin(), header.end());
+    switch (format) {
+    case image_format::p3:
+      append_ascii_pixels(buffer, image);
+      break;
+    case image_format::p6:
+      append_byte_pixels(buffer, image);
+      break;
+    default:
+      append_float_pixels(buffer, image, format == image_format::pfm);
+      break;
+    }
+    out.write(buffer.data(), std::streamsize(buffer.size()));
+  }
+
+private:
+  int thread_count;
+
+  static std::string make_header(framebuffer const &image,
+                                 image_format format) {
+    std::string size = std::to_string(image.get_width()) + " " +
+                       std::to_string(image.get_height()) + "\n";
+    switch (format) {
+    case image_format::p3:
+      return "P3\n" + size + "255\n";
+    case image_format::p6:
+      return "P6\n" + size + "255\n";
+    case image_format::pfm:
+      return "PF\n" + size + "-1.0\n"; // negative scale: little endian
+    default:
+      return "";
+    }
+  }
+
+  void append_byte_pixels(std::vector<char> &buffer,
+                          framebuffer const &image) const {
+    int width = image.get_width();
+    size_t offset = buffer.size();
+    buffer.resize(offset + size_t(width) * image.get_height() * 3);
+    parallel_for(size_t(image.get_height()), thread_count,
+                 [&](size_t begin, size_t end) {
+                   for (size_t y = begin; y < end; y++) {
+                     char *row = &buffer[offset + y * width * 3];
+                     for (int x = 0; x < width; x++) {
+                       color3 color = image.get(x, int(y));
+                       row[3 * x + 0] = char(quantize(color.r));
+                       row[3 * x + 1] = char(quantize(color.g));
+                       row[3 * x + 2] = char(quantize(color.b));
+                     }
+                   }
+                 });
+  }
+
+  // "r g b\n" per pixel like write_color. rows are formatted into one chunk
+  // per thread, then joined
+  void append_ascii_pixels(std::vector<char> &buffer,
+                           framebuffer const &image) const {
+    int width = image.get_width(), height = image.get_height();
+    size_t chunks = size_t(std::max(1, thread_count));
+    size_t rows_per_chunk = (size_t(height) + chunks - 1) / chunks;
+    std::vector<std::vector<char>> formatted(chunks);
+    parallel_for(chunks, thread_count, [&](size_t begin, size_t end) {
+      for (size_t chunk = begin; chunk < end; chunk++) {
+        std::vector<char> &text = formatted[chunk];
+        size_t first = chunk * rows_per_chunk;
+        size_t last = std::min(size_t(height), first + rows_per_chunk);
+        text.reserve((last > first ? last - first : 0) * width * 12);
+        for (size_t y = first; y < last; y++) {
+          for (int x = 0; x < width; x++) {
+            color3 color = image.get(x, int(y));
+            append_number(text, quantize(color.r), ' ');
+            append_number(text, quantize(color.g), ' ');
+            append_number(text, quantize(color.b), '\n');
+          }
+        }
+      }
+    });
+
+    size_t total = buffer.size();
+    for (auto const &text : formatted)
+      total += text.size();
+    buffer.reserve(total);
+    for (auto const &text : formatted)
+      buffer.insert(buffer.end(), text.begin(), text.end());
+  }
+
+  static void append_number(std::vector<char> &text, int value,
+                            char separator) {
+    if (value >= 100)
+      text.push_back(char('0' + value / 100));
+    if (value >= 10)
+      text.push_back(char('0' + value / 10 % 10));
+    text.push_back(char('0' + value % 10));
+    text.push_back(separator);
+  }
+
+  // floats as the machine stores them, which the pfm header declares as
+  // little endian: x86 and arm hosts
+  void append_float_pixels(std::vector<char> &buffer, framebuffer const &image,
+                           bool bottom_up) const {
+    int width = image.get_width(), height = image.get_height();
+    size_t offset = buffer.size();
+    buffer.resize(offset + size_t(width) * height * 3 * sizeof(float));
+    parallel_for(size_t(height), thread_count, [&](size_t begin, size_t end) {
+      for (size_t y = begin; y < end; y++) {
+        size_t row = bottom_up ? size_t(height) - 1 - y : y;
+        char *out = &buffer[offset + row * width * 3 * sizeof(float)];
+        for (int x = 0; x < width; x++) {
+          color3 color = image.get(x, int(y));
+          float const values[3] = {float(color.r), float(color.g),
+                                   float(color.b)};
+          std::memcpy(out + x * sizeof(values), values, sizeof(values));
+        }
+      }
+    });
+  }
+};
+
+#endif // IMAGE_WRITER_H
@@ -0,0 +1,524 @@
+#ifndef INDEX_BVH_H
+#define INDEX_BVH_H
+
+#include "aabb.h"
+#include "bvh.h"
+#include "common.h"
+#include "interval.h"
+#include "linear_bvh.h"
+#include "parallel.h"
+#include "ray.h"
+#include "vec3.h"
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+// what index_bvh is built from: the bounds of one item and its id
+class index_bvh_item {
+public:
+  aabb bbox;
+  point3 centroid;
+  uint32_t id;
+
+  index_bvh_item() {}
+  index_bvh_item(aabb const &bbox, uint32_t id)
+      : bbox(bbox), centroid(bbox.centroid()), id(id) {}
+};
+
+// a ray as index_bvh's node test takes it
+class bvh_ray {
+public:
+  double origin[3], inverse_direction[3];
+  bool direction_is_negative[3];
+
+  bvh_ray(Ray const &ray) {
+    for (int axis = 0; axis < 3; axis++) {
+      origin[axis] = ray.getOrigin()[axis];
+      inverse_direction[axis] = 1.0 / ray.getDirection()[axis];
+      direction_is_negative[axis] = inverse_direction[axis] < 0.0;
+    }
+  }
+};
+
+/*
+a bvh over things known only by an id and their bounds, like the triangles of
+a mesh or the instances of a tlas, which need no hittable each. built with
+binned sah like bvh_node into linear_bvh's 32 byte nodes; leaves are ranges
+of order(), which holds the ids. the owner tests the ids itself in the
+callbacks of closest() and any(), so those calls inline.
+
+when items move, update() refits the bounds instead of building again. the
+tree is cut into subtrees that are refit in parallel; a subtree whose sah
+cost has grown past a threshold of its cost when built is rebuilt on its
+own, and the whole tree if its own cost has.
+*/
+class index_bvh {
+public:
+  static int const max_depth = linear_bvh::max_depth;
+
+  // items are reordered, ids must fit in 32 bits
+  void build(std::vector<index_bvh_item> &items,
+             bvh_build_options const &options = bvh_build_options()) {
+    build(items, options, 1);
+  }
+
+  class update_result {
+  public:
+    size_t refit_nodes = 0;
+    size_t rebuilt_subtrees = 0, rebuilt_nodes = 0;
+    bool rebuilt_all = false;
+    double degradation = 1.0; // sah cost now over the cost when built
+  };
+
+  // bounds_of(id) gives the current bounds of an item, from several threads
+  // at once. subtrees (and then the tree) are rebuilt once their sah cost is
+  // more than rebuild_threshold times what it was when they were built
+  template <typename item_bounds>
+  update_result update(item_bounds &&bounds_of,
+                       bvh_build_options const &options,
+                       double rebuild_threshold, int thread_count = 1) {
+    update_result result;
+    if (nodes.empty())
+      return result;
+
+    std::vector<subtree> parts;
+    size_t target = std::max<size_t>(
+        64, nodes.size() / std::max(64, 8 * std::max(1, thread_count)));
+    cut(0, uint32_t(nodes.size()), 1, target, parts);
+
+    std::vector<double> ratios(parts.size());
+    parallel_for(parts.size(), thread_count, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        refit(parts[i], bounds_of);
+        ratios[i] = degradation(parts[i].root, parts[i].end, options);
+      }
+    });
+    result.refit_nodes = nodes.size();
+
+    // back to front, so the subtrees not yet spliced keep their place
+    for (size_t i = parts.size(); i-- > 0;) {
+      if (!(ratios[i] > rebuild_threshold))
+        continue;
+      result.rebuilt_subtrees++;
+      result.rebuilt_nodes += parts[i].end - parts[i].root;
+      int32_t growth = rebuild(parts[i], bounds_of, options);
+      for (size_t later = i + 1; later < parts.size(); later++) {
+        parts[later].root += growth;
+        parts[later].end += growth;
+      }
+      parts[i].end += growth;
+    }
+    refit_above(0, parts);
+
+    // rebuilt subtrees take their new areas as their own reference, the
+    // whole tree is measured against its last full build
+    result.degradation = weighted_area(0, uint32_t(nodes.size()), options) /
+                         std::max(built_cost, 1e-300);
+    if (result.degradation > rebuild_threshold) {
+      std::vector<index_bvh_item> items(order.size());
+      for (size_t i = 0; i < order.size(); i++)
+        items[i] = index_bvh_item(bounds_of(order[i]), order[i]);
+      build(items, options);
+      result.rebuilt_all = true;
+      result.degradation = 1.0;
+    }
+    return result;
+  }
+
+  // expected cost of a ray through the root box, as linear_bvh::sah_cost
+  double sah_cost(double traversal_cost = 1.0) const {
+    if (nodes.empty())
+      return 0.0;
+    double root_area = node_area(nodes[0]), cost = 0.0;
+    for (auto const &node : nodes) {
+      double relative_area = root_area > 0.0 ? node_area(node) / root_area : 1;
+      cost += relative_area *
+              (node.is_leaf() ? double(node.primitive_count) : traversal_cost);
+    }
+    return cost;
+  }
+
+  // test(id, ray_range) intersects one item; on a hit it shortens
+  // ray_range.max to it and returns true. the nearer child is visited first
+  template <typename item_test>
+  bool closest(bvh_ray const &ray, interval ray_range, item_test &&test) const {
+    if (nodes.empty())
+      return false;
+    bool hit_anything = false;
+    uint32_t stack[max_depth];
+    int stack_size = 0;
+    uint32_t current = 0;
+    while (true) {
+      linear_bvh_node const &node = nodes[current];
+      if (node.hit(ray.origin, ray.inverse_direction, ray_range)) {
+        if (node.is_leaf()) {
+          for (uint32_t i = 0; i < node.primitive_count; i++)
+            hit_anything |= test(order[node.offset + i], ray_range);
+        } else {
+          if (ray.direction_is_negative[node.axis]) {
+            stack[stack_size++] = current + 1;
+            current = node.offset;
+          } else {
+            stack[stack_size++] = node.offset;
+            current = current + 1;
+          }
+          continue;
+        }
+      }
+      if (stack_size == 0)
+        break;
+      current = stack[--stack_size];
+    }
+    return hit_anything;
+  }
+
+  // stops at the first id test(id, ray_range) reports a hit for
+  template <typename item_test>
+  bool any(bvh_ray const &ray, interval ray_range, item_test &&test) const {
+    if (nodes.empty())
+      return false;
+    uint32_t stack[max_depth];
+    int stack_size = 0;
+    uint32_t current = 0;
+    while (true) {
+      linear_bvh_node const &node = nodes[current];
+      if (node.hit(ray.origin, ray.inverse_direction, ray_range)) {
+        if (node.is_leaf()) {
+          for (uint32_t i = 0; i < node.primitive_count; i++)
+            if (test(order[node.offset + i], ray_range))
+              return true;
+        } else {
+          stack[stack_size++] = node.offset;
+          current = current + 1;
+          continue;
+        }
+      }
+      if (stack_size == 0)
+        return false;
+      current = stack[--stack_size];
+    }
+  }
+
+  bool empty() const { return nodes.empty(); }
+  aabb bounds() const {
+    return nodes.empty() ? aabb::Empty_bbox : node_bounds(nodes[0]);
+  }
+  size_t node_count() const { return nodes.size(); }
+  std::vector<uint32_t> const &leaf_order() const { return order; }
+  std::vector<linear_bvh_node> const &tree_nodes() const { return nodes; }
+
+  size_t memory_bytes() const {
+    return nodes.size() * sizeof(linear_bvh_node) +
+           order.size() * sizeof(uint32_t) + built_area.size() * sizeof(float);
+  }
+
+  static aabb node_bounds(linear_bvh_node const &node) {
+    return aabb(point3(node.bounds_min[0], node.bounds_min[1],
+                       node.bounds_min[2]),
+                point3(node.bounds_max[0], node.bounds_max[1],
+                       node.bounds_max[2]));
+  }
+
+private:
+  std::vector<linear_bvh_node> nodes;
+  std::vector<uint32_t> order;   // item ids in leaf order
+  std::vector<float> built_area; // of each node when it was built
+  double built_cost = 0.0;       // weighted_area() after the last build
+
+  // scratch of split(), kept between nodes
+  std::vector<aabb> bin_bounds;
+  std::vector<size_t> bin_counts, right_count;
+  std::vector<double> right_area;
+
+  // the nodes [root, end) of a subtree at depth, and the items [first,
+  // last) of order below it
+  class subtree {
+  public:
+    uint32_t root, end;
+    int depth;
+    uint32_t first = 0, last = 0;
+  };
+
+  // depth is that of the root in the whole tree, for a rebuilt subtree
+  void build(std::vector<index_bvh_item> &items,
+             bvh_build_options const &options, int depth) {
+    nodes.clear();
+    order.clear();
+    built_area.clear();
+    size_t count = items.size();
+    if (count == 0)
+      return;
+    if (count > 0xffffffffu / 2)
+      throw std::length_error("index_bvh: too many items");
+
+    nodes.reserve(2 * count / std::max(1, options.max_leaf_size) + 1);
+    emit(items, 0, count, depth, options);
+    order.resize(count);
+    for (size_t i = 0; i < count; i++)
+      order[i] = items[i].id;
+    record_built_area();
+    built_cost = weighted_area(0, uint32_t(nodes.size()), options);
+  }
+
+  static double node_area(linear_bvh_node const &node) {
+    double lx = node.bounds_max[0] - node.bounds_min[0];
+    double ly = node.bounds_max[1] - node.bounds_min[1];
+    double lz = node.bounds_max[2] - node.bounds_min[2];
+    return 2.0 * (lx * ly + ly * lz + lz * lx);
+  }
+
+  void record_built_area() {
+    built_area.resize(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++)
+      built_area[i] = float(node_area(nodes[i]));
+  }
+
+  // nodes [root, end) against their areas when built, weighted like sah
+  double degradation(uint32_t root, uint32_t end,
+                     bvh_build_options const &options) const {
+    double now = 0.0, built = 0.0;
+    for (uint32_t i = root; i < end; i++) {
+      double weight = nodes[i].is_leaf() ? double(nodes[i].primitive_count)
+                                         : options.traversal_cost;
+      now += weight * node_area(nodes[i]);
+      built += weight * built_area[i];
+    }
+    return built > 0.0 ? now / built : 1.0;
+  }
+
+  // sah cost of nodes [root, end) without dividing by the root's area
+  double weighted_area(uint32_t root, uint32_t end,
+                       bvh_build_options const &options) const {
+    double sum = 0.0;
+    for (uint32_t i = root; i < end; i++)
+      sum += node_area(nodes[i]) * (nodes[i].is_leaf()
+                                        ? double(nodes[i].primitive_count)
+                                        : options.traversal_cost);
+    return sum;
+  }
+
+  // splits the tree into subtrees of at most target nodes (or leaves)
+  void cut(uint32_t root, uint32_t end, int depth, size_t target,
+           std::vector<subtree> &parts) const {
+    linear_bvh_node const &node = nodes[root];
+    if (end - root <= target || node.is_leaf()) {
+      subtree part;
+      part.root = root;
+      part.end = end;
+      part.depth = depth;
+      parts.push_back(part);
+      return;
+    }
+    cut(root + 1, node.offset, depth + 1, target, parts);
+    cut(node.offset, end, depth + 1, target, parts);
+  }
+
+  // children come after their parent, so back to front is bottom up
+  template <typename item_bounds>
+  void refit(subtree &part, item_bounds &bounds_of) {
+    part.first = uint32_t(order.size());
+    part.last = 0;
+    for (uint32_t i = part.end; i-- > part.root;) {
+      linear_bvh_node &node = nodes[i];
+      aabb box = aabb::Empty_bbox;
+      if (node.is_leaf()) {
+        for (uint32_t k = 0; k < node.primitive_count; k++)
+          box = aabb(box, bounds_of(order[node.offset + k]));
+        part.first = std::min(part.first, node.offset);
+        part.last = std::max(part.last, node.offset + node.primitive_count);
+      } else {
+        box = aabb(node_bounds(nodes[i + 1]), node_bounds(nodes[node.offset]));
+      }
+      set_bounds_only(node, box);
+    }
+  }
+
+  // builds the subtree's items again and splices the new nodes in its
+  // place; returns how many nodes that added (or removed)
+  template <typename item_bounds>
+  int32_t rebuild(subtree const &part, item_bounds &bounds_of,
+                  bvh_build_options const &options) {
+    std::vector<index_bvh_item> items(part.last - part.first);
+    for (uint32_t i = part.first; i < part.last; i++)
+      items[i - part.first] = index_bvh_item(bounds_of(order[i]), order[i]);
+    index_bvh fresh;
+    fresh.build(items, options, part.depth);
+
+    for (auto &node : fresh.nodes)
+      node.offset += node.is_leaf() ? part.first : part.root;
+    std::copy(fresh.order.begin(), fresh.order.end(),
+              order.begin() + part.first);
+
+    int32_t growth =
+        int32_t(fresh.nodes.size()) - int32_t(part.end - part.root);
+    if (growth != 0) {
+      for (uint32_t i = 0; i < nodes.size(); i++) {
+        bool outside = i < part.root || i >= part.end;
+        if (outside && !nodes[i].is_leaf() && nodes[i].offset >= part.end)
+          nodes[i].offset += growth;
+      }
+    }
+    nodes.erase(nodes.begin() + part.root, nodes.begin() + part.end);
+    nodes.insert(nodes.begin() + part.root, fresh.nodes.begin(),
+                 fresh.nodes.end());
+    built_area.erase(built_area.begin() + part.root,
+                     built_area.begin() + part.end);
+    built_area.insert(built_area.begin() + part.root,
+                      fresh.built_area.begin(), fresh.built_area.end());
+    return growth;
+  }
+
+  // the nodes above the subtrees, from their children's new bounds. parts
+  // are in tree order, so the one a node is the root of is found by index
+  aabb refit_above(uint32_t index, std::vector<subtree> const &parts) {
+    auto part = std::lower_bound(
+        parts.begin(), parts.end(), index,
+        [](subtree const &a, uint32_t root) { return a.root < root; });
+    linear_bvh_node &node = nodes[index];
+    if ((part != parts.end() && part->root == index) || node.is_leaf())
+      return node_bounds(node);
+    aabb box(refit_above(index + 1, parts), refit_above(node.offset, parts));
+    set_bounds_only(node, box);
+    return box;
+  }
+
+  // linear_bvh::set_bounds without touching the rest of the node
+  static void set_bounds_only(linear_bvh_node &node, aabb const &box) {
+    linear_bvh_node bounds;
+    linear_bvh::set_bounds(bounds, box);
+    std::copy(bounds.bounds_min, bounds.bounds_min + 3, node.bounds_min);
+    std::copy(bounds.bounds_max, bounds.bounds_max + 3, node.bounds_max);
+  }
+
+  // builds the subtree of items[start, end) depth first, returns its node
+  uint32_t emit(std::vector<index_bvh_item> &items, size_t start, size_t end,
+                int depth, bvh_build_options const &options) {
+    uint32_t index = uint32_t(nodes.size());
+    nodes.push_back(linear_bvh_node());
+
+    aabb bounds = aabb::Empty_bbox, centroid_bounds = aabb::Empty_bbox;
+    for (size_t i = start; i < end; i++) {
+      bounds = aabb(bounds, items[i].bbox);
+      centroid_bounds =
+          aabb(centroid_bounds, aabb(items[i].centroid, items[i].centroid));
+    }
+    linear_bvh::set_bounds(nodes[index], bounds);
+
+    int axis;
+    size_t mid;
+    if (!split(items, start, end, bounds, centroid_bounds, depth, options,
+               axis, mid)) {
+      nodes[index].offset = uint32_t(start);
+      nodes[index].primitive_count = uint16_t(end - start);
+      nodes[index].axis = 0;
+      return index;
+    }
+
+    emit(items, start, mid, depth + 1, options);
+    uint32_t second = emit(items, mid, end, depth + 1, options);
+    nodes[index].offset = second;
+    nodes[index].primitive_count = 0;
+    nodes[index].axis = uint8_t(axis);
+    return index;
+  }
+
+  // binned sah like bvh_node. from halfway down the traversal stack on it
+  // halves by count, which reaches single items within the other half
+  bool split(std::vector<index_bvh_item> &items, size_t start, size_t end,
+             aabb const &bounds, aabb const &centroid_bounds, int depth,
+             bvh_build_options const &options, int &axis, size_t &mid) {
+    size_t count = end - start;
+    size_t max_leaf = size_t(std::max(1, options.max_leaf_size));
+    bool must_split = count > 0xffff; // primitive_count is 16 bits
+    if (count <= 1)
+      return false;
+    axis = centroid_bounds.longest_axis();
+    if (depth >= max_depth / 2 ||
+        options.split_method == bvh_split_method::median) {
+      if (count <= max_leaf && !must_split)
+        return false;
+      mid = start + count / 2;
+      std::nth_element(items.begin() + start, items.begin() + mid,
+                       items.begin() + end,
+                       [&](index_bvh_item const &a, index_bvh_item const &b) {
+                         return a.centroid[axis] < b.centroid[axis];
+                       });
+      return true;
+    }
+
+    int bins = std::max(2, options.bin_count);
+    double best_cost = INFINITY_DOUBLE;
+    int best_axis = -1, best_bin = 0;
+    bin_bounds.resize(bins);
+    bin_counts.resize(bins);
+    right_area.resize(bins);
+    right_count.resize(bins);
+    for (int candidate = 0; candidate < 3; candidate++) {
+      interval const &extent = centroid_bounds.get_axis_interval(candidate);
+      if (!(extent.max - extent.min > 0.0))
+        continue;
+      std::fill(bin_bounds.begin(), bin_bounds.end(), aabb::Empty_bbox);
+      std::fill(bin_counts.begin(), bin_counts.end(), 0);
+      for (size_t i = start; i < end; i++) {
+        int bin = bin_of(items[i].centroid[candidate], extent, bins);
+        bin_bounds[bin] = aabb(bin_bounds[bin], items[i].bbox);
+        bin_counts[bin]++;
+      }
+      // sweep from the right, then from the left: split after bin
+      aabb right = aabb::Empty_bbox;
+      size_t right_total = 0;
+      for (int bin = bins - 1; bin > 0; bin--) {
+        right = aabb(right, bin_bounds[bin]);
+        right_total += bin_counts[bin];
+        right_area[bin] = right_total ? right.surface_area() : 0.0;
+        right_count[bin] = right_total;
+      }
+      aabb left = aabb::Empty_bbox;
+      size_t left_total = 0;
+      for (int bin = 0; bin < bins - 1; bin++) {
+        left = aabb(left, bin_bounds[bin]);
+        left_total += bin_counts[bin];
+        if (left_total == 0 || right_count[bin + 1] == 0)
+          continue;
+        double cost = left.surface_area() * left_total +
+                      right_area[bin + 1] * right_count[bin + 1];
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_axis = candidate;
+          best_bin = bin;
+        }
+      }
+    }
+
+    if (best_axis < 0) {
+      // every centroid in one place: no split separates them
+      if (!must_split)
+        return false;
+      mid = start + count / 2;
+      return true;
+    }
+    double area = bounds.surface_area();
+    double split_cost = options.traversal_cost +
+                        (area > 0.0 ? best_cost / area : double(count));
+    if (!must_split && count <= max_leaf && split_cost >= double(count))
+      return false;
+
+    axis = best_axis;
+    interval const &extent = centroid_bounds.get_axis_interval(axis);
+    auto middle = std::partition(
+        items.begin() + start, items.begin() + end,
+        [&](index_bvh_item const &item) {
+          return bin_of(item.centroid[axis], extent, bins) <= best_bin;
+        });
+    mid = size_t(middle - items.begin());
+    return true;
+  }
+
+  static int bin_of(double value, interval const &extent, int bins) {
+    int bin = int(bins * (value - extent.min) / (extent.max - extent.min));
+    return std::min(bins - 1, std::max(0, bin));
+  }
+};
+
+#endif // INDEX_BVH_H
@@ -0,0 +1,567 @@
+#ifndef LBVH_H
+#define LBVH_H
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "parallel.h"
+#include "tile_scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+/*
+parallel linear bvh builder for very large primitive counts:
+  1. morton code of every primitive centroid (30 or 63 bits)
+  2. parallel lsd radix sort of the codes
+  3. binary radix tree over the sorted codes, every internal node found
+     independently (Karras 2012, "Maximizing Parallelism in the Construction
+     of BVHs, Octrees, and k-d Trees")
+  4. bounds and sah costs bottom-up, the second child to finish computes the
+     parent
+  5. optional treelet restructuring to win back sah quality (Karras & Aila
+     2013, "Fast Parallel Construction of High-Quality BVHs")
+the result is emitted as a linear_bvh, with small subtrees collapsed into
+leaves where that is cheaper.
+*/
+
+class lbvh_build_options {
+public:
+  int morton_bits = 30;   // 30 (10 per axis) or 63 (21 per axis)
+  int treelet_passes = 0; // restructuring passes, 0 turns it off
+  int treelet_size = 7;   // leaves per treelet, 3 to 8
+  int max_leaf_size = 4;  // subtrees up to this size may become one leaf
+  double traversal_cost = 1.0;
+  int thread_count = 0; // 0: RT_THREADS environment variable or all cores
+};
+
+class lbvh_build_stats {
+public:
+  double morton_seconds = 0, sort_seconds = 0, hierarchy_seconds = 0,
+         bounds_seconds = 0, treelet_seconds = 0, flatten_seconds = 0;
+  bool median_fallback = false; // too deep to traverse, built by median
+
+  double total_seconds() const {
+    return morton_seconds + sort_seconds + hierarchy_seconds + bounds_seconds +
+           treelet_seconds + flatten_seconds;
+  }
+
+  void print(std::ostream &out, std::string const &name) const {
+    out << name << ": built in " << total_seconds() * 1e3 << " ms (morton "
+        << morton_seconds * 1e3 << ", sort " << sort_seconds * 1e3
+        << ", hierarchy " << hierarchy_seconds * 1e3 << ", bounds "
+        << bounds_seconds * 1e3 << ", treelets " << treelet_seconds * 1e3
+        << ", flatten " << flatten_seconds * 1e3 << ")"
+        << (median_fallback ? ", too deep: median split instead" : "")
+        << "\n";
+  }
+};
+
+int count_leading_zeros(uint64_t value) {
+  if (value == 0)
+    return 64;
+#if defined(__GNUC__)
+  return __builtin_clzll(value);
+#else
+  int zeros = 0;
+  while (!(value & (1ULL << 63))) {
+    value <<= 1;
+    zeros++;
+  }
+  return zeros;
+#endif
+}
+
+// spreads the low `bits` bits of value so two zero bits follow each one
+uint64_t spread_bits(uint64_t value, int bits) {
+  uint64_t result = 0;
+  for (int bit = 0; bit < bits; bit++)
+    result |= ((value >> bit) & 1ULL) << (3 * bit);
+  return result;
+}
+
+uint64_t morton_code(point3 const &normalized, int bits_per_axis) {
+  double scale = double((1ULL << bits_per_axis) - 1);
+  uint64_t code = 0;
+  for (int axis = 0; axis < 3; axis++) {
+    double quantized = std::min(std::max(normalized[axis] * scale, 0.0), scale);
+    code |= spread_bits(uint64_t(quantized), bits_per_axis) << (2 - axis);
+  }
+  return code;
+}
+
+// stable lsd radix sort of keys (and values alongside), 8 bits per pass.
+// every thread histograms and scatters its own chunk of the input
+void parallel_radix_sort(std::vector<uint64_t> &keys,
+                         std::vector<uint32_t> &values, int key_bits,
+                         int thread_count) {
+  size_t count = keys.size();
+  size_t chunks = std::max<size_t>(
+      1, std::min<size_t>(size_t(std::max(1, thread_count)), count));
+  size_t chunk_size = (count + chunks - 1) / std::max<size_t>(chunks, 1);
+  std::vector<uint64_t> keys_out(count);
+  std::vector<uint32_t> values_out(count);
+  std::vector<size_t> offsets(chunks * 256);
+
+  for (int shift = 0; shift < key_bits; shift += 8) {
+    std::fill(offsets.begin(), offsets.end(), 0);
+    parallel_for(chunks, int(chunks), [&](size_t first, size_t last) {
+      for (size_t chunk = first; chunk < last; chunk++) {
+        size_t *histogram = &offsets[chunk * 256];
+        size_t end = std::min(count, (chunk + 1) * chunk_size);
+        for (size_t i = chunk * chunk_size; i < end; i++)
+          histogram[(keys[i] >> shift) & 0xff]++;
+      }
+    });
+
+    // digit-major prefix sum: all of digit d's slots (chunk by chunk) come
+    // before digit d+1's, which keeps the sort stable
+    size_t running = 0;
+    for (int digit = 0; digit < 256; digit++) {
+      for (size_t chunk = 0; chunk < chunks; chunk++) {
+        size_t bucket = offsets[chunk * 256 + digit];
+        offsets[chunk * 256 + digit] = running;
+        running += bucket;
+      }
+    }
+
+    parallel_for(chunks, int(chunks), [&](size_t first, size_t last) {
+      for (size_t chunk = first; chunk < last; chunk++) {
+        size_t *offset = &offsets[chunk * 256];
+        size_t end = std::min(count, (chunk + 1) * chunk_size);
+        for (size_t i = chunk * chunk_size; i < end; i++) {
+          size_t destination = offset[(keys[i] >> shift) & 0xff]++;
+          keys_out[destination] = keys[i];
+          values_out[destination] = values[i];
+        }
+      }
+    });
+
+    keys.swap(keys_out);
+    values.swap(values_out);
+  }
+}
+
+class lbvh_builder {
+public:
+  lbvh_builder(hittable_list const &list, lbvh_build_options const &options)
+      : options(options), threads(resolve_thread_count(options.thread_count)),
+        primitive_count(list.objects.size()) {
+    bbox = aabb::Empty_bbox;
+    if (primitive_count == 0)
+      return;
+
+    auto start = std::chrono::steady_clock::now();
+    compute_morton_codes(list);
+    stats.morton_seconds = lap(start);
+
+    sorted_primitives.resize(primitive_count);
+    for (size_t i = 0; i < primitive_count; i++)
+      sorted_primitives[i] = uint32_t(i);
+    parallel_radix_sort(codes, sorted_primitives, 3 * bits_per_axis(),
+                        threads);
+    stats.sort_seconds = lap(start);
+
+    size_t node_count = 2 * primitive_count - 1;
+    left.assign(node_count, none);
+    right.assign(node_count, none);
+    parent.assign(node_count, none);
+    node_bounds.resize(node_count);
+    cost.resize(node_count);
+    leaf_count.resize(node_count);
+    build_hierarchy();
+    stats.hierarchy_seconds = lap(start);
+
+    bottom_up([this](uint32_t node) { update_node(node); });
+    stats.bounds_seconds = lap(start);
+
+    int treelet_size = std::min(8, std::max(3, options.treelet_size));
+    for (int pass = 0; pass < options.treelet_passes; pass++)
+      bottom_up([this, treelet_size](uint32_t node) {
+        if (leaf_count[node] >= uint32_t(treelet_size))
+          restructure_treelet(node, treelet_size);
+        else
+          update_node(node);
+      });
+    stats.treelet_seconds = lap(start);
+  }
+
+  shared_ptr<linear_bvh> emit() {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<linear_bvh_node> nodes;
+    std::vector<shared_ptr<hittable>> objects;
+    shared_ptr<linear_bvh> result;
+    if (primitive_count > 0 && !emit_node(root(), 1, nodes, objects)) {
+      // as linear_bvh(hittable_list) does for sah, the median split never
+      // goes deeper than log2(n)
+      hittable_list list;
+      for (auto const &primitive : primitives)
+        list.add(primitive.object);
+      bvh_build_options median;
+      median.split_method = bvh_split_method::median;
+      median.max_leaf_size = options.max_leaf_size;
+      median.traversal_cost = options.traversal_cost;
+      result = make_shared<linear_bvh>(bvh_node(list, median));
+      stats.median_fallback = true;
+    } else {
+      result = make_shared<linear_bvh>(std::move(nodes), std::move(objects),
+                                       bbox);
+    }
+    stats.flatten_seconds = lap(start);
+    return result;
+  }
+
+  lbvh_build_stats const &build_stats() const { return stats; }
+
+private:
+  enum : uint32_t { none = 0xffffffffu }; // parent of the root
+
+  lbvh_build_options options;
+  int threads;
+  size_t primitive_count;
+  aabb bbox;
+  lbvh_build_stats stats;
+
+  std::vector<bvh_primitive> primitives;
+  std::vector<uint64_t> codes;
+  std::vector<uint32_t> sorted_primitives;
+
+  // nodes [0, n - 1) are internal with node 0 the root, nodes [n - 1, 2n - 1)
+  // are leaves, leaf n - 1 + k holding sorted primitive k
+  std::vector<uint32_t> left, right, parent;
+  std::vector<aabb> node_bounds;
+  std::vector<double> cost;         // unnormalized sah cost of the subtree
+  std::vector<uint32_t> leaf_count; // primitives below the node
+
+  static double lap(std::chrono::steady_clock::time_point &start) {
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - start).count();
+    start = now;
+    return seconds;
+  }
+
+  int bits_per_axis() const { return options.morton_bits >= 63 ? 21 : 10; }
+  uint32_t root() const { return primitive_count == 1 ? leaf(0) : 0; }
+  uint32_t leaf(size_t k) const { return uint32_t(primitive_count - 1 + k); }
+  bool is_leaf(uint32_t node) const { return node >= primitive_count - 1; }
+
+  void compute_morton_codes(hittable_list const &list) {
+    primitives.resize(primitive_count);
+    codes.resize(primitive_count);
+
+    std::vector<aabb> partial_bounds(threads, aabb::Empty_bbox),
+        partial_centroids(threads, aabb::Empty_bbox);
+    std::atomic<int> next_partial(0);
+    parallel_for(primitive_count, threads, [&](size_t begin, size_t end) {
+      aabb bounds = aabb::Empty_bbox, centroids = aabb::Empty_bbox;
+      for (size_t i = begin; i < end; i++) {
+        bvh_primitive &primitive = primitives[i];
+        primitive.object = list.objects[i];
+        primitive.bbox = primitive.object->bounding_box();
+        primitive.centroid = primitive.bbox.centroid();
+        point3 const &centroid = primitive.centroid;
+        bounds = aabb(bounds, primitive.bbox);
+        centroids = aabb(centroids, aabb(centroid, centroid));
+      }
+      int slot = next_partial++;
+      partial_bounds[slot] = bounds;
+      partial_centroids[slot] = centroids;
+    });
+
+    aabb centroid_bounds = aabb::Empty_bbox;
+    for (int i = 0; i < threads; i++) {
+      bbox = aabb(bbox, partial_bounds[i]);
+      centroid_bounds = aabb(centroid_bounds, partial_centroids[i]);
+    }
+
+    point3 low(centroid_bounds.x_interval.min, centroid_bounds.y_interval.min,
+               centroid_bounds.z_interval.min);
+    vec3 extent(centroid_bounds.x_interval.length(),
+                centroid_bounds.y_interval.length(),
+                centroid_bounds.z_interval.length());
+    int bits = bits_per_axis();
+    parallel_for(primitive_count, threads, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        vec3 offset = primitives[i].centroid - low;
+        point3 normalized;
+        for (int axis = 0; axis < 3; axis++) // flat axes map to the middle
+          normalized[axis] =
+              extent[axis] > 0.0 ? offset[axis] / extent[axis] : 0.5;
+        codes[i] = morton_code(normalized, bits);
+      }
+    });
+  }
+
+  // length of the common prefix of sorted keys i and j; equal codes are
+  // told apart by their index, so every key is unique
+  int common_prefix(int64_t i, int64_t j) const {
+    if (j < 0 || j >= int64_t(primitive_count))
+      return -1;
+    uint64_t a = codes[i], b = codes[j];
+    if (a == b)
+      return 64 + count_leading_zeros(uint64_t(i ^ j));
+    return count_leading_zeros(a ^ b);
+  }
+
+  void build_hierarchy() {
+    int64_t internal_count = int64_t(primitive_count) - 1;
+    parallel_for(size_t(internal_count), threads, [&](size_t begin,
+                                                      size_t end) {
+      for (int64_t i = int64_t(begin); i < int64_t(end); i++) {
+        // the range of node i extends towards the neighbour it shares the
+        // longer prefix with
+        int direction =
+            common_prefix(i, i + 1) - common_prefix(i, i - 1) > 0 ? 1 : -1;
+        int minimum_prefix = common_prefix(i, i - direction);
+
+        int64_t length_bound = 2;
+        while (common_prefix(i, i + length_bound * direction) > minimum_prefix)
+          length_bound *= 2;
+        int64_t length = 0;
+        for (int64_t step = length_bound / 2; step >= 1; step /= 2)
+          if (common_prefix(i, i + (length + step) * direction) >
+              minimum_prefix)
+            length += step;
+        int64_t j = i + length * direction;
+
+        // split where the prefix of the whole range ends
+        int node_prefix = common_prefix(i, j);
+        int64_t split = 0, divisor = 2, step;
+        do {
+          step = (length + divisor - 1) / divisor;
+          if (common_prefix(i, i + (split + step) * direction) > node_prefix)
+            split += step;
+          divisor *= 2;
+        } while (step > 1);
+        int64_t gamma = i + split * direction + std::min(direction, 0);
+
+        uint32_t left_child =
+            std::min(i, j) == gamma ? leaf(size_t(gamma)) : uint32_t(gamma);
+        uint32_t right_child = std::max(i, j) == gamma + 1
+                                   ? leaf(size_t(gamma + 1))
+                                   : uint32_t(gamma + 1);
+        left[i] = left_child;
+        right[i] = right_child;
+        parent[left_child] = uint32_t(i);
+        parent[right_child] = uint32_t(i);
+      }
+    });
+  }
+
+  // runs visit on every internal node after both of its children, leaves
+  // first. the first child to arrive at a parent stops, the second goes on
+  void bottom_up(std::function<void(uint32_t)> const &visit) {
+    if (primitive_count < 2) {
+      if (primitive_count == 1)
+        set_leaf(0);
+      return;
+    }
+
+    std::vector<std::atomic<uint32_t>> arrivals(primitive_count - 1);
+    for (auto &arrival : arrivals)
+      arrival.store(0, std::memory_order_relaxed);
+
+    parallel_for(primitive_count, threads, [&](size_t begin, size_t end) {
+      for (size_t k = begin; k < end; k++) {
+        set_leaf(k);
+        uint32_t node = parent[leaf(k)];
+        while (node != none) {
+          if (arrivals[node].fetch_add(1, std::memory_order_acq_rel) == 0)
+            break;
+          visit(node);
+          node = parent[node];
+        }
+      }
+    });
+  }
+
+  void set_leaf(size_t k) {
+    uint32_t node = leaf(k);
+    node_bounds[node] = primitives[sorted_primitives[k]].bbox;
+    cost[node] = node_bounds[node].surface_area();
+    leaf_count[node] = 1;
+  }
+
+  void update_node(uint32_t node) {
+    uint32_t l = left[node], r = right[node];
+    node_bounds[node] = aabb(node_bounds[l], node_bounds[r]);
+    cost[node] = options.traversal_cost * node_bounds[node].surface_area() +
+                 cost[l] + cost[r];
+    leaf_count[node] = leaf_count[l] + leaf_count[r];
+  }
+
+  void restructure_treelet(uint32_t treelet_root, int treelet_size) {
+    update_node(treelet_root);
+
+    // grow the treelet by opening its largest-area internal leaf
+    uint32_t leaves[8];
+    uint32_t internals[8];
+    int leaves_used = 2, internals_used = 0;
+    leaves[0] = left[treelet_root];
+    leaves[1] = right[treelet_root];
+    while (leaves_used < treelet_size) {
+      int largest = -1;
+      double largest_area = -1.0;
+      for (int i = 0; i < leaves_used; i++) {
+        double area = node_bounds[leaves[i]].surface_area();
+        if (!is_leaf(leaves[i]) && area > largest_area) {
+          largest = i;
+          largest_area = area;
+        }
+      }
+      if (largest < 0)
+        break;
+      uint32_t opened = leaves[largest];
+      internals[internals_used++] = opened;
+      leaves[largest] = left[opened];
+      leaves[leaves_used++] = right[opened];
+    }
+    if (leaves_used < 3)
+      return;
+
+    // optimal topology over every subset of the treelet's leaves
+    int subset_count = 1 << leaves_used;
+    aabb subset_bounds[256];
+    double subset_cost[256];
+    int best_partition[256];
+    for (int subset = 1; subset < subset_count; subset++) {
+      int lowest_bit = subset & -subset;
+      int lowest = 0;
+      while ((1 << lowest) != lowest_bit)
+        lowest++;
+      int rest = subset ^ lowest_bit;
+      subset_bounds[subset] =
+          rest == 0 ? node_bounds[leaves[lowest]]
+                    : aabb(subset_bounds[rest], node_bounds[leaves[lowest]]);
+      if (rest == 0) {
+        subset_cost[subset] = cost[leaves[lowest]];
+        continue;
+      }
+
+      // each unordered split once: the part holding the lowest leaf
+      double best = INFINITY_DOUBLE;
+      for (int part = (subset - 1) & subset; part > 0;
+           part = (part - 1) & subset) {
+        if (!(part & lowest_bit))
+          continue;
+        double split_cost = subset_cost[part] + subset_cost[subset ^ part];
+        if (split_cost < best) {
+          best = split_cost;
+          best_partition[subset] = part;
+        }
+      }
+      subset_cost[subset] =
+          options.traversal_cost * subset_bounds[subset].surface_area() + best;
+    }
+
+    int full = subset_count - 1;
+    if (!(subset_cost[full] < cost[treelet_root] * (1.0 - 1e-9)))
+      return;
+
+    int next_internal = 0;
+    form_treelet(full, treelet_root, leaves, internals, next_internal,
+                 best_partition);
+  }
+
+  uint32_t form_treelet(int subset, uint32_t node, uint32_t const *leaves,
+                        uint32_t const *internals, int &next_internal,
+                        int const *best_partition) {
+    int part = best_partition[subset];
+    uint32_t children[2];
+    int parts[2] = {part, subset ^ part};
+    for (int side = 0; side < 2; side++) {
+      int s = parts[side];
+      if ((s & (s - 1)) == 0) { // a single treelet leaf
+        int bit = 0;
+        while ((1 << bit) != s)
+          bit++;
+        children[side] = leaves[bit];
+      } else {
+        children[side] =
+            form_treelet(s, internals[next_internal++], leaves, internals,
+                         next_internal, best_partition);
+      }
+      parent[children[side]] = node;
+    }
+    left[node] = children[0];
+    right[node] = children[1];
+    update_node(node);
+    return node;
+  }
+
+  void collect_objects(uint32_t node,
+                       std::vector<shared_ptr<hittable>> &objects) const {
+    if (is_leaf(node)) {
+      size_t k = node - (primitive_count - 1);
+      objects.push_back(primitives[sorted_primitives[k]].object);
+      return;
+    }
+    collect_objects(left[node], objects);
+    collect_objects(right[node], objects);
+  }
+
+  // false if the tree is deeper than linear_bvh can traverse
+  bool emit_node(uint32_t node, int depth, std::vector<linear_bvh_node> &nodes,
+                 std::vector<shared_ptr<hittable>> &objects) const {
+    if (depth > linear_bvh::max_depth)
+      return false;
+
+    uint32_t index = uint32_t(nodes.size());
+    nodes.push_back(linear_bvh_node());
+    linear_bvh::set_bounds(nodes[index], node_bounds[node]);
+
+    double leaf_cost =
+        leaf_count[node] * node_bounds[node].surface_area();
+    if (is_leaf(node) ||
+        (leaf_count[node] <= uint32_t(std::max(1, options.max_leaf_size)) &&
+         leaf_cost <= cost[node])) {
+      nodes[index].offset = uint32_t(objects.size());
+      nodes[index].primitive_count = uint16_t(leaf_count[node]);
+      nodes[index].axis = 0;
+      collect_objects(node, objects);
+      return true;
+    }
+
+    // first child below the second on the axis their centers differ most
+    point3 a = node_bounds[left[node]].centroid();
+    point3 b = node_bounds[right[node]].centroid();
+    vec3 difference = b - a;
+    int axis = 0;
+    for (int i = 1; i < 3; i++)
+      if (std::fabs(difference[i]) > std::fabs(difference[axis]))
+        axis = i;
+    uint32_t first = left[node], second = right[node];
+    if (difference[axis] < 0)
+      std::swap(first, second);
+
+    if (!emit_node(first, depth + 1, nodes, objects))
+      return false;
+    uint32_t second_index = uint32_t(nodes.size());
+    if (!emit_node(second, depth + 1, nodes, objects))
+      return false;
+    nodes[index].offset = second_index;
+    nodes[index].primitive_count = 0;
+    nodes[index].axis = uint8_t(axis);
+    return true;
+  }
+};
+
+shared_ptr<linear_bvh>
+build_lbvh(hittable_list const &list,
+           lbvh_build_options const &options = lbvh_build_options(),
+           lbvh_build_stats *stats = nullptr) {
+  lbvh_builder builder(list, options);
+  shared_ptr<linear_bvh> result = builder.emit();
+  if (stats)
+    *stats = builder.build_stats();
+  return result;
+}
+
+#endif // LBVH_H
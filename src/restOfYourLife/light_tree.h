@@ -0,0 +1,366 @@
+#ifndef LIGHT_TREE_H
+#define LIGHT_TREE_H
+
+#include "aabb.h"
+#include "common.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "interval.h"
+#include "material.h"
+#include "ray.h"
+#include "vec3.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+/*
+bounds of a group of emitters: box, cone of surface normals and total power.
+importance() is an upper bound of what the group can send towards a point,
+used to pick a child during light tree traversal.
+*/
+class light_bounds {
+public:
+  aabb bounds;
+  vec3 axis = vec3(0, 0, 1);
+  double cos_theta_normals = 1.0;
+  double cos_theta_emission = 1.0;
+  double power = 0.0;
+
+  light_bounds() {}
+
+  light_bounds(emitter_shape const &shape, double shape_power)
+      : bounds(shape.bounds), axis(unit_vector(shape.axis)),
+        cos_theta_normals(shape.cos_theta_normals),
+        cos_theta_emission(shape.cos_theta_emission), power(shape_power) {}
+
+  light_bounds(light_bounds const &a, light_bounds const &b)
+      : bounds(a.bounds, b.bounds), power(a.power + b.power) {
+    merge_cones(a, b);
+    cos_theta_emission = std::min(a.cos_theta_emission, b.cos_theta_emission);
+  }
+
+  double importance(point3 const &point) const {
+    point3 center = bounds.centroid();
+    vec3 extent(bounds.x_interval.length(), bounds.y_interval.length(),
+                bounds.z_interval.length());
+    double radius = 0.5 * extent.norm();
+
+    vec3 to_point = point - center;
+    double distance_squared = to_point.norm_square();
+    double distance = std::sqrt(distance_squared);
+
+    // angle between the cone axis and the point, minus the normal spread and
+    // the angle the box covers as seen from the point
+    double cos_theta_w = distance > 0.0
+                             ? dotProduct(axis, to_point) / distance
+                             : 1.0; // center on the point
+    double cos_theta = reduce_angle(cos_theta_w, cos_theta_normals);
+    if (distance_squared > radius * radius) {
+      double sin_theta_b_squared = radius * radius / distance_squared;
+      cos_theta = reduce_angle(cos_theta, std::sqrt(1 - sin_theta_b_squared));
+    } else {
+      cos_theta = 1.0; // inside the bounding sphere, every angle is possible
+    }
+
+    if (cos_theta <= cos_theta_emission)
+      return 0.0;
+    // no closer than the box size, nearby groups would blow up otherwise
+    return power * cos_theta / std::max(distance_squared, radius * radius);
+  }
+
+private:
+  static double sin_from_cos(double cos_theta) {
+    return std::sqrt(std::max(0.0, 1.0 - cos_theta * cos_theta));
+  }
+
+  // cos(max(0, theta - delta))
+  static double reduce_angle(double cos_theta, double cos_delta) {
+    if (cos_theta >= cos_delta)
+      return 1.0;
+    return cos_theta * cos_delta +
+           sin_from_cos(cos_theta) * sin_from_cos(cos_delta);
+  }
+
+  // the smallest cone (around a rotated axis) holding both normal cones
+  void merge_cones(light_bounds const &a, light_bounds const &b) {
+    if (a.power == 0.0 && b.power == 0.0) {
+      axis = a.axis;
+      cos_theta_normals = std::min(a.cos_theta_normals, b.cos_theta_normals);
+      return;
+    }
+
+    double theta_a = std::acos(clamp_cosine(a.cos_theta_normals));
+    double theta_b = std::acos(clamp_cosine(b.cos_theta_normals));
+    double theta_d = std::acos(clamp_cosine(dotProduct(a.axis, b.axis)));
+    if (std::min(theta_d + theta_b, PI) <= theta_a) {
+      axis = a.axis;
+      cos_theta_normals = a.cos_theta_normals;
+      return;
+    }
+    if (std::min(theta_d + theta_a, PI) <= theta_b) {
+      axis = b.axis;
+      cos_theta_normals = b.cos_theta_normals;
+      return;
+    }
+
+    double theta_o = 0.5 * (theta_a + theta_d + theta_b);
+    vec3 rotation_axis = crossProduct(a.axis, b.axis);
+    if (theta_o >= PI || rotation_axis.norm_square() < 1e-12) {
+      axis = a.axis;
+      cos_theta_normals = -1.0;
+      return;
+    }
+
+    // rotate a.axis towards b.axis by theta_o - theta_a (rodrigues)
+    double theta_r = theta_o - theta_a;
+    vec3 k = unit_vector(rotation_axis);
+    axis = a.axis * std::cos(theta_r) +
+           crossProduct(k, a.axis) * std::sin(theta_r) +
+           k * dotProduct(k, a.axis) * (1 - std::cos(theta_r));
+    axis = unit_vector(axis);
+    cos_theta_normals = std::cos(theta_o);
+  }
+
+  static double clamp_cosine(double cosine) {
+    return std::max(-1.0, std::min(1.0, cosine));
+  }
+};
+
+/*
+many-light sampling: a binary tree over the emitters, each node bounding its
+lights' positions, normals and power. random() walks down from the root and
+picks a child in proportion to its importance for the shading point, so a
+light is chosen in O(log n) with a probability that follows its contribution
+instead of 1/n. pdf_value() finds the lights a direction hits and replays the
+same choices for each of them.
+
+it is a hittable over the lights, so it is passed wherever a hittable_list of
+lights was (hittable_pdf, the nee integrator) and materials are unchanged.
+*/
+class light_tree : public hittable {
+public:
+  light_tree(hittable_list const &lights) {
+    std::vector<uint32_t> order;
+    for (auto const &object : lights.objects) {
+      emitter_shape shape;
+      if (!object->emitter(shape))
+        throw std::invalid_argument("light_tree: object is not an emitter");
+      order.push_back(uint32_t(emitters.size()));
+      emitters.push_back(object.get());
+      owners.push_back(object);
+      leaf_bounds.push_back(light_bounds(shape, emitted_power(shape)));
+    }
+    leaf_node.resize(emitters.size());
+    if (!emitters.empty())
+      build(order, 0, order.size(), none);
+  }
+
+  bool intersect(const Ray &ray, interval ray_range,
+                 hit_info &info) const override {
+    if (nodes.empty())
+      return false;
+
+    bool hit_anything = false;
+    uint32_t stack[max_depth];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0) {
+      node const &current = nodes[stack[--stack_size]];
+      if (!current.bounds.bounds.hit(ray, ray_range))
+        continue;
+      if (current.is_leaf()) {
+        if (emitters[current.light]->intersect(ray, ray_range, info)) {
+          hit_anything = true;
+          ray_range.max = info.factorOfDirection;
+        }
+      } else {
+        stack[stack_size++] = current.children[1];
+        stack[stack_size++] = current.children[0];
+      }
+    }
+    return hit_anything;
+  }
+
+  bool occluded(const Ray &ray, interval ray_range) const override {
+    if (nodes.empty())
+      return false;
+
+    uint32_t stack[max_depth];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0) {
+      node const &current = nodes[stack[--stack_size]];
+      if (!current.bounds.bounds.hit(ray, ray_range))
+        continue;
+      if (current.is_leaf()) {
+        if (emitters[current.light]->occluded(ray, ray_range))
+          return true;
+      } else {
+        stack[stack_size++] = current.children[1];
+        stack[stack_size++] = current.children[0];
+      }
+    }
+    return false;
+  }
+
+  aabb bounding_box() const override {
+    return nodes.empty() ? aabb() : nodes[0].bounds.bounds;
+  }
+
+  int instance_depth() const override { return deepest_instance(owners); }
+
+  // every light the direction passes through, weighted by the chance the
+  // traversal in random() picks it
+  double pdf_value(point3 const &origin, vec3 const &direction) const override {
+    if (nodes.empty())
+      return 0.0;
+
+    Ray ray(origin, direction);
+    interval const ray_range(0.001, INFINITY_DOUBLE);
+    double pdf = 0.0;
+    uint32_t stack[max_depth];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0) {
+      node const &current = nodes[stack[--stack_size]];
+      if (!current.bounds.bounds.hit(ray, ray_range))
+        continue;
+      if (current.is_leaf()) {
+        double light_pdf =
+            emitters[current.light]->pdf_value(origin, direction);
+        if (light_pdf > 0.0)
+          pdf += light_pdf * selection_probability(current.light, origin);
+      } else {
+        stack[stack_size++] = current.children[1];
+        stack[stack_size++] = current.children[0];
+      }
+    }
+    return pdf;
+  }
+
+  vec3 random(point3 const &origin) const override {
+    if (nodes.empty())
+      return vec3(1.0, 0.0, 0.0);
+
+    // one uniform for the whole descent, rescaled to [0, 1) after each
+    // choice, so light selection takes a single sampler dimension
+    double u = random_double();
+    uint32_t index = 0;
+    while (!nodes[index].is_leaf()) {
+      node const &current = nodes[index];
+      double left = first_child_probability(current, origin);
+      if (u < left) {
+        u /= left;
+        index = current.children[0];
+      } else {
+        u = std::min((u - left) / (1.0 - left), 0.99999999999999989);
+        index = current.children[1];
+      }
+    }
+    return emitters[nodes[index].light]->random(origin);
+  }
+
+  // chance that random(origin) samples the given light
+  double selection_probability(uint32_t light, point3 const &origin) const {
+    double probability = 1.0;
+    uint32_t index = leaf_node[light];
+    while (nodes[index].parent != none) {
+      node const &parent = nodes[nodes[index].parent];
+      double left = first_child_probability(parent, origin);
+      probability *= parent.children[0] == index ? left : 1.0 - left;
+      index = nodes[index].parent;
+    }
+    return probability;
+  }
+
+  size_t light_count() const { return emitters.size(); }
+  size_t node_count() const { return nodes.size(); }
+
+private:
+  static int const max_depth = 64; // size of the traversal stack
+  enum : uint32_t { none = 0xffffffffu };
+
+  class node {
+  public:
+    light_bounds bounds;
+    uint32_t children[2] = {none, none};
+    uint32_t parent = none;
+    uint32_t light = none; // leaves only
+
+    bool is_leaf() const { return light != none; }
+  };
+
+  std::vector<node> nodes;
+  std::vector<hittable const *> emitters;
+  std::vector<shared_ptr<hittable>> owners; // keeps emitters alive
+  std::vector<light_bounds> leaf_bounds;
+  std::vector<uint32_t> leaf_node; // light -> its node
+
+  // radiant power up to a constant factor: area times mean emitted radiance.
+  // emitters without a (known) emission are weighted by their area alone
+  static double emitted_power(emitter_shape const &shape) {
+    if (shape.material == nullptr)
+      return shape.area;
+    color3 emission = shape.material->emitted(shape.texture_point, shape.point);
+    double radiance = (emission.x + emission.y + emission.z) / 3.0;
+    return radiance > 0.0 ? radiance * shape.area : shape.area;
+  }
+
+  // both children get half when neither can contribute, so every light keeps
+  // a nonzero chance and random() and pdf_value() always agree
+  static double importance_share(double first, double second) {
+    double total = first + second;
+    return total > 0.0 ? first / total : 0.5;
+  }
+
+  double first_child_probability(node const &parent,
+                                 point3 const &origin) const {
+    double first = nodes[parent.children[0]].bounds.importance(origin);
+    double second = nodes[parent.children[1]].bounds.importance(origin);
+    return importance_share(first, second);
+  }
+
+  // splits at the median centroid of the widest axis, which keeps the depth
+  // at log2(n) for the stack-based traversals
+  uint32_t build(std::vector<uint32_t> &order, size_t begin, size_t end,
+                 uint32_t parent) {
+    uint32_t index = uint32_t(nodes.size());
+    nodes.push_back(node());
+    nodes[index].parent = parent;
+
+    if (end - begin == 1) {
+      uint32_t light = order[begin];
+      nodes[index].bounds = leaf_bounds[light];
+      nodes[index].light = light;
+      leaf_node[light] = index;
+      return index;
+    }
+
+    aabb centroids;
+    for (size_t i = begin; i < end; i++) {
+      point3 c = leaf_bounds[order[i]].bounds.centroid();
+      centroids = aabb(centroids, aabb(c, c));
+    }
+    int axis = centroids.longest_axis();
+    size_t middle = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + middle,
+                     order.begin() + end, [&](uint32_t a, uint32_t b) {
+                       return leaf_bounds[a].bounds.centroid()[axis] <
+                              leaf_bounds[b].bounds.centroid()[axis];
+                     });
+
+    uint32_t first = build(order, begin, middle, index);
+    uint32_t second = build(order, middle, end, index);
+    // nodes may have been reallocated, index again
+    nodes[index].children[0] = first;
+    nodes[index].children[1] = second;
+    nodes[index].bounds = light_bounds(nodes[first].bounds,
+                                       nodes[second].bounds);
+    return index;
+  }
+};
+
+#endif // LIGHT_TREE_H
@@ -0,0 +1,414 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "interval.h"
+#include "ray.h"
+#include "ray_packet.h"
+#include "simd.h"
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/*
+one node of a depth-first flattened bvh, 32 bytes so two share a cache line.
+the first child of an interior node is always the next node in the array,
+offset holds the second one. leaves use offset as their first primitive.
+*/
+class linear_bvh_node {
+public:
+  float bounds_min[3];
+  float bounds_max[3];
+  uint32_t offset;
+  uint16_t primitive_count; // 0 for interior nodes
+  uint8_t axis;             // split axis, first child is below on it
+  uint8_t padding;
+
+  bool is_leaf() const { return primitive_count > 0; }
+
+  bool hit(double const origin[3], double const inverse_direction[3],
+           interval ray_range) const {
+    for (int ith_axis = 0; ith_axis < 3; ith_axis++) {
+      double inverse = inverse_direction[ith_axis];
+      double root1 = (bounds_min[ith_axis] - origin[ith_axis]) * inverse;
+      double root2 = (bounds_max[ith_axis] - origin[ith_axis]) * inverse;
+      double t0 = root1 < root2 ? root1 : root2;
+      double t1 = root1 < root2 ? root2 : root1;
+
+      // comparisons against NaN (ray inside a slab plane) keep the range
+      ray_range.min = t0 > ray_range.min ? t0 : ray_range.min;
+      ray_range.max = t1 < ray_range.max ? t1 : ray_range.max;
+
+      if (ray_range.min > ray_range.max)
+        return false;
+    }
+    return true;
+  }
+};
+
+static_assert(sizeof(linear_bvh_node) == 32,
+              "linear_bvh_node must stay 32 bytes");
+
+// the lanes in mask whose rays enter the node's box within their ranges.
+// the kernels do linear_bvh_node::hit's arithmetic in doubles, lane by lane
+// or a register at a time, so a packet finds exactly what its rays would
+// alone
+typedef uint32_t (*packet_node_kernel)(linear_bvh_node const &,
+                                       ray_packet const &, uint32_t);
+
+uint32_t packet_hits_node_scalar(linear_bvh_node const &node,
+                                 ray_packet const &packet, uint32_t mask) {
+  uint32_t result = 0;
+  for (int lane; ray_packet::next_lane(mask, lane);) {
+    double origin[3], inverse_direction[3];
+    for (int axis = 0; axis < 3; axis++) {
+      origin[axis] = packet.origin[axis][lane];
+      inverse_direction[axis] = packet.inverse_direction[axis][lane];
+    }
+    if (node.hit(origin, inverse_direction, packet.range(lane)))
+      result |= 1u << lane;
+  }
+  return result;
+}
+
+#ifdef X86_SIMD
+// hit()'s selects as min/max, which return their second operand when either
+// is NaN: t0 = min(root1, root2), t1 = max(root2, root1), and the range goes
+// second so a NaN root never moves it
+
+__attribute__((target("sse4.1"))) uint32_t
+packet_hits_node_sse4(linear_bvh_node const &node, ray_packet const &packet,
+                      uint32_t mask) {
+  uint32_t result = 0;
+  for (int first = 0; first < packet.size; first += 2) {
+    if (((mask >> first) & 0x3) == 0)
+      continue;
+    __m128d near = _mm_loadu_pd(packet.t_min + first);
+    __m128d far = _mm_loadu_pd(packet.t_max + first);
+    for (int axis = 0; axis < 3; axis++) {
+      __m128d origin = _mm_loadu_pd(packet.origin[axis] + first);
+      __m128d inverse = _mm_loadu_pd(packet.inverse_direction[axis] + first);
+      __m128d root1 = _mm_mul_pd(
+          _mm_sub_pd(_mm_set1_pd(node.bounds_min[axis]), origin), inverse);
+      __m128d root2 = _mm_mul_pd(
+          _mm_sub_pd(_mm_set1_pd(node.bounds_max[axis]), origin), inverse);
+      near = _mm_max_pd(_mm_min_pd(root1, root2), near);
+      far = _mm_min_pd(_mm_max_pd(root2, root1), far);
+    }
+    result |= uint32_t(_mm_movemask_pd(_mm_cmple_pd(near, far))) << first;
+  }
+  return result & mask;
+}
+
+__attribute__((target("avx2"))) uint32_t
+packet_hits_node_avx2(linear_bvh_node const &node, ray_packet const &packet,
+                      uint32_t mask) {
+  uint32_t result = 0;
+  for (int first = 0; first < packet.size; first += 4) {
+    if (((mask >> first) & 0xf) == 0)
+      continue;
+    __m256d near = _mm256_loadu_pd(packet.t_min + first);
+    __m256d far = _mm256_loadu_pd(packet.t_max + first);
+    for (int axis = 0; axis < 3; axis++) {
+      __m256d origin = _mm256_loadu_pd(packet.origin[axis] + first);
+      __m256d inverse =
+          _mm256_loadu_pd(packet.inverse_direction[axis] + first);
+      __m256d root1 = _mm256_mul_pd(
+          _mm256_sub_pd(_mm256_set1_pd(node.bounds_min[axis]), origin),
+          inverse);
+      __m256d root2 = _mm256_mul_pd(
+          _mm256_sub_pd(_mm256_set1_pd(node.bounds_max[axis]), origin),
+          inverse);
+      near = _mm256_max_pd(_mm256_min_pd(root1, root2), near);
+      far = _mm256_min_pd(_mm256_max_pd(root2, root1), far);
+    }
+    result |= uint32_t(_mm256_movemask_pd(_mm256_cmp_pd(near, far, _CMP_LE_OQ)))
+              << first;
+  }
+  return result & mask;
+}
+#endif
+
+// the widest kernel the cpu runs, looked up once
+packet_node_kernel packet_node_test() {
+  static packet_node_kernel const kernel = []() -> packet_node_kernel {
+#ifdef X86_SIMD
+    simd_level level = detect_simd_level();
+    if (level == simd_level::avx2)
+      return packet_hits_node_avx2;
+    if (level == simd_level::sse4)
+      return packet_hits_node_sse4;
+#endif
+    return packet_hits_node_scalar;
+  }();
+  return kernel;
+}
+
+class linear_bvh : public hittable {
+public:
+  static int const max_depth = 64; // size of the traversal stack
+  static int const min_packet_rays = 2;
+
+  linear_bvh(hittable_list const &list,
+             bvh_build_options const &options = bvh_build_options()) {
+    bvh_node tree(list, options);
+    if (tree.build_stats().max_depth > max_depth) {
+      // sah can chain 1 vs n-1 splits on odd inputs, median never goes deeper
+      // than log2(n)
+      bvh_build_options median = options;
+      median.split_method = bvh_split_method::median;
+      flatten(bvh_node(list, median));
+    } else {
+      flatten(tree);
+    }
+  }
+
+  linear_bvh(bvh_node const &tree) {
+    if (tree.build_stats().max_depth > max_depth)
+      throw std::invalid_argument("linear_bvh: tree too deep to traverse");
+    flatten(tree);
+  }
+
+  // for builders that emit the flattened layout themselves (lbvh). leaves
+  // index into objects; the caller guarantees the depth fits the stack
+  linear_bvh(std::vector<linear_bvh_node> &&flattened,
+             std::vector<shared_ptr<hittable>> &&objects, aabb const &bounds)
+      : nodes(std::move(flattened)), owners(std::move(objects)), bbox(bounds) {
+    primitives.reserve(owners.size());
+    for (auto const &object : owners)
+      primitives.push_back(object.get());
+  }
+
+  bool intersect(const Ray &ray, interval ray_range,
+                 hit_info &info) const override {
+    return !nodes.empty() && closest(0, ray, ray_range, info);
+  }
+
+  // the packet goes down the tree as one: each node is tested against the
+  // rays still in it at once, and children are taken in the order of the
+  // first of them. rays go on one by one through a subtree fewer than
+  // min_packet_rays of them enter, where a packet would mostly carry
+  // misses
+  void intersect_packet(ray_packet &packet, uint32_t mask, hit_info *infos,
+                        uint32_t &hits) const override {
+    if (nodes.empty() || mask == 0)
+      return;
+    packet_node_kernel hits_node = packet_node_test();
+
+    uint32_t stack[max_depth], stack_mask[max_depth];
+    int stack_size = 0;
+    uint32_t current = 0;
+    while (true) {
+      linear_bvh_node const &node = nodes[current];
+      uint32_t active = hits_node(node, packet, mask);
+      if (ray_packet::lane_count(active) < min_packet_rays) {
+        for (int lane; ray_packet::next_lane(active, lane);) {
+          if (closest(current, packet.rays[lane], packet.range(lane),
+                      infos[lane])) {
+            packet.t_max[lane] = infos[lane].factorOfDirection;
+            hits |= 1u << lane;
+          }
+        }
+      } else if (node.is_leaf()) {
+        for (uint32_t i = 0; i < node.primitive_count; i++)
+          primitives[node.offset + i]->intersect_packet(packet, active, infos,
+                                                        hits);
+      } else {
+        int lead = __builtin_ctz(active);
+        stack_mask[stack_size] = active;
+        if (packet.inverse_direction[node.axis][lead] < 0.0) {
+          stack[stack_size++] = current + 1;
+          current = node.offset;
+        } else {
+          stack[stack_size++] = node.offset;
+          current = current + 1;
+        }
+        mask = active;
+        continue;
+      }
+
+      if (stack_size == 0)
+        break;
+      current = stack[--stack_size];
+      mask = stack_mask[stack_size];
+    }
+  }
+
+  bool occluded(const Ray &ray, interval ray_range) const override {
+    if (nodes.empty())
+      return false;
+
+    double origin[3], inverse_direction[3];
+    for (int ith_axis = 0; ith_axis < 3; ith_axis++) {
+      origin[ith_axis] = ray.getOrigin()[ith_axis];
+      inverse_direction[ith_axis] = 1.0 / ray.getDirection()[ith_axis];
+    }
+
+    // the range never shrinks here, so the visiting order does not matter
+    uint32_t stack[max_depth];
+    int stack_size = 0;
+    uint32_t current = 0;
+
+    while (true) {
+      linear_bvh_node const &node = nodes[current];
+      if (node.hit(origin, inverse_direction, ray_range)) {
+        if (node.is_leaf()) {
+          for (uint32_t i = 0; i < node.primitive_count; i++)
+            if (primitives[node.offset + i]->occluded(ray, ray_range))
+              return true;
+        } else {
+          stack[stack_size++] = node.offset;
+          current = current + 1;
+          continue;
+        }
+      }
+
+      if (stack_size == 0)
+        return false;
+      current = stack[--stack_size];
+    }
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  bool random_intersections() const override {
+    return any_random_intersections(owners);
+  }
+
+  int instance_depth() const override { return deepest_instance(owners); }
+
+  size_t node_count() const { return nodes.size(); }
+
+  // expected cost of a ray through the root box: traversal_cost per interior
+  // node and 1 per primitive, weighted by the chance of hitting each node
+  double sah_cost(double traversal_cost = 1.0) const {
+    if (nodes.empty())
+      return 0.0;
+    double root_area = node_area(nodes[0]), cost = 0.0;
+    for (auto const &node : nodes) {
+      double relative_area = root_area > 0.0 ? node_area(node) / root_area : 1;
+      cost += relative_area *
+              (node.is_leaf() ? double(node.primitive_count) : traversal_cost);
+    }
+    return cost;
+  }
+
+  static void set_bounds(linear_bvh_node &node, aabb const &box) {
+    // round outwards, a float box must never be smaller than the double one
+    for (int ith_axis = 0; ith_axis < 3; ith_axis++) {
+      interval const &extent = box.get_axis_interval(ith_axis);
+      float low = float(extent.min), high = float(extent.max);
+      if (double(low) > extent.min)
+        low = std::nextafter(low, -INFINITY);
+      if (double(high) < extent.max)
+        high = std::nextafter(high, INFINITY);
+      node.bounds_min[ith_axis] = low;
+      node.bounds_max[ith_axis] = high;
+    }
+    node.padding = 0;
+  }
+
+private:
+  std::vector<linear_bvh_node> nodes;
+  std::vector<hittable const *> primitives; // what traversal touches
+  std::vector<shared_ptr<hittable>> owners; // keeps primitives alive
+  aabb bbox;
+
+  // closest hit below the node root, as intersect() from the root
+  bool closest(uint32_t root, const Ray &ray, interval ray_range,
+               hit_info &info) const {
+    double origin[3], inverse_direction[3];
+    bool direction_is_negative[3];
+    for (int ith_axis = 0; ith_axis < 3; ith_axis++) {
+      origin[ith_axis] = ray.getOrigin()[ith_axis];
+      inverse_direction[ith_axis] = 1.0 / ray.getDirection()[ith_axis];
+      direction_is_negative[ith_axis] = inverse_direction[ith_axis] < 0.0;
+    }
+
+    uint32_t stack[max_depth];
+    int stack_size = 0;
+    uint32_t current = root;
+    bool hit_anything = false;
+
+    while (true) {
+      linear_bvh_node const &node = nodes[current];
+      if (node.hit(origin, inverse_direction, ray_range)) {
+        if (node.is_leaf()) {
+          for (uint32_t i = 0; i < node.primitive_count; i++) {
+            if (primitives[node.offset + i]->intersect(ray, ray_range, info)) {
+              hit_anything = true;
+              ray_range.max = info.factorOfDirection;
+            }
+          }
+        } else {
+          // visit the child on the ray's side first, so the far one is more
+          // likely to be culled by the shortened ray
+          if (direction_is_negative[node.axis]) {
+            stack[stack_size++] = current + 1;
+            current = node.offset;
+          } else {
+            stack[stack_size++] = node.offset;
+            current = current + 1;
+          }
+          continue;
+        }
+      }
+
+      if (stack_size == 0)
+        break;
+      current = stack[--stack_size];
+    }
+
+    return hit_anything;
+  }
+
+  void flatten(bvh_node const &tree) {
+    bbox = tree.bounding_box();
+    if (tree.is_leaf() && tree.leaf_objects().empty())
+      return; // empty scene, no nodes: hit() returns false right away
+    emit(tree);
+  }
+
+  uint32_t emit(bvh_node const &tree_node) {
+    uint32_t index = uint32_t(nodes.size());
+    nodes.push_back(linear_bvh_node());
+    set_bounds(nodes[index], tree_node.bounding_box());
+
+    if (tree_node.is_leaf()) {
+      auto const &objects = tree_node.leaf_objects();
+      if (objects.size() > 0xffff)
+        throw std::invalid_argument("linear_bvh: leaf too large");
+      nodes[index].offset = uint32_t(primitives.size());
+      nodes[index].primitive_count = uint16_t(objects.size());
+      nodes[index].axis = 0;
+      for (auto const &object : objects) {
+        primitives.push_back(object.get());
+        owners.push_back(object);
+      }
+      return index;
+    }
+
+    emit(tree_node.left_child());
+    uint32_t second = emit(tree_node.right_child());
+    // nodes may have been reallocated, index again
+    nodes[index].offset = second;
+    nodes[index].primitive_count = 0;
+    nodes[index].axis = uint8_t(tree_node.axis());
+    return index;
+  }
+
+  static double node_area(linear_bvh_node const &node) {
+    double lx = node.bounds_max[0] - node.bounds_min[0];
+    double ly = node.bounds_max[1] - node.bounds_min[1];
+    double lz = node.bounds_max[2] - node.bounds_min[2];
+    return 2.0 * (lx * ly + ly * lz + lz * lx);
+  }
+};
+
+#endif // LINEAR_BVH_H
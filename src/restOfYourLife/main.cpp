@@ -1,11 +1,19 @@
+#include "benchmark.h"
 #include "bvh.h"
 #include "camera.h"
+#include "light_tree.h"
+#include "linear_bvh.h"
+#include "sampler.h"
+#include "scene.h"
+#include "scenes.h"
 
 #include <algorithm>
 #include <cassert>
 #include <cctype>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <functional>
 #include <initializer_list>
 #include <iostream>
 #include <memory>
@@ -24,48 +32,362 @@
 #include "texture.h"
 #include "vec3.h"
 
-void cornell_box();
+class render_options {
+public:
+  int thread_count = 0; // 0: let the camera decide (RT_THREADS or all cores)
+  uint64_t seed = 0;
+  int russian_roulette_depth = 5;
+  std::string scene = "cornell";
+  std::string mesh_file; // cornell: stands in for the tall box
+  integrator_kind integrator = integrator_kind::mixture;
+  bool visibility_only = false; // --mode visibility
+  int packet_size = 8;          // camera rays traced together
+  std::string light_sampler; // list or tree, empty: the scene's default
+  sampler_kind sampler = sampler_kind::sobol;
+  int adaptive_max_spp = 0; // 0: every pixel gets the scene's spp
+  double adaptive_error = 0.1;
+  std::string heatmap_file;
+  int samples_per_pixel = 0; // 0: the scene's own
+  int pass_samples = 0;      // 0: not progressive
+  double time_budget = 0.0;  // seconds, 0: none
+  int frames = 1;            // more: an animation, one file per frame
+  double orbit = 0.0;        // degrees the camera turns over the frames
+  std::string preview_file, checkpoint_file, resume_file;
+  std::string output_file;   // empty: stdout
+  std::string output_format; // empty: by output_file's extension, else p3
+  std::string benchmark; // run a micro benchmark instead of rendering
+};
+
+render_options parse_arguments(int argc, char **argv);
+void command_prompt_hint();
+
+void apply_render_options(Camera &camera, render_options const &options);
+void render_frames(Camera &camera, hittable const &world,
+                   hittable const &lights, render_options const &options,
+                   std::function<void(int)> const &animate = nullptr);
+void cornell_box(render_options const &options);
+void simple_light(render_options const &options);
+void many_lights(render_options const &options);
+void forest(render_options const &options);
 
 int main(int argc, char **argv) {
-  cornell_box();
+  render_options options;
+  try {
+    options = parse_arguments(argc, argv);
+  } catch (std::invalid_argument const &err) {
+    std::cerr << err.what() << std::endl;
+    command_prompt_hint();
+    return 1;
+  }
+
+  if (!options.benchmark.empty()) {
+    if (!run_benchmark(options.benchmark,
+                       resolve_thread_count(options.thread_count))) {
+      std::cerr << "unknown benchmark " << options.benchmark << std::endl;
+      command_prompt_hint();
+      return 1;
+    }
+    return 0;
+  }
+
+  try {
+    if (options.scene == "simple_light")
+      simple_light(options);
+    else if (options.scene == "many_lights")
+      many_lights(options);
+    else if (options.scene == "forest")
+      forest(options);
+    else
+      cornell_box(options);
+  } catch (std::runtime_error const &err) { // checkpoint and output files
+    std::cerr << err.what() << std::endl;
+    return 1;
+  }
   return 0;
 }
 
-void cornell_box() {
-  hittable_list world;
-
-  auto red = make_shared<lambertian>(color3(.65, .05, .05));
-  auto white = make_shared<lambertian>(color3(.73, .73, .73));
-  auto green = make_shared<lambertian>(color3(.12, .45, .15));
-  auto light = make_shared<diffuse_light>(color3(15, 15, 15));
-
-  world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0),
-                              vec3(0, 0, 555), green));
-  world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555),
-                              red));
-  world.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0),
-                              vec3(0, 0, -105), light));
-  world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555),
-                              white));
-  world.add(make_shared<quad>(point3(555, 555, 555), vec3(-555, 0, 0),
-                              vec3(0, 0, -555), white));
-  world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0),
-                              vec3(0, 555, 0), white));
-
-  shared_ptr<hittable> box1 =
-      box(point3(0.0, 0.0, 0.0), point3(165, 330, 165), white);
-  box1 = make_shared<rotate_y>(box1, 15);
-  box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-  world.add(box1);
-
-  auto glass = make_shared<dielectric>(1.5);
-  world.add(make_shared<sphere>(point3(190, 90, 190), 90, glass));
-
-  // light sources
-  auto empty_material = shared_ptr<Material>();
+void command_prompt_hint() {
+  std::cerr << "options:" << std::endl;
+  std::cerr << "  --threads N   render with N worker threads (default: "
+               "RT_THREADS or all cores)"
+            << std::endl;
+  std::cerr << "  --seed S      seed of the per-pixel random sequences"
+            << std::endl;
+  std::cerr << "  --rr-depth D  russian roulette from bounce D on (default 5, "
+               "50 or more: off)"
+            << std::endl;
+  std::cerr << "  --scene NAME  cornell (default), simple_light, many_lights "
+               "or forest"
+            << std::endl;
+  std::cerr << "  --mesh FILE   an .obj or .ply model in place of the "
+               "cornell box's tall block"
+            << std::endl;
+  std::cerr << "  --integrator I  mixture (default) or nee (next event "
+               "estimation with mis)"
+            << std::endl;
+  std::cerr << "  --mode M      path (default) or visibility, a quick preview "
+               "shading only what the camera rays hit"
+            << std::endl;
+  std::cerr << "  --packet N    trace camera rays N at a time, up to 16 "
+               "(default 8, 1: one by one)"
+            << std::endl;
+  std::cerr << "  --lights L    sample lights from a list (uniformly) or a "
+               "tree (by importance); default tree for many_lights"
+            << std::endl;
+  std::cerr << "  --sampler S   sobol (default, owen-scrambled), halton, "
+               "stratified or independent"
+            << std::endl;
+  std::cerr << "  --spp N       samples per pixel instead of the scene's"
+            << std::endl;
+  std::cerr << "  --progressive N  render in passes of N spp, saving the "
+               "preview and checkpoint after each"
+            << std::endl;
+  std::cerr << "  --time-budget S  render passes while they fit in S seconds, "
+               "up to --spp"
+            << std::endl;
+  std::cerr << "  --preview FILE  image so far, rewritten after every pass"
+            << std::endl;
+  std::cerr << "  --checkpoint FILE  resumable samples, rewritten after every "
+               "pass"
+            << std::endl;
+  std::cerr << "  --resume FILE  continue a checkpoint with the same settings, "
+               "saving back into it"
+            << std::endl;
+  std::cerr << "  --adaptive N  keep sampling noisy pixels, up to N spp"
+            << std::endl;
+  std::cerr << "  --adaptive-error E  relative error adaptive sampling stops "
+               "at (default 0.1)"
+            << std::endl;
+  std::cerr << "  --heatmap FILE  write the samples per pixel as an image"
+            << std::endl;
+  std::cerr << "  --output FILE  write the image to FILE instead of stdout"
+            << std::endl;
+  std::cerr << "  --format F    p3 (ascii ppm), p6 (binary ppm), pfm (linear "
+               "floats) or raw; default p3, or by --output's extension"
+            << std::endl;
+  std::cerr << "  --frames N    render N frames of the scene's animation "
+               "to --output, numbered"
+            << std::endl;
+  std::cerr << "  --orbit DEG   turn the camera DEG degrees around its target "
+               "over the frames"
+            << std::endl;
+  std::cerr << "  --bench NAME  run a micro benchmark instead of rendering: "
+               "rng, bvh, wide, lbvh, occlusion, alloc, lights, convergence, "
+               "adaptive, boxes, instances, output, mesh, tlas, refit, motion, "
+               "packets"
+            << std::endl;
+}
+
+bool parse_unsigned(std::string const &str, uint64_t &value) {
+  if (str.empty())
+    return false;
+  for (char c : str) {
+    if (!std::isdigit(c))
+      return false;
+  }
+  value = std::stoull(str);
+  return true;
+}
+
+bool parse_decimal(std::string const &str, double &value) {
+  try {
+    size_t used;
+    value = std::stod(str, &used);
+    return used == str.size() && value >= 0.0;
+  } catch (std::logic_error const &) {
+    return false;
+  }
+}
+
+render_options parse_arguments(int argc, char **argv) {
+  render_options options;
+  for (int i = 1; i < argc; i++) {
+    std::string argument = argv[i];
+    if (i + 1 >= argc)
+      throw std::invalid_argument("invalid argument, " + argument +
+                                  " expects a value");
+    std::string value = argv[++i];
+
+    if (argument == "--bench") {
+      options.benchmark = value;
+      continue;
+    }
+    if (argument == "--scene") {
+      if (value != "cornell" && value != "simple_light" &&
+          value != "many_lights" && value != "forest")
+        throw std::invalid_argument("invalid argument, unknown scene " + value);
+      options.scene = value;
+      continue;
+    }
+    if (argument == "--integrator") {
+      if (value == "mixture")
+        options.integrator = integrator_kind::mixture;
+      else if (value == "nee")
+        options.integrator = integrator_kind::nee;
+      else
+        throw std::invalid_argument("invalid argument, unknown integrator " +
+                                    value);
+      continue;
+    }
+
+    if (argument == "--mode") {
+      if (value != "path" && value != "visibility")
+        throw std::invalid_argument("invalid argument, unknown mode " + value);
+      options.visibility_only = value == "visibility";
+      continue;
+    }
+    if (argument == "--sampler") {
+      if (!parse_sampler_kind(value, options.sampler))
+        throw std::invalid_argument("invalid argument, unknown sampler " +
+                                    value);
+      continue;
+    }
+    if (argument == "--format") {
+      image_format format;
+      if (!parse_image_format(value, format))
+        throw std::invalid_argument("invalid argument, unknown format " +
+                                    value);
+      options.output_format = value;
+      continue;
+    }
+    if (argument == "--heatmap" || argument == "--preview" ||
+        argument == "--checkpoint" || argument == "--resume" ||
+        argument == "--output" || argument == "--mesh") {
+      std::string &file = argument == "--heatmap"      ? options.heatmap_file
+                          : argument == "--preview"    ? options.preview_file
+                          : argument == "--checkpoint" ? options.checkpoint_file
+                          : argument == "--resume"     ? options.resume_file
+                          : argument == "--mesh"       ? options.mesh_file
+                                                       : options.output_file;
+      file = value;
+      continue;
+    }
+    if (argument == "--adaptive-error" || argument == "--time-budget" ||
+        argument == "--orbit") {
+      double &number = argument == "--adaptive-error" ? options.adaptive_error
+                       : argument == "--time-budget"  ? options.time_budget
+                                                      : options.orbit;
+      if (!parse_decimal(value, number))
+        throw std::invalid_argument("invalid argument, " + argument +
+                                    " expects a non-negative number");
+      continue;
+    }
+    if (argument == "--lights") {
+      if (value != "list" && value != "tree")
+        throw std::invalid_argument("invalid argument, unknown light sampler " +
+                                    value);
+      options.light_sampler = value;
+      continue;
+    }
+
+    uint64_t number;
+    if (!parse_unsigned(value, number))
+      throw std::invalid_argument("invalid argument, " + argument +
+                                  " expects a non-negative integer");
+
+    if (argument == "--threads")
+      options.thread_count = int(number);
+    else if (argument == "--seed")
+      options.seed = number;
+    else if (argument == "--rr-depth")
+      options.russian_roulette_depth = int(number);
+    else if (argument == "--adaptive")
+      options.adaptive_max_spp = int(number);
+    else if (argument == "--spp")
+      options.samples_per_pixel = int(number);
+    else if (argument == "--progressive")
+      options.pass_samples = int(number);
+    else if (argument == "--frames")
+      options.frames = int(std::max<uint64_t>(1, number));
+    else if (argument == "--packet" && number >= 1 &&
+             number <= uint64_t(ray_packet::max_size))
+      options.packet_size = int(number);
+    else if (argument == "--packet")
+      throw std::invalid_argument("invalid argument, --packet expects 1 to " +
+                                  std::to_string(ray_packet::max_size));
+    else
+      throw std::invalid_argument("invalid argument, unknown option " +
+                                  argument);
+  }
+  if (options.frames > 1 && options.output_file.empty())
+    throw std::invalid_argument("invalid argument, --frames needs --output");
+  if (options.frames > 1 &&
+      !(options.checkpoint_file.empty() && options.resume_file.empty()))
+    throw std::invalid_argument(
+        "invalid argument, --frames can't be combined with checkpoints");
+  return options;
+}
+
+// the command line settings on top of a scene's camera
+void apply_render_options(Camera &camera, render_options const &options) {
+  if (options.samples_per_pixel > 0)
+    camera.sample_per_pixel = options.samples_per_pixel;
+  camera.thread_count = options.thread_count;
+  camera.seed = options.seed;
+  camera.russian_roulette_depth = options.russian_roulette_depth;
+  camera.integrator = options.integrator;
+  camera.visibility_only = options.visibility_only;
+  camera.packet_size = options.packet_size;
+  camera.sampler_type = options.sampler;
+  camera.adaptive_max_spp = options.adaptive_max_spp;
+  camera.adaptive_error = options.adaptive_error;
+  camera.heatmap_file = options.heatmap_file;
+  camera.pass_samples = options.pass_samples;
+  camera.time_budget = options.time_budget;
+  camera.preview_file = options.preview_file;
+  camera.checkpoint_file = options.checkpoint_file;
+  camera.resume_file = options.resume_file;
+  camera.scene_name = options.mesh_file.empty()
+                          ? options.scene
+                          : options.scene + " " + options.mesh_file;
+  camera.output_file = options.output_file;
+  if (!options.output_format.empty())
+    parse_image_format(options.output_format, camera.output_format);
+  else if (!options.output_file.empty())
+    camera.output_format = image_format_for(options.output_file);
+}
+
+// "out.ppm" as "out_0007.ppm"
+std::string frame_file(std::string const &path, int frame) {
+  std::string number = std::to_string(frame);
+  number = std::string(number.size() < 4 ? 4 - number.size() : 0, '0') +
+           number;
+  size_t dot = path.find_last_of('.');
+  size_t slash = path.find_last_of('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    return path + "_" + number;
+  return path.substr(0, dot) + "_" + number + path.substr(dot);
+}
+
+// one image, or options.frames of them with the camera turned around its
+// target by options.orbit degrees over the sequence. animate(frame) moves
+// the scene's objects before each frame of a sequence
+void render_frames(Camera &camera, hittable const &world,
+                   hittable const &lights, render_options const &options,
+                   std::function<void(int)> const &animate) {
+  if (options.frames <= 1) {
+    camera.render(world, lights);
+    return;
+  }
+  point3 target = camera.lookat;
+  vec3 arm = camera.lookfrom - camera.lookat;
+  for (int frame = 0; frame < options.frames; frame++) {
+    if (animate)
+      animate(frame);
+    camera.lookfrom =
+        target + affine_transform::rotation_y(options.orbit * frame /
+                                              options.frames)
+                     .vector(arm);
+    camera.output_file = frame_file(options.output_file, frame);
+    std::clog << "Frame " << frame << ": " << camera.output_file << "\n";
+    camera.render(world, lights);
+  }
+}
+
+void cornell_box(render_options const &options) {
+  scene objects;
   hittable_list lights;
-  lights.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0.0, 0.0),
-                               vec3(0.0, 0.0, -105), empty_material));
+  hittable_list world = cornell_box_world(objects, lights, options.mesh_file);
 
   Camera camera;
 
@@ -82,5 +404,113 @@ void cornell_box() {
 
   camera.defocus_angle = 0;
 
-  camera.render(world, lights);
+  apply_render_options(camera, options);
+
+  if (options.light_sampler == "tree") {
+    light_tree tree(lights);
+    render_frames(camera, world, tree, options);
+  } else {
+    render_frames(camera, world, lights, options);
+  }
+}
+
+void simple_light(render_options const &options) {
+  scene objects;
+  hittable_list lights;
+  hittable_list world = simple_light_world(objects, lights);
+
+  Camera camera;
+
+  camera.aspect_ratio = 16.0 / 9.0;
+  camera.image_width = 400;
+  camera.sample_per_pixel = 100;
+  camera.max_depth = 50;
+  camera.background = color3(0, 0, 0);
+
+  camera.vFov = 20;
+  camera.lookfrom = point3(26, 3, 6);
+  camera.lookat = point3(0, 2, 0);
+  camera.up = vec3(0, 1, 0);
+
+  camera.defocus_angle = 0;
+
+  apply_render_options(camera, options);
+
+  if (options.light_sampler == "tree") {
+    light_tree tree(lights);
+    render_frames(camera, world, tree, options);
+  } else {
+    render_frames(camera, world, lights, options);
+  }
+}
+
+void many_lights(render_options const &options) {
+  scene objects;
+  hittable_list lights;
+  hittable_list world = many_lights_world(objects, lights);
+
+  Camera camera;
+
+  camera.aspect_ratio = 16.0 / 9.0;
+  camera.image_width = 400;
+  camera.sample_per_pixel = 64;
+  camera.max_depth = 50;
+  camera.background = color3(0, 0, 0);
+
+  camera.vFov = 50;
+  camera.lookfrom = point3(0, 8, -70);
+  camera.lookat = point3(0, 2, 0);
+  camera.up = vec3(0, 1, 0);
+
+  camera.defocus_angle = 0;
+
+  apply_render_options(camera, options);
+
+  if (options.light_sampler == "list") {
+    render_frames(camera, world, lights, options);
+  } else {
+    light_tree tree(lights);
+    render_frames(camera, world, tree, options);
+  }
+}
+
+void forest(render_options const &options) {
+  scene objects;
+  hittable_list lights;
+  shared_ptr<tlas> trees = forest_instances(objects, 50000);
+  hittable_list world = forest_world(objects, lights, trees);
+
+  Camera camera;
+
+  camera.aspect_ratio = 16.0 / 9.0;
+  camera.image_width = 400;
+  camera.sample_per_pixel = 64;
+  camera.max_depth = 20;
+  camera.background = color3(0.5, 0.65, 0.9);
+
+  camera.vFov = 40;
+  camera.lookfrom = point3(0, 28, -530);
+  camera.lookat = point3(40, 0, -420);
+  camera.up = vec3(0, 1, 0);
+
+  camera.defocus_angle = 0;
+
+  apply_render_options(camera, options);
+
+  // the trees sway in the wind, 24 frames a second
+  std::vector<affine_transform> rest;
+  for (size_t i = 0; i < trees->instance_count(); i++)
+    rest.push_back(trees->instance(i).object_to_world());
+  int threads = resolve_thread_count(options.thread_count);
+  render_frames(camera, world, lights, options, [&](int frame) {
+    auto start = std::chrono::steady_clock::now();
+    sway_forest(*trees, rest, frame / 24.0);
+    auto update = trees->update(1.5, threads);
+    std::clog << "Moved " << rest.size() << " instances, tlas updated in "
+              << seconds_since(start) * 1e3 << " ms ("
+              << (update.rebuilt_all ? std::string("rebuilt")
+                                     : std::to_string(update.rebuilt_subtrees) +
+                                           " subtrees rebuilt")
+              << ")\n";
+  });
 }
@@ -16,7 +16,7 @@
 class scatter_record {
 public:
   color3 attenuation;
-  std::shared_ptr<pdf> pdf_ptr;
+  pdf direction_pdf; // empty when skip_pdf
   bool skip_pdf;
   Ray skip_pdf_ray;
 };
@@ -56,7 +56,7 @@ public:
                scatter_record &scatter_rec) const override {
     scatter_rec.attenuation =
         tex->value(record.textureCoordinate, record.hitPoint);
-    scatter_rec.pdf_ptr = make_shared<cosine_pdf>(record.normalAgainstRay);
+    scatter_rec.direction_pdf = cosine_pdf(record.normalAgainstRay);
     scatter_rec.skip_pdf = false;
     return true;
   }
@@ -103,7 +103,7 @@ public:
   bool Scatter(const Ray &ray_in, const hit_record &record,
                scatter_record &scatter_rec) const override {
     scatter_rec.attenuation = color3(1.0, 1.0, 1.0);
-    scatter_rec.pdf_ptr = nullptr;
+    scatter_rec.direction_pdf = pdf();
     scatter_rec.skip_pdf = true;
 
     double etaIncidentOverEtaRefract =
@@ -196,7 +196,7 @@ public:
                scatter_record &scatter_rec) const override {
     scatter_rec.attenuation =
         tex->value(record.textureCoordinate, record.hitPoint);
-    scatter_rec.pdf_ptr = make_shared<sphere_pdf>();
+    scatter_rec.direction_pdf = sphere_pdf();
     scatter_rec.skip_pdf = false;
     return true;
   }
@@ -0,0 +1,270 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "index_bvh.h"
+#include "interval.h"
+#include "material.h"
+#include "ray.h"
+#include "vec3.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/*
+vertex and index buffers of a triangle mesh. normals and uvs are optional,
+one per position when present. meshes built from the same data share it.
+*/
+class mesh_data {
+public:
+  std::vector<point3> positions;
+  std::vector<vec3> normals;     // empty: flat shading
+  std::vector<double> uvs;       // u, v per position; empty: barycentrics
+  std::vector<uint32_t> indices; // three per triangle, counter-clockwise
+
+  size_t triangle_count() const { return indices.size() / 3; }
+
+  size_t memory_bytes() const {
+    return positions.size() * sizeof(point3) + normals.size() * sizeof(vec3) +
+           uvs.size() * sizeof(double) + indices.size() * sizeof(uint32_t);
+  }
+
+  // throws if an index is out of range or the optional buffers don't match
+  void validate() const {
+    if (indices.size() % 3 != 0)
+      throw std::runtime_error("mesh: index count is not a multiple of 3");
+    if (!normals.empty() && normals.size() != positions.size())
+      throw std::runtime_error("mesh: one normal per position expected");
+    if (!uvs.empty() && uvs.size() != 2 * positions.size())
+      throw std::runtime_error("mesh: one uv per position expected");
+    for (uint32_t index : indices)
+      if (index >= positions.size())
+        throw std::runtime_error("mesh: vertex index out of range");
+  }
+};
+
+// a surface of revolution around the y axis. profile points are (radius,
+// height) pairs in x and y; a point with radius 0 closes the surface there.
+// u runs around the axis, v along the profile
+shared_ptr<mesh_data> lathe_mesh(std::vector<point3> const &profile,
+                                 int segments) {
+  auto mesh = std::make_shared<mesh_data>();
+  int rows = int(profile.size());
+  for (int row = 0; row < rows; row++) {
+    for (int segment = 0; segment <= segments; segment++) {
+      double phi = 2 * PI * (segment % segments) / segments; // seam exact
+      mesh->positions.push_back(point3(profile[row].x * std::cos(phi),
+                                       profile[row].y,
+                                       profile[row].x * std::sin(phi)));
+      mesh->uvs.push_back(double(segment) / segments);
+      mesh->uvs.push_back(double(row) / std::max(1, rows - 1));
+    }
+  }
+  // the seam column is doubled for the uvs; the last quad of a row uses it
+  auto at = [&](int row, int segment) {
+    return uint32_t(row * (segments + 1) + segment);
+  };
+  for (int row = 0; row + 1 < rows; row++) {
+    for (int segment = 0; segment < segments; segment++) {
+      if (profile[row].x > 0.0)
+        mesh->indices.insert(mesh->indices.end(),
+                             {at(row, segment), at(row + 1, segment),
+                              at(row, segment + 1)});
+      if (profile[row + 1].x > 0.0)
+        mesh->indices.insert(mesh->indices.end(),
+                             {at(row, segment + 1), at(row + 1, segment),
+                              at(row + 1, segment + 1)});
+    }
+  }
+  return mesh;
+}
+
+/*
+a triangle mesh as one hittable: triangles are indices into shared buffers,
+not objects of their own, so a triangle costs its three indices plus its
+share of the mesh's index_bvh over triangle ids. hits use the watertight test
+of Woop, Benthin and Wald (2013), which never lets a ray slip through the
+edge between two triangles. normals and uvs are interpolated for the closest
+hit only, in materialize().
+*/
+class triangle_mesh : public hittable {
+public:
+  triangle_mesh(shared_ptr<mesh_data const> data,
+                shared_ptr<Material> material,
+                bvh_build_options const &options = bvh_build_options())
+      : data(std::move(data)), material(std::move(material)) {
+    this->data->validate();
+    auto start = std::chrono::steady_clock::now();
+    build(options);
+    build_seconds = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+  }
+
+  bool intersect(const Ray &ray, interval ray_range,
+                 hit_info &info) const override {
+    watertight_ray query(ray);
+    return bvh.closest(query, ray_range,
+                       [&](uint32_t triangle, interval &range) {
+                         double t, b1, b2;
+                         if (!hit_triangle(query, triangle, range, t, b1, b2))
+                           return false;
+                         range.max = t;
+                         info.record_hit(this, t, b1, b2, triangle);
+                         return true;
+                       });
+  }
+
+  bool occluded(const Ray &ray, interval ray_range) const override {
+    watertight_ray query(ray);
+    return bvh.any(query, ray_range, [&](uint32_t triangle, interval range) {
+      double t, b1, b2;
+      return hit_triangle(query, triangle, range, t, b1, b2);
+    });
+  }
+
+  // info.u, info.v are the barycentric weights of the second and third
+  // vertex, info.element the triangle
+  void materialize(const Ray &ray, hit_info const &info,
+                   hit_record &record) const override {
+    uint32_t const *corner = &data->indices[3 * size_t(info.element)];
+    double b1 = info.u, b2 = info.v, b0 = 1.0 - b1 - b2;
+    point3 const &p0 = data->positions[corner[0]];
+    point3 const &p1 = data->positions[corner[1]];
+    point3 const &p2 = data->positions[corner[2]];
+
+    record.material = material.get();
+    record.factorOfDirection = info.factorOfDirection;
+    record.hitPoint = ray.at(info.factorOfDirection);
+    record.set_surface_normal(
+        ray, unit_vector(crossProduct(p1 - p0, p2 - p0)));
+
+    // the shading normal is turned to the side the geometric one faces
+    if (!data->normals.empty()) {
+      vec3 shading = unit_vector(b0 * data->normals[corner[0]] +
+                                 b1 * data->normals[corner[1]] +
+                                 b2 * data->normals[corner[2]]);
+      if (dotProduct(shading, record.normalAgainstRay) < 0.0)
+        shading = -shading;
+      record.normalAgainstRay = shading;
+    }
+
+    if (data->uvs.empty()) {
+      record.textureCoordinate = texture_coordinate(b1, b2);
+    } else {
+      double const *uv = data->uvs.data();
+      record.textureCoordinate = texture_coordinate(
+          b0 * uv[2 * corner[0]] + b1 * uv[2 * corner[1]] +
+              b2 * uv[2 * corner[2]],
+          b0 * uv[2 * corner[0] + 1] + b1 * uv[2 * corner[1] + 1] +
+              b2 * uv[2 * corner[2] + 1]);
+    }
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  size_t triangle_count() const { return data->triangle_count(); }
+  mesh_data const &get_data() const { return *data; }
+  size_t node_count() const { return bvh.node_count(); }
+  double build_time() const { return build_seconds; }
+
+  // the bvh this mesh adds to its shared data
+  size_t memory_bytes() const { return bvh.memory_bytes(); }
+
+private:
+  shared_ptr<mesh_data const> data;
+  shared_ptr<Material> material;
+  index_bvh bvh; // over triangle ids
+  aabb bbox;
+  double build_seconds = 0.0;
+
+  // the ray as the watertight test wants it: sheared so it runs along +z of
+  // a permuted frame, with kz the largest direction component
+  class watertight_ray : public bvh_ray {
+  public:
+    int kx, ky, kz;
+    double shear_x, shear_y, shear_z;
+
+    watertight_ray(Ray const &ray) : bvh_ray(ray) {
+      vec3 const &direction = ray.getDirection();
+      kz = std::fabs(direction.x) > std::fabs(direction.y)
+               ? (std::fabs(direction.x) > std::fabs(direction.z) ? 0 : 2)
+               : (std::fabs(direction.y) > std::fabs(direction.z) ? 1 : 2);
+      kx = (kz + 1) % 3;
+      ky = (kx + 1) % 3;
+      if (direction[kz] < 0.0) // keeps the winding of the triangles
+        std::swap(kx, ky);
+      shear_x = direction[kx] / direction[kz];
+      shear_y = direction[ky] / direction[kz];
+      shear_z = 1.0 / direction[kz];
+    }
+  };
+
+  bool hit_triangle(watertight_ray const &ray, uint32_t triangle,
+                    interval ray_range, double &t, double &b1,
+                    double &b2) const {
+    uint32_t const *corner = &data->indices[3 * size_t(triangle)];
+    point3 const &p0 = data->positions[corner[0]];
+    point3 const &p1 = data->positions[corner[1]];
+    point3 const &p2 = data->positions[corner[2]];
+
+    // vertices relative to the origin, sheared into the ray's frame
+    double a[3] = {p0.x - ray.origin[0], p0.y - ray.origin[1],
+                   p0.z - ray.origin[2]};
+    double b[3] = {p1.x - ray.origin[0], p1.y - ray.origin[1],
+                   p1.z - ray.origin[2]};
+    double c[3] = {p2.x - ray.origin[0], p2.y - ray.origin[1],
+                   p2.z - ray.origin[2]};
+    double ax = a[ray.kx] - ray.shear_x * a[ray.kz];
+    double ay = a[ray.ky] - ray.shear_y * a[ray.kz];
+    double bx = b[ray.kx] - ray.shear_x * b[ray.kz];
+    double by = b[ray.ky] - ray.shear_y * b[ray.kz];
+    double cx = c[ray.kx] - ray.shear_x * c[ray.kz];
+    double cy = c[ray.ky] - ray.shear_y * c[ray.kz];
+
+    // scaled barycentrics: edge functions of the projected triangle
+    double u = cx * by - cy * bx;
+    double v = ax * cy - ay * cx;
+    double w = bx * ay - by * ax;
+    if ((u < 0.0 || v < 0.0 || w < 0.0) && (u > 0.0 || v > 0.0 || w > 0.0))
+      return false;
+    double determinant = u + v + w;
+    if (determinant == 0.0)
+      return false;
+
+    double scaled_t = u * ray.shear_z * a[ray.kz] +
+                      v * ray.shear_z * b[ray.kz] + w * ray.shear_z * c[ray.kz];
+    t = scaled_t / determinant;
+    if (!ray_range.contain(t))
+      return false;
+    b1 = v / determinant;
+    b2 = w / determinant;
+    return true;
+  }
+
+  void build(bvh_build_options const &options) {
+    size_t count = data->triangle_count();
+    if (count > 0xffffffffu / 2)
+      throw std::runtime_error("triangle_mesh: too many triangles");
+
+    std::vector<index_bvh_item> items(count);
+    for (size_t i = 0; i < count; i++) {
+      uint32_t const *corner = &data->indices[3 * i];
+      aabb box(data->positions[corner[0]], data->positions[corner[1]]);
+      box = aabb(box, aabb(data->positions[corner[2]],
+                           data->positions[corner[2]]));
+      items[i] = index_bvh_item(box, uint32_t(i));
+    }
+    bvh.build(items, options);
+    bbox = bvh.bounds();
+  }
+};
+
+#endif // MESH_H
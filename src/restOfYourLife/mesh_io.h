@@ -0,0 +1,464 @@
+#ifndef MESH_IO_H
+#define MESH_IO_H
+
+#include "mesh.h"
+#include "vec3.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+mesh files in and out. read_obj takes v, vt, vn and f lines (polygons are
+split into fans, negative indices count from the end); a vertex of the mesh
+is each distinct v/vt/vn combination. read_ply takes ascii and binary ply of
+either byte order with x y z, optional nx ny nz and u v (or s t), and faces
+as vertex_indices lists. everything else in the files is skipped. errors
+throw std::runtime_error.
+*/
+
+shared_ptr<mesh_data> read_obj(std::istream &in) {
+  std::vector<point3> positions;
+  std::vector<vec3> normals;
+  std::vector<double> uvs;
+  auto mesh = std::make_shared<mesh_data>();
+  bool all_normals = true, all_uvs = true;
+
+  class corner_key {
+  public:
+    long position, uv, normal;
+    bool operator==(corner_key const &other) const {
+      return position == other.position && uv == other.uv &&
+             normal == other.normal;
+    }
+  };
+  class corner_hash {
+  public:
+    size_t operator()(corner_key const &key) const {
+      return std::hash<long>()(key.position * 73856093L ^ key.uv * 19349663L ^
+                               key.normal * 83492791L);
+    }
+  };
+  std::unordered_map<corner_key, uint32_t, corner_hash> vertices;
+  std::vector<corner_key> corners; // in mesh vertex order
+
+  // 1-based, negative from the end; 0 when absent
+  auto resolve = [](long index, size_t count, size_t line_number) -> long {
+    long resolved = index < 0 ? long(count) + index + 1 : index;
+    if (resolved < 1 || resolved > long(count))
+      throw std::runtime_error("obj: index out of range on line " +
+                               std::to_string(line_number));
+    return resolved;
+  };
+
+  std::string line;
+  std::vector<uint32_t> polygon;
+  size_t line_number = 0;
+  while (std::getline(in, line)) {
+    line_number++;
+    char const *c = line.c_str();
+    while (*c == ' ' || *c == '\t')
+      c++;
+    char *end;
+    if (c[0] == 'v' && (c[1] == ' ' || c[1] == '\t')) {
+      double x = std::strtod(c + 1, &end);
+      double y = std::strtod(end, &end);
+      double z = std::strtod(end, &end);
+      positions.push_back(point3(x, y, z));
+    } else if (c[0] == 'v' && c[1] == 't') {
+      double u = std::strtod(c + 2, &end);
+      double v = std::strtod(end, &end);
+      uvs.push_back(u);
+      uvs.push_back(v);
+    } else if (c[0] == 'v' && c[1] == 'n') {
+      double x = std::strtod(c + 2, &end);
+      double y = std::strtod(end, &end);
+      double z = std::strtod(end, &end);
+      normals.push_back(vec3(x, y, z));
+    } else if (c[0] == 'f' && (c[1] == ' ' || c[1] == '\t')) {
+      polygon.clear();
+      c++;
+      while (true) {
+        long position = std::strtol(c, &end, 10);
+        if (end == c)
+          break;
+        corner_key key = {resolve(position, positions.size(), line_number), 0,
+                          0};
+        c = end;
+        if (*c == '/') {
+          c++;
+          if (*c != '/') {
+            key.uv = resolve(std::strtol(c, &end, 10), uvs.size() / 2,
+                             line_number);
+            c = end;
+          }
+          if (*c == '/') {
+            c++;
+            key.normal = resolve(std::strtol(c, &end, 10), normals.size(),
+                                 line_number);
+            c = end;
+          }
+        }
+        all_uvs &= key.uv != 0;
+        all_normals &= key.normal != 0;
+
+        auto found = vertices.find(key);
+        if (found == vertices.end()) {
+          found = vertices.emplace(key, uint32_t(corners.size())).first;
+          corners.push_back(key);
+        }
+        polygon.push_back(found->second);
+      }
+      if (polygon.size() < 3)
+        throw std::runtime_error("obj: face with fewer than 3 vertices on "
+                                 "line " +
+                                 std::to_string(line_number));
+      for (size_t i = 1; i + 1 < polygon.size(); i++) {
+        mesh->indices.push_back(polygon[0]);
+        mesh->indices.push_back(polygon[i]);
+        mesh->indices.push_back(polygon[i + 1]);
+      }
+    }
+  }
+  if (in.bad())
+    throw std::runtime_error("obj: read error");
+
+  // attributes only some corners have are dropped
+  mesh->positions.reserve(corners.size());
+  for (auto const &key : corners)
+    mesh->positions.push_back(positions[key.position - 1]);
+  if (all_normals && !corners.empty()) {
+    mesh->normals.reserve(corners.size());
+    for (auto const &key : corners)
+      mesh->normals.push_back(normals[key.normal - 1]);
+  }
+  if (all_uvs && !corners.empty()) {
+    mesh->uvs.reserve(2 * corners.size());
+    for (auto const &key : corners) {
+      mesh->uvs.push_back(uvs[2 * (key.uv - 1)]);
+      mesh->uvs.push_back(uvs[2 * (key.uv - 1) + 1]);
+    }
+  }
+  mesh->validate();
+  return mesh;
+}
+
+// one scalar type of the ply header
+class ply_type {
+public:
+  enum kind { int8, uint8, int16, uint16, int32, uint32, float32, float64 };
+  kind type = float32;
+
+  static bool parse(std::string const &name, ply_type &result) {
+    static char const *const names[][2] = {
+        {"char", "int8"},   {"uchar", "uint8"},   {"short", "int16"},
+        {"ushort", "uint16"}, {"int", "int32"},   {"uint", "uint32"},
+        {"float", "float32"}, {"double", "float64"}};
+    for (int k = 0; k < 8; k++) {
+      if (name == names[k][0] || name == names[k][1]) {
+        result.type = kind(k);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  int size() const {
+    static int const sizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+    return sizes[type];
+  }
+};
+
+class ply_property {
+public:
+  std::string name;
+  ply_type type;
+  bool is_list = false;
+  ply_type count_type; // of lists
+};
+
+class ply_element {
+public:
+  std::string name;
+  size_t count = 0;
+  std::vector<ply_property> properties;
+};
+
+// reads the scalars of a ply body, ascii or binary of either byte order
+class ply_reader {
+public:
+  enum format { ascii, little_endian, big_endian };
+
+  ply_reader(std::istream &in, format body_format)
+      : in(in), body_format(body_format) {}
+
+  double read(ply_type type) {
+    if (body_format == ascii) {
+      double value;
+      if (!(in >> value))
+        throw std::runtime_error("ply: truncated ascii body");
+      return value;
+    }
+    unsigned char bytes[8];
+    int size = type.size();
+    if (!in.read(reinterpret_cast<char *>(bytes), size))
+      throw std::runtime_error("ply: truncated binary body");
+    if ((body_format == big_endian) != host_is_big_endian())
+      for (int i = 0; i < size / 2; i++)
+        std::swap(bytes[i], bytes[size - 1 - i]);
+    switch (type.type) {
+    case ply_type::int8:
+      return double(int8_t(bytes[0]));
+    case ply_type::uint8:
+      return double(bytes[0]);
+    case ply_type::int16:
+      return double(as<int16_t>(bytes));
+    case ply_type::uint16:
+      return double(as<uint16_t>(bytes));
+    case ply_type::int32:
+      return double(as<int32_t>(bytes));
+    case ply_type::uint32:
+      return double(as<uint32_t>(bytes));
+    case ply_type::float32:
+      return double(as<float>(bytes));
+    default:
+      return as<double>(bytes);
+    }
+  }
+
+private:
+  std::istream &in;
+  format body_format;
+
+  template <typename T> static T as(unsigned char const *bytes) {
+    T value;
+    std::memcpy(&value, bytes, sizeof(T));
+    return value;
+  }
+
+  static bool host_is_big_endian() {
+    uint16_t probe = 1;
+    unsigned char first;
+    std::memcpy(&first, &probe, 1);
+    return first == 0;
+  }
+};
+
+shared_ptr<mesh_data> read_ply(std::istream &in) {
+  std::string line;
+  if (!std::getline(in, line) || line.compare(0, 3, "ply") != 0)
+    throw std::runtime_error("ply: missing magic number");
+
+  ply_reader::format body_format = ply_reader::ascii;
+  std::vector<ply_element> elements;
+  while (true) {
+    if (!std::getline(in, line))
+      throw std::runtime_error("ply: header without end_header");
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    std::istringstream words(line);
+    std::string keyword;
+    words >> keyword;
+    if (keyword == "end_header")
+      break;
+    if (keyword == "format") {
+      std::string name;
+      words >> name;
+      if (name == "ascii")
+        body_format = ply_reader::ascii;
+      else if (name == "binary_little_endian")
+        body_format = ply_reader::little_endian;
+      else if (name == "binary_big_endian")
+        body_format = ply_reader::big_endian;
+      else
+        throw std::runtime_error("ply: unknown format " + name);
+    } else if (keyword == "element") {
+      ply_element element;
+      words >> element.name >> element.count;
+      elements.push_back(element);
+    } else if (keyword == "property") {
+      if (elements.empty())
+        throw std::runtime_error("ply: property before any element");
+      ply_property property;
+      std::string type;
+      words >> type;
+      if (type == "list") {
+        std::string count_type, item_type;
+        words >> count_type >> item_type;
+        property.is_list = true;
+        if (!ply_type::parse(count_type, property.count_type))
+          throw std::runtime_error("ply: unknown type " + count_type);
+        type = item_type;
+      }
+      if (!ply_type::parse(type, property.type))
+        throw std::runtime_error("ply: unknown type " + type);
+      words >> property.name;
+      elements.back().properties.push_back(property);
+    }
+    // comment, obj_info and anything else: skipped
+  }
+
+  auto mesh = std::make_shared<mesh_data>();
+  ply_reader reader(in, body_format);
+  std::vector<double> values;
+  std::vector<uint32_t> polygon;
+  for (auto const &element : elements) {
+    bool is_vertex = element.name == "vertex", is_face = element.name == "face";
+    // where each property goes: x y z nx ny nz u v, or -1
+    std::vector<int> slot(element.properties.size(), -1);
+    bool has_normal = false, has_uv = false;
+    int face_list = -1;
+    for (size_t p = 0; p < element.properties.size(); p++) {
+      std::string const &name = element.properties[p].name;
+      static char const *const names[][3] = {
+          {"x", "", ""},   {"y", "", ""},   {"z", "", ""},
+          {"nx", "", ""},  {"ny", "", ""},  {"nz", "", ""},
+          {"u", "s", "texture_u"}, {"v", "t", "texture_v"}};
+      for (int k = 0; is_vertex && k < 8; k++)
+        if (name == names[k][0] || name == names[k][1] || name == names[k][2])
+          slot[p] = k;
+      has_normal |= slot[p] >= 3 && slot[p] <= 5;
+      has_uv |= slot[p] >= 6;
+      if (is_face && element.properties[p].is_list &&
+          (name == "vertex_indices" || name == "vertex_index"))
+        face_list = int(p);
+    }
+
+    if (is_vertex) {
+      mesh->positions.reserve(element.count);
+      if (has_normal)
+        mesh->normals.reserve(element.count);
+      if (has_uv)
+        mesh->uvs.reserve(2 * element.count);
+    }
+    for (size_t item = 0; item < element.count; item++) {
+      double vertex[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+      for (size_t p = 0; p < element.properties.size(); p++) {
+        ply_property const &property = element.properties[p];
+        if (!property.is_list) {
+          double value = reader.read(property.type);
+          if (slot[p] >= 0)
+            vertex[slot[p]] = value;
+          continue;
+        }
+        size_t length = size_t(reader.read(property.count_type));
+        polygon.clear();
+        for (size_t i = 0; i < length; i++)
+          polygon.push_back(uint32_t(reader.read(property.type)));
+        if (int(p) != face_list)
+          continue;
+        if (polygon.size() < 3)
+          throw std::runtime_error("ply: face with fewer than 3 vertices");
+        for (size_t i = 1; i + 1 < polygon.size(); i++) {
+          mesh->indices.push_back(polygon[0]);
+          mesh->indices.push_back(polygon[i]);
+          mesh->indices.push_back(polygon[i + 1]);
+        }
+      }
+      if (is_vertex) {
+        mesh->positions.push_back(point3(vertex[0], vertex[1], vertex[2]));
+        if (has_normal)
+          mesh->normals.push_back(vec3(vertex[3], vertex[4], vertex[5]));
+        if (has_uv) {
+          mesh->uvs.push_back(vertex[6]);
+          mesh->uvs.push_back(vertex[7]);
+        }
+      }
+    }
+  }
+  mesh->validate();
+  return mesh;
+}
+
+// by extension, .obj or .ply
+shared_ptr<mesh_data> load_mesh(std::string const &path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    throw std::runtime_error("could not open " + path);
+  auto ends_with = [&](char const *suffix) {
+    size_t length = std::strlen(suffix);
+    return path.size() >= length &&
+           path.compare(path.size() - length, length, suffix) == 0;
+  };
+  try {
+    if (ends_with(".obj") || ends_with(".OBJ"))
+      return read_obj(in);
+    if (ends_with(".ply") || ends_with(".PLY"))
+      return read_ply(in);
+  } catch (std::runtime_error const &err) {
+    throw std::runtime_error(path + ": " + err.what());
+  }
+  throw std::runtime_error(path + ": not an .obj or .ply file");
+}
+
+void write_obj(std::ostream &out, mesh_data const &mesh) {
+  out.precision(9);
+  for (auto const &p : mesh.positions)
+    out << "v " << p.x << " " << p.y << " " << p.z << "\n";
+  for (size_t i = 0; i < mesh.uvs.size(); i += 2)
+    out << "vt " << mesh.uvs[i] << " " << mesh.uvs[i + 1] << "\n";
+  for (auto const &n : mesh.normals)
+    out << "vn " << n.x << " " << n.y << " " << n.z << "\n";
+  bool uvs = !mesh.uvs.empty(), normals = !mesh.normals.empty();
+  for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+    out << "f";
+    for (int k = 0; k < 3; k++) {
+      uint32_t index = mesh.indices[i + k] + 1;
+      out << " " << index;
+      if (uvs || normals)
+        out << "/";
+      if (uvs)
+        out << index;
+      if (normals)
+        out << "/" << index;
+    }
+    out << "\n";
+  }
+}
+
+// binary little endian, float vertex attributes
+void write_ply(std::ostream &out, mesh_data const &mesh) {
+  bool uvs = !mesh.uvs.empty(), normals = !mesh.normals.empty();
+  out << "ply\nformat binary_little_endian 1.0\nelement vertex "
+      << mesh.positions.size()
+      << "\nproperty float x\nproperty float y\nproperty float z\n";
+  if (normals)
+    out << "property float nx\nproperty float ny\nproperty float nz\n";
+  if (uvs)
+    out << "property float u\nproperty float v\n";
+  out << "element face " << mesh.triangle_count()
+      << "\nproperty list uchar uint vertex_indices\nend_header\n";
+
+  // the byte layout is the host's, which the header declares little endian
+  std::vector<float> vertex;
+  std::vector<char> body;
+  for (size_t i = 0; i < mesh.positions.size(); i++) {
+    vertex.assign({float(mesh.positions[i].x), float(mesh.positions[i].y),
+                   float(mesh.positions[i].z)});
+    if (normals)
+      vertex.insert(vertex.end(), {float(mesh.normals[i].x),
+                                   float(mesh.normals[i].y),
+                                   float(mesh.normals[i].z)});
+    if (uvs)
+      vertex.insert(vertex.end(),
+                    {float(mesh.uvs[2 * i]), float(mesh.uvs[2 * i + 1])});
+    char const *bytes = reinterpret_cast<char const *>(vertex.data());
+    body.insert(body.end(), bytes, bytes + vertex.size() * sizeof(float));
+  }
+  for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+    body.push_back(char(3));
+    char const *bytes = reinterpret_cast<char const *>(&mesh.indices[i]);
+    body.insert(body.end(), bytes, bytes + 3 * sizeof(uint32_t));
+  }
+  out.write(body.data(), std::streamsize(body.size()));
+}
+
+#endif // MESH_IO_H
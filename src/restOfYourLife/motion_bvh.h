@@ -0,0 +1,287 @@
+#ifndef MOTION_BVH_H
+#define MOTION_BVH_H
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "index_bvh.h"
+#include "interval.h"
+#include "linear_bvh.h"
+#include "ray.h"
+#include "vec3.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+/*
+one node of a motion_bvh: its bounds when the shutter opens and when it
+closes. a ray is tested against the box in between at the ray's time, which
+for things moving in straight lines is as tight as they are at that time.
+nodes over nothing that moves skip the interpolation. laid out like
+linear_bvh_node, 56 bytes.
+*/
+class motion_bvh_node {
+public:
+  float open_min[3], open_max[3];
+  float close_min[3], close_max[3];
+  uint32_t offset;
+  uint16_t primitive_count; // 0 for interior nodes
+  uint8_t axis;
+  uint8_t moving; // 0 if the bounds at both ends are the same
+
+  bool is_leaf() const { return primitive_count > 0; }
+
+  // time in [0, 1]
+  bool hit(double const origin[3], double const inverse_direction[3],
+           double time, interval ray_range) const {
+    for (int ith_axis = 0; ith_axis < 3; ith_axis++) {
+      double low = open_min[ith_axis], high = open_max[ith_axis];
+      if (moving) {
+        low += time * (double(close_min[ith_axis]) - low);
+        high += time * (double(close_max[ith_axis]) - high);
+      }
+      double inverse = inverse_direction[ith_axis];
+      double root1 = (low - origin[ith_axis]) * inverse;
+      double root2 = (high - origin[ith_axis]) * inverse;
+      double t0 = root1 < root2 ? root1 : root2;
+      double t1 = root1 < root2 ? root2 : root1;
+
+      ray_range.min = t0 > ray_range.min ? t0 : ray_range.min;
+      ray_range.max = t1 < ray_range.max ? t1 : ray_range.max;
+
+      if (ray_range.min > ray_range.max)
+        return false;
+    }
+    return true;
+  }
+};
+
+static_assert(sizeof(motion_bvh_node) == 56,
+              "motion_bvh_node must stay 56 bytes");
+
+/*
+a bvh for scenes with motion blur. linear_bvh bounds a moving object by its
+box over the whole shutter, so every ray, whatever its time, tests the whole
+swept volume. here each node keeps its bounds at both ends of the shutter
+(from hittable::motion_bounds) and the ray's time picks the box in between.
+the tree is built by sah over the objects' boxes halfway through the shutter,
+the same as an index_bvh; rays with a time outside [0, 1] see the bounds at
+the nearer end.
+
+with interpolate false both ends hold the box over the whole shutter, which
+is what a static bvh tests: the same traversal then shows what the motion
+bounds save (node_visits).
+*/
+class motion_bvh : public hittable {
+public:
+  static int const max_depth = index_bvh::max_depth;
+
+  motion_bvh(hittable_list const &list,
+             bvh_build_options const &options = bvh_build_options(),
+             bool interpolate = true)
+      : owners(list.objects) {
+    size_t count = owners.size();
+    if (count > 0xffffffffu / 2)
+      throw std::invalid_argument("motion_bvh: too many objects");
+
+    std::vector<aabb> open(count), close(count);
+    std::vector<index_bvh_item> items(count);
+    for (size_t i = 0; i < count; i++) {
+      owners[i]->motion_bounds(open[i], close[i]);
+      if (!interpolate)
+        open[i] = close[i] = aabb(open[i], close[i]);
+      items[i] = index_bvh_item(midway(open[i], close[i]), uint32_t(i));
+    }
+    index_bvh tree;
+    tree.build(items, options);
+
+    for (uint32_t id : tree.leaf_order())
+      primitives.push_back(owners[id].get());
+
+    // the same nodes with bounds at both ends, children come after parents
+    auto const &tree_nodes = tree.tree_nodes();
+    auto const &order = tree.leaf_order();
+    nodes.resize(tree_nodes.size());
+    std::vector<aabb> node_open(nodes.size()), node_close(nodes.size());
+    for (size_t i = nodes.size(); i-- > 0;) {
+      linear_bvh_node const &from = tree_nodes[i];
+      aabb at_open = aabb::Empty_bbox, at_close = aabb::Empty_bbox;
+      if (from.is_leaf()) {
+        for (uint32_t k = 0; k < from.primitive_count; k++) {
+          uint32_t id = order[from.offset + k];
+          at_open = aabb(at_open, open[id]);
+          at_close = aabb(at_close, close[id]);
+        }
+      } else {
+        at_open = aabb(node_open[i + 1], node_open[from.offset]);
+        at_close = aabb(node_close[i + 1], node_close[from.offset]);
+      }
+      node_open[i] = at_open;
+      node_close[i] = at_close;
+
+      motion_bvh_node &node = nodes[i];
+      set_bounds(node.open_min, node.open_max, at_open);
+      set_bounds(node.close_min, node.close_max, at_close);
+      node.offset = from.offset;
+      node.primitive_count = from.primitive_count;
+      node.axis = from.axis;
+      node.moving = !std::equal(node.open_min, node.open_min + 3,
+                                node.close_min) ||
+                    !std::equal(node.open_max, node.open_max + 3,
+                                node.close_max);
+    }
+
+    if (!nodes.empty()) {
+      bounds_at_open = node_open[0];
+      bounds_at_close = node_close[0];
+      bbox = aabb(bounds_at_open, bounds_at_close);
+    }
+  }
+
+  bool intersect(const Ray &ray, interval ray_range,
+                 hit_info &info) const override {
+    return closest(ray, ray_range, info, nullptr);
+  }
+
+  bool occluded(const Ray &ray, interval ray_range) const override {
+    if (nodes.empty())
+      return false;
+    double origin[3], inverse_direction[3];
+    for (int ith_axis = 0; ith_axis < 3; ith_axis++) {
+      origin[ith_axis] = ray.getOrigin()[ith_axis];
+      inverse_direction[ith_axis] = 1.0 / ray.getDirection()[ith_axis];
+    }
+    double time = shutter_time(ray);
+
+    uint32_t stack[max_depth];
+    int stack_size = 0;
+    uint32_t current = 0;
+    while (true) {
+      motion_bvh_node const &node = nodes[current];
+      if (node.hit(origin, inverse_direction, time, ray_range)) {
+        if (node.is_leaf()) {
+          for (uint32_t i = 0; i < node.primitive_count; i++)
+            if (primitives[node.offset + i]->occluded(ray, ray_range))
+              return true;
+        } else {
+          stack[stack_size++] = node.offset;
+          current = current + 1;
+          continue;
+        }
+      }
+      if (stack_size == 0)
+        return false;
+      current = stack[--stack_size];
+    }
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  bool random_intersections() const override {
+    return any_random_intersections(owners);
+  }
+
+  int instance_depth() const override { return deepest_instance(owners); }
+
+  // nested in another motion_bvh, this one interpolates too
+  void motion_bounds(aabb &at_open, aabb &at_close) const override {
+    at_open = bounds_at_open;
+    at_close = bounds_at_close;
+  }
+
+  // how many node boxes a closest-hit query tests
+  size_t node_visits(const Ray &ray, interval ray_range) const {
+    hit_info info;
+    size_t visits = 0;
+    closest(ray, ray_range, info, &visits);
+    return visits;
+  }
+
+  size_t node_count() const { return nodes.size(); }
+
+  size_t memory_bytes() const {
+    return nodes.size() * sizeof(motion_bvh_node) +
+           primitives.size() * sizeof(hittable const *);
+  }
+
+private:
+  std::vector<motion_bvh_node> nodes;
+  std::vector<hittable const *> primitives; // in leaf order
+  std::vector<shared_ptr<hittable>> owners;
+  aabb bounds_at_open = aabb::Empty_bbox, bounds_at_close = aabb::Empty_bbox;
+  aabb bbox = aabb::Empty_bbox;
+
+  static double shutter_time(const Ray &ray) {
+    return std::min(1.0, std::max(0.0, ray.getTime()));
+  }
+
+  static aabb midway(aabb const &a, aabb const &b) {
+    return aabb(interval(0.5 * (a.x_interval.min + b.x_interval.min),
+                         0.5 * (a.x_interval.max + b.x_interval.max)),
+                interval(0.5 * (a.y_interval.min + b.y_interval.min),
+                         0.5 * (a.y_interval.max + b.y_interval.max)),
+                interval(0.5 * (a.z_interval.min + b.z_interval.min),
+                         0.5 * (a.z_interval.max + b.z_interval.max)));
+  }
+
+  // rounded outwards, as linear_bvh::set_bounds
+  static void set_bounds(float low[3], float high[3], aabb const &box) {
+    linear_bvh_node rounded;
+    linear_bvh::set_bounds(rounded, box);
+    std::copy(rounded.bounds_min, rounded.bounds_min + 3, low);
+    std::copy(rounded.bounds_max, rounded.bounds_max + 3, high);
+  }
+
+  // counts the nodes tested into visits unless it is null
+  bool closest(const Ray &ray, interval ray_range, hit_info &info,
+               size_t *visits) const {
+    if (nodes.empty())
+      return false;
+    double origin[3], inverse_direction[3];
+    bool direction_is_negative[3];
+    for (int ith_axis = 0; ith_axis < 3; ith_axis++) {
+      origin[ith_axis] = ray.getOrigin()[ith_axis];
+      inverse_direction[ith_axis] = 1.0 / ray.getDirection()[ith_axis];
+      direction_is_negative[ith_axis] = inverse_direction[ith_axis] < 0.0;
+    }
+    double time = shutter_time(ray);
+
+    uint32_t stack[max_depth];
+    int stack_size = 0;
+    uint32_t current = 0;
+    bool hit_anything = false;
+    while (true) {
+      motion_bvh_node const &node = nodes[current];
+      if (visits)
+        ++*visits;
+      if (node.hit(origin, inverse_direction, time, ray_range)) {
+        if (node.is_leaf()) {
+          for (uint32_t i = 0; i < node.primitive_count; i++) {
+            if (primitives[node.offset + i]->intersect(ray, ray_range, info)) {
+              hit_anything = true;
+              ray_range.max = info.factorOfDirection;
+            }
+          }
+        } else {
+          if (direction_is_negative[node.axis]) {
+            stack[stack_size++] = current + 1;
+            current = node.offset;
+          } else {
+            stack[stack_size++] = node.offset;
+            current = current + 1;
+          }
+          continue;
+        }
+      }
+      if (stack_size == 0)
+        break;
+      current = stack[--stack_size];
+    }
+    return hit_anything;
+  }
+};
+
+#endif // MOTION_BVH_H
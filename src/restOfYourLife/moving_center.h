@@ -19,6 +19,7 @@ public:
   }
 
   point3 at(double time) const { return origin + time * displacement; }
+  vec3 const &get_displacement() const { return displacement; }
 
 private:
   vec3 displacement;
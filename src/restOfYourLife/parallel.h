@@ -0,0 +1,35 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// splits [0, count) into one contiguous chunk per thread and runs
+// body(begin, end) on each; the calling thread takes the first chunk
+void parallel_for(size_t count, int thread_count,
+                  std::function<void(size_t, size_t)> const &body) {
+  size_t chunks = std::max<size_t>(
+      1, std::min<size_t>(size_t(std::max(1, thread_count)), count));
+  if (chunks == 1) {
+    if (count > 0)
+      body(0, count);
+    return;
+  }
+
+  size_t chunk_size = (count + chunks - 1) / chunks;
+  std::vector<std::thread> workers;
+  for (size_t chunk = 1; chunk < chunks; chunk++) {
+    size_t begin = chunk * chunk_size;
+    size_t end = std::min(count, begin + chunk_size);
+    if (begin < end)
+      workers.push_back(std::thread(body, begin, end));
+  }
+  body(0, std::min(count, chunk_size));
+  for (auto &worker : workers)
+    worker.join();
+}
+
+#endif // PARALLEL_H
@@ -6,79 +6,113 @@
 #include "orthonormalbasis.h"
 #include "vec3.h"
 #include <cmath>
-#include <memory>
 
-class pdf {
-public:
-  pdf() {}
-  virtual double value(vec3 const &direction) const = 0;
-  virtual vec3 generate() const = 0;
-
-private:
-};
+/*
+pdfs are small values built on the stack for every bounce, never on the heap.
+the concrete pdfs below are plain classes; `pdf` holds any one of them in a
+tagged union, and mixture_pdf keeps its two components inline.
+*/
 
-class sphere_pdf : public pdf {
+class sphere_pdf {
 public:
-  sphere_pdf();
-  double value(vec3 const &direction) const override { return 1 / (4 * PI); }
-  vec3 generate() const override {
-    return generate_random_diffused_unitVector();
-  }
-
-private:
+  sphere_pdf() {}
+  double value(vec3 const &direction) const { return 1 / (4 * PI); }
+  vec3 generate() const { return generate_random_diffused_unitVector(); }
 };
 
-class cosine_pdf : public pdf {
+class cosine_pdf {
 public:
   cosine_pdf(vec3 const &w) : uvw(w) {}
 
-  double value(vec3 const &direction) const override {
+  double value(vec3 const &direction) const {
     auto cosine_theta = dotProduct(unit_vector(direction), uvw.getw());
     return cosine_theta > 0.0 ? cosine_theta / PI : 0.0;
   }
 
-  vec3 generate() const override {
-    return uvw.transform(random_cosine_direction());
-  }
+  vec3 generate() const { return uvw.transform(random_cosine_direction()); }
 
 private:
   onb uvw;
 };
 
-class hittable_pdf : public pdf {
+class hittable_pdf {
 public:
   hittable_pdf(hittable const &objects, point3 const &origin)
-      : objects(objects), origin(origin) {}
+      : objects(&objects), origin(origin) {}
 
-  double value(vec3 const &direction) const override {
-    return objects.pdf_value(origin, direction);
+  double value(vec3 const &direction) const {
+    return objects->pdf_value(origin, direction);
   }
 
-  vec3 generate() const override { return objects.random(origin); }
+  vec3 generate() const { return objects->random(origin); }
 
 private:
-  hittable const &objects;
+  hittable const *objects;
   point3 origin;
 };
 
-class mixture_pdf : public pdf {
+class pdf {
+public:
+  pdf() : kind(kind_none) {}
+  pdf(sphere_pdf const &p) : kind(kind_sphere), sphere(p) {}
+  pdf(cosine_pdf const &p) : kind(kind_cosine), cosine(p) {}
+  pdf(hittable_pdf const &p) : kind(kind_hittable), objects(p) {}
+
+  bool empty() const { return kind == kind_none; }
+
+  double value(vec3 const &direction) const {
+    switch (kind) {
+    case kind_sphere:
+      return sphere.value(direction);
+    case kind_cosine:
+      return cosine.value(direction);
+    case kind_hittable:
+      return objects.value(direction);
+    default:
+      return 0.0;
+    }
+  }
+
+  vec3 generate() const {
+    switch (kind) {
+    case kind_sphere:
+      return sphere.generate();
+    case kind_cosine:
+      return cosine.generate();
+    case kind_hittable:
+      return objects.generate();
+    default:
+      return vec3(1.0, 0.0, 0.0);
+    }
+  }
+
+private:
+  enum pdf_kind { kind_none, kind_sphere, kind_cosine, kind_hittable } kind;
+  union {
+    sphere_pdf sphere;
+    cosine_pdf cosine;
+    hittable_pdf objects;
+  };
+};
+
+class mixture_pdf {
 public:
-  mixture_pdf(std::shared_ptr<pdf> p0, std::shared_ptr<pdf> p1) {
+  mixture_pdf(pdf const &p0, pdf const &p1) {
     p[0] = p0;
     p[1] = p1;
   }
-  double value(vec3 const &direction) const override {
-    return 0.5 * p[0]->value(direction) + 0.5 * p[1]->value(direction);
+  double value(vec3 const &direction) const {
+    return 0.5 * p[0].value(direction) + 0.5 * p[1].value(direction);
   }
-  vec3 generate() const override {
+  vec3 generate() const {
     if (random_double() < 0.5)
-      return p[0]->generate();
+      return p[0].generate();
     else
-      return p[1]->generate();
+      return p[1].generate();
   }
 
 private:
-  shared_ptr<pdf> p[2];
+  pdf p[2];
 };
 
-#endif // PDF_H
\ No newline at end of file
+#endif // PDF_H
@@ -7,9 +7,12 @@
 #include "interval.h"
 #include "material.h"
 #include "ray.h"
+#include "scene.h"
+#include "simd.h"
 #include "vec3.h"
 #include <cmath>
 #include <memory>
+#include <utility>
 class quad : public hittable {
 public:
   quad(point3 _p0, vec3 _u, vec3 _v, std::shared_ptr<Material> _material)
@@ -23,43 +26,83 @@ public:
     calculate_bbox();
   };
 
-  bool hit(const Ray &ray, interval ray_range,
-           hit_record &record) const override {
+  bool intersect(const Ray &ray, interval ray_range,
+                 hit_info &info) const override {
     double factroOfDirection;
     if (solveIntersection(ray, ray_range, factroOfDirection)) {
       auto intersection = ray.at(factroOfDirection);
-      if (is_interior(intersection, record)) {
-        generate_hit_record(record, ray, factroOfDirection);
+      double a, b;
+      if (is_interior(intersection, a, b)) {
+        info.record_hit(this, factroOfDirection, a, b);
         return true;
       }
     }
     return false;
   }
 
+  void intersect_packet(ray_packet &packet, uint32_t mask, hit_info *infos,
+                        uint32_t &hits) const override {
+#ifdef X86_SIMD
+    if (current_simd_level() == simd_level::avx2) {
+      intersect_packet_avx2(packet, mask, infos, hits);
+      return;
+    }
+#endif
+    hittable::intersect_packet(packet, mask, infos, hits);
+  }
+
+  void materialize(const Ray &ray, hit_info const &info,
+                   hit_record &record) const override {
+    record.textureCoordinate.u = info.u;
+    record.textureCoordinate.v = info.v;
+    generate_hit_record(record, ray, info.factorOfDirection);
+  }
+
+  bool occluded(const Ray &ray, interval ray_range) const override {
+    double factorOfDirection, a, b;
+    return solveIntersection(ray, ray_range, factorOfDirection) &&
+           is_interior(ray.at(factorOfDirection), a, b);
+  }
+
   aabb bounding_box() const override { return bbox; }
 
   void generate_hit_record(hit_record &record, Ray const &ray,
                            double factorOfDirection) const {
-    record.material = material;
+    record.material = material.get();
     record.factorOfDirection = factorOfDirection;
     record.hitPoint = ray.at(factorOfDirection);
     record.set_surface_normal(ray, normal);
   }
 
   double pdf_value(point3 const &origin, vec3 const &direction) const override {
-    hit_record record;
-    if (!this->hit(Ray(origin, direction), interval(0.001, INFINITY_DOUBLE),
-                   record))
+    Ray ray(origin, direction);
+    double factorOfDirection, a, b;
+    if (!solveIntersection(ray, interval(0.001, INFINITY_DOUBLE),
+                           factorOfDirection) ||
+        !is_interior(ray.at(factorOfDirection), a, b))
       return 0.0;
 
-    auto distance_squared = record.factorOfDirection *
-                            record.factorOfDirection * direction.norm_square();
-    auto cosine = std::fabs(dotProduct(record.normalAgainstRay, direction) /
-                            direction.norm());
+    auto distance_squared =
+        factorOfDirection * factorOfDirection * direction.norm_square();
+    auto cosine =
+        std::fabs(dotProduct(normal, direction) / direction.norm());
 
     return distance_squared / (cosine * area);
   }
 
+  // one-sided: diffuse_light only emits on the front face
+  bool emitter(emitter_shape &shape) const override {
+    shape.bounds = bbox;
+    shape.axis = normal;
+    shape.cos_theta_normals = 1.0;
+    shape.cos_theta_emission = 0.0;
+    shape.area = area;
+    shape.material = material.get();
+    shape.texture_point = texture_coordinate(0.5, 0.5);
+    shape.point = p0 + 0.5 * u + 0.5 * v;
+    return true;
+  }
+
   vec3 random(const point3 &origin) const {
     auto random_u = random_double(0, 1);
     auto random_v = random_double(0, 1);
@@ -84,6 +127,97 @@ private:
     bbox = aabb(diagonal1, diagonal2);
   }
 
+#ifdef X86_SIMD
+  // intersect() for four lanes at a time: solveIntersection() and
+  // is_interior() operation for operation, so a packet finds exactly what
+  // its rays would alone
+  __attribute__((target("avx2"))) void
+  intersect_packet_avx2(ray_packet &packet, uint32_t mask, hit_info *infos,
+                        uint32_t &hits) const {
+    __m256d const n[3] = {_mm256_set1_pd(normal.x), _mm256_set1_pd(normal.y),
+                          _mm256_set1_pd(normal.z)};
+    __m256d const sign_bit = _mm256_set1_pd(-0.0);
+    __m256d const zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1.0);
+    for (int first = 0; first < packet.size; first += 4) {
+      uint32_t lanes = (mask >> first) & 0xf;
+      if (lanes == 0)
+        continue;
+      __m256d origin[3], direction[3];
+      for (int axis = 0; axis < 3; axis++) {
+        origin[axis] = _mm256_loadu_pd(packet.origin[axis] + first);
+        direction[axis] = _mm256_loadu_pd(packet.direction[axis] + first);
+      }
+      __m256d denominal = dot(n, direction);
+      __m256d t = _mm256_div_pd(
+          _mm256_sub_pd(_mm256_set1_pd(D), dot(n, origin)), denominal);
+      __m256d in_range = _mm256_and_pd(
+          _mm256_cmp_pd(_mm256_andnot_pd(sign_bit, denominal),
+                        _mm256_set1_pd(1e-8), _CMP_NLT_UQ),
+          _mm256_and_pd(
+              _mm256_cmp_pd(t, _mm256_loadu_pd(packet.t_min + first),
+                            _CMP_GE_OQ),
+              _mm256_cmp_pd(t, _mm256_loadu_pd(packet.t_max + first),
+                            _CMP_LE_OQ)));
+      lanes &= uint32_t(_mm256_movemask_pd(in_range));
+      if (lanes == 0)
+        continue;
+
+      __m256d to_hit[3]; // ray.at(t) - p0
+      for (int axis = 0; axis < 3; axis++)
+        to_hit[axis] = _mm256_sub_pd(
+            _mm256_add_pd(origin[axis], _mm256_mul_pd(t, direction[axis])),
+            _mm256_set1_pd(p0[axis]));
+      __m256d const along_u[3] = {_mm256_set1_pd(u.x), _mm256_set1_pd(u.y),
+                                  _mm256_set1_pd(u.z)};
+      __m256d const along_v[3] = {_mm256_set1_pd(v.x), _mm256_set1_pd(v.y),
+                                  _mm256_set1_pd(v.z)};
+      __m256d const scaled_normal[3] = {
+          _mm256_set1_pd(w.x), _mm256_set1_pd(w.y), _mm256_set1_pd(w.z)};
+      __m256d cross_v[3], cross_u[3];
+      cross(to_hit, along_v, cross_v);
+      cross(along_u, to_hit, cross_u);
+      __m256d a = dot(scaled_normal, cross_v);
+      __m256d b = dot(scaled_normal, cross_u);
+      __m256d interior = _mm256_and_pd(
+          _mm256_and_pd(_mm256_cmp_pd(a, zero, _CMP_GE_OQ),
+                        _mm256_cmp_pd(a, one, _CMP_LE_OQ)),
+          _mm256_and_pd(_mm256_cmp_pd(b, zero, _CMP_GE_OQ),
+                        _mm256_cmp_pd(b, one, _CMP_LE_OQ)));
+      lanes &= uint32_t(_mm256_movemask_pd(interior));
+      if (lanes == 0)
+        continue;
+      double ts[4], as[4], bs[4];
+      _mm256_storeu_pd(ts, t);
+      _mm256_storeu_pd(as, a);
+      _mm256_storeu_pd(bs, b);
+      for (int k; ray_packet::next_lane(lanes, k);) {
+        int lane = first + k;
+        infos[lane].record_hit(this, ts[k], as[k], bs[k]);
+        packet.t_max[lane] = ts[k];
+        hits |= 1u << lane;
+      }
+    }
+  }
+
+  // (x * x + y * y) + z * z, as vec3's dot product adds
+  __attribute__((target("avx2"))) static __m256d dot(__m256d const a[3],
+                                                     __m256d const b[3]) {
+    return _mm256_add_pd(
+        _mm256_add_pd(_mm256_mul_pd(a[0], b[0]), _mm256_mul_pd(a[1], b[1])),
+        _mm256_mul_pd(a[2], b[2]));
+  }
+
+  __attribute__((target("avx2"))) static void
+  cross(__m256d const a[3], __m256d const b[3], __m256d result[3]) {
+    result[0] = _mm256_sub_pd(_mm256_mul_pd(a[1], b[2]),
+                              _mm256_mul_pd(a[2], b[1]));
+    result[1] = _mm256_sub_pd(_mm256_mul_pd(a[2], b[0]),
+                              _mm256_mul_pd(a[0], b[2]));
+    result[2] = _mm256_sub_pd(_mm256_mul_pd(a[0], b[1]),
+                              _mm256_mul_pd(a[1], b[0]));
+  }
+#endif
+
   bool solveIntersection(Ray const &ray, interval ray_range,
                          double &factorOfDirection) const {
     auto denominal = dotProduct(normal, ray.getDirection());
@@ -100,27 +234,29 @@ private:
     return true;
   }
 
-  bool is_interior(point3 const &intersection, hit_record &record) const {
+  bool is_interior(point3 const &intersection, double &a, double &b) const {
     vec3 p0_to_hitpoint = intersection - p0;
-    auto a = dotProduct(w, crossProduct(p0_to_hitpoint, v));
-    auto b = dotProduct(w, crossProduct(u, p0_to_hitpoint));
+    a = dotProduct(w, crossProduct(p0_to_hitpoint, v));
+    b = dotProduct(w, crossProduct(u, p0_to_hitpoint));
 
     interval unit_interval = interval(0, 1);
 
-    if (!unit_interval.contain(a) || !unit_interval.contain(b))
-      return false;
-
-    record.textureCoordinate.u = a;
-    record.textureCoordinate.v = b;
-    return true;
+    return unit_interval.contain(a) && unit_interval.contain(b);
   }
 };
-inline shared_ptr<hittable_list> box(const point3 &a, const point3 &b,
-                                     shared_ptr<Material> mat) {
+inline shared_ptr<hittable_list> box_sides(const point3 &a, const point3 &b,
+                                     shared_ptr<Material> mat,
+                                     scene *objects = nullptr) {
   // Returns the 3D box (six sides) that contains the two opposite vertices a &
-  // b.
+  // b. With a scene, the sides are created in its arena. box() is faster,
+  // this is the reference it is compared with.
 
-  auto sides = make_shared<hittable_list>();
+  auto sides = objects ? objects->create<hittable_list>()
+                       : make_shared<hittable_list>();
+  auto side = [&](point3 const &q, vec3 const &u, vec3 const &v) {
+    return objects ? objects->create<quad>(q, u, v, mat)
+                   : make_shared<quad>(q, u, v, mat);
+  };
 
   // Construct the two opposite vertices with the minimum and maximum
   // coordinates.
@@ -133,20 +269,227 @@ inline shared_ptr<hittable_list> box(const point3 &a, const point3 &b,
   auto dy = vec3(0, max.y - min.y, 0);
   auto dz = vec3(0, 0, max.z - min.z);
 
-  sides->add(make_shared<quad>(point3(min.x, min.y, max.z), dx, dy,
-                               mat)); // front
-  sides->add(make_shared<quad>(point3(max.x, min.y, max.z), -dz, dy,
-                               mat)); // right
-  sides->add(make_shared<quad>(point3(max.x, min.y, min.z), -dx, dy,
-                               mat)); // back
-  sides->add(make_shared<quad>(point3(min.x, min.y, min.z), dz, dy,
-                               mat)); // left
-  sides->add(make_shared<quad>(point3(min.x, max.y, max.z), dx, -dz,
-                               mat)); // top
-  sides->add(make_shared<quad>(point3(min.x, min.y, min.z), dx, dz,
-                               mat)); // bottom
+  sides->add(side(point3(min.x, min.y, max.z), dx, dy));  // front
+  sides->add(side(point3(max.x, min.y, max.z), -dz, dy)); // right
+  sides->add(side(point3(max.x, min.y, min.z), -dx, dy)); // back
+  sides->add(side(point3(min.x, min.y, min.z), dz, dy));  // left
+  sides->add(side(point3(min.x, max.y, max.z), dx, -dz)); // top
+  sides->add(side(point3(min.x, min.y, min.z), dx, dz));  // bottom
 
   return sides;
 }
 
+/*
+an axis-aligned box as one primitive: a single slab test finds the hit and
+its face, instead of six quad tests. faces are numbered 2 * axis, plus one for
+the max side; texture coordinates run over each face the way the six quads of
+box_sides() lay them out. a ray starting inside hits the face it leaves by,
+as media and dielectrics need.
+*/
+class aa_box : public hittable {
+public:
+  aa_box(point3 const &a, point3 const &b, std::shared_ptr<Material> material)
+      : minimum(std::fmin(a.x, b.x), std::fmin(a.y, b.y), std::fmin(a.z, b.z)),
+        maximum(std::fmax(a.x, b.x), std::fmax(a.y, b.y), std::fmax(a.z, b.z)),
+        bbox(a, b), material(material) {
+    for (int axis = 0; axis < 3; axis++) {
+      double size = maximum[axis] - minimum[axis];
+      inverse_size[axis] = size > 0.0 ? 1.0 / size : 0.0;
+    }
+    for (int face = 0; face < 6; face++) {
+      int axis = face / 2;
+      face_area[face] = (maximum[(axis + 1) % 3] - minimum[(axis + 1) % 3]) *
+                        (maximum[(axis + 2) % 3] - minimum[(axis + 2) % 3]);
+    }
+  }
+
+  // the face goes through hit_info::u, the coordinates are only needed for
+  // the final hit
+  bool intersect(const Ray &ray, interval ray_range,
+                 hit_info &info) const override {
+    double factorOfDirection;
+    int face;
+    if (!slab_hit(ray, ray_range, factorOfDirection, face))
+      return false;
+    info.record_hit(this, factorOfDirection, face);
+    return true;
+  }
+
+  void materialize(const Ray &ray, hit_info const &info,
+                   hit_record &record) const override {
+    int face = int(info.u);
+    record.material = material.get();
+    record.factorOfDirection = info.factorOfDirection;
+    record.hitPoint = ray.at(info.factorOfDirection);
+    record.textureCoordinate = face_coordinate(face, record.hitPoint);
+    record.set_surface_normal(ray, face_normal(face));
+  }
+
+  bool occluded(const Ray &ray, interval ray_range) const override {
+    double factorOfDirection;
+    int face;
+    return slab_hit(ray, ray_range, factorOfDirection, face);
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  // area sampling over the faces turned towards origin (all six from
+  // inside): each direction crosses that surface once, so the pdf is the
+  // usual area-to-solid-angle conversion with their total area
+  double pdf_value(point3 const &origin, vec3 const &direction) const override {
+    double factorOfDirection;
+    int face;
+    if (!slab_hit(Ray(origin, direction), interval(0.001, INFINITY_DOUBLE),
+                  factorOfDirection, face))
+      return 0.0;
+
+    auto distance_squared =
+        factorOfDirection * factorOfDirection * direction.norm_square();
+    auto cosine = std::fabs(direction[face / 2]) / direction.norm();
+    return distance_squared / (cosine * visible_area(origin));
+  }
+
+  vec3 random(const point3 &origin) const override {
+    double pick = random_double(0, visible_area(origin));
+    int face = 0; // ends on the last visible face if rounding overshoots
+    for (int candidate = 0; candidate < 6; candidate++) {
+      if (!faces(candidate, origin))
+        continue;
+      face = candidate;
+      if (pick < face_area[candidate])
+        break;
+      pick -= face_area[candidate];
+    }
+
+    int axis = face / 2, u_axis = (axis + 1) % 3, v_axis = (axis + 2) % 3;
+    point3 random_point;
+    random_point[axis] = face % 2 ? maximum[axis] : minimum[axis];
+    random_point[u_axis] = random_double(minimum[u_axis], maximum[u_axis]);
+    random_point[v_axis] = random_double(minimum[v_axis], maximum[v_axis]);
+    return unit_vector(random_point - origin);
+  }
+
+  // emits to every side, like a sphere
+  bool emitter(emitter_shape &shape) const override {
+    shape.bounds = bbox;
+    shape.cos_theta_normals = -1.0;
+    shape.cos_theta_emission = 0.0;
+    shape.area = 0.0;
+    for (double area : face_area)
+      shape.area += area;
+    shape.material = material.get();
+    shape.texture_point = texture_coordinate(0.5, 0.5);
+    shape.point = point3(0.5 * (minimum.x + maximum.x), maximum.y,
+                         0.5 * (minimum.z + maximum.z));
+    return true;
+  }
+
+private:
+  point3 minimum, maximum;
+  vec3 inverse_size;
+  double face_area[6];
+  aabb bbox;
+  std::shared_ptr<Material> material;
+
+  // entry and exit through the three slabs: the hit is the entry, or the
+  // exit when the entry is behind ray_range
+  bool slab_hit(Ray const &ray, interval ray_range, double &factorOfDirection,
+                int &face) const {
+    double t_near = -INFINITY_DOUBLE, t_far = INFINITY_DOUBLE;
+    int near_face = 0, far_face = 0;
+    for (int axis = 0; axis < 3; axis++) {
+      double origin = ray.getOrigin()[axis];
+      double inverse_direction = 1.0 / ray.getDirection()[axis];
+      double t_min = (minimum[axis] - origin) * inverse_direction;
+      double t_max = (maximum[axis] - origin) * inverse_direction;
+      int min_face = 2 * axis, max_face = 2 * axis + 1;
+      if (t_min > t_max) {
+        std::swap(t_min, t_max);
+        std::swap(min_face, max_face);
+      }
+      if (t_min > t_near) {
+        t_near = t_min;
+        near_face = min_face;
+      }
+      if (t_max < t_far) {
+        t_far = t_max;
+        far_face = max_face;
+      }
+    }
+    if (t_near > t_far)
+      return false;
+
+    if (ray_range.contain(t_near)) {
+      factorOfDirection = t_near;
+      face = near_face;
+      return true;
+    }
+    if (t_near < ray_range.min && ray_range.contain(t_far)) {
+      factorOfDirection = t_far;
+      face = far_face;
+      return true;
+    }
+    return false;
+  }
+
+  static vec3 face_normal(int face) {
+    vec3 normal(0, 0, 0);
+    normal[face / 2] = face % 2 ? 1.0 : -1.0;
+    return normal;
+  }
+
+  texture_coordinate face_coordinate(int face, point3 const &point) const {
+    double x = (point.x - minimum.x) * inverse_size.x;
+    double y = (point.y - minimum.y) * inverse_size.y;
+    double z = (point.z - minimum.z) * inverse_size.z;
+    switch (face) {
+    case 0: // left
+      return texture_coordinate(z, y);
+    case 1: // right
+      return texture_coordinate(1.0 - z, y);
+    case 2: // bottom
+      return texture_coordinate(x, z);
+    case 3: // top
+      return texture_coordinate(x, 1.0 - z);
+    case 4: // back
+      return texture_coordinate(1.0 - x, y);
+    default: // front
+      return texture_coordinate(x, y);
+    }
+  }
+
+  // whether face is turned towards origin, every face is from inside
+  bool faces(int face, point3 const &origin) const {
+    if (!outside(origin))
+      return true;
+    int axis = face / 2;
+    return face % 2 ? origin[axis] > maximum[axis]
+                    : origin[axis] < minimum[axis];
+  }
+
+  bool outside(point3 const &origin) const {
+    for (int axis = 0; axis < 3; axis++)
+      if (origin[axis] < minimum[axis] || origin[axis] > maximum[axis])
+        return true;
+    return false;
+  }
+
+  double visible_area(point3 const &origin) const {
+    double area = 0.0;
+    for (int face = 0; face < 6; face++)
+      if (faces(face, origin))
+        area += face_area[face];
+    return area;
+  }
+};
+
+// the box as one aa_box. With a scene, it is created in its arena
+inline shared_ptr<hittable> box(const point3 &a, const point3 &b,
+                                shared_ptr<Material> mat,
+                                scene *objects = nullptr) {
+  if (objects)
+    return objects->create<aa_box>(a, b, mat);
+  return make_shared<aa_box>(a, b, mat);
+}
+
 #endif // QUAD_H
\ No newline at end of file
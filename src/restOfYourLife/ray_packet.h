@@ -0,0 +1,58 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "interval.h"
+#include "ray.h"
+#include "vec3.h"
+#include <cstdint>
+
+/*
+up to max_size rays traced together, like the camera rays of a few
+neighbouring samples. besides the rays, their origins, directions and
+reciprocal directions are kept per coordinate (SoA) for simd box tests, and
+each ray's range, whose max shrinks to the closest hit found so far. lanes
+are picked with a bit mask; only the first size lanes hold rays.
+*/
+class ray_packet {
+public:
+  static int const max_size = 16;
+
+  // the unused lanes are zero, so kernels may load whole registers
+  int size = 0;
+  Ray rays[max_size];
+  double origin[3][max_size] = {}, direction[3][max_size] = {};
+  double inverse_direction[3][max_size] = {};
+  double time[max_size] = {};
+  double t_min[max_size] = {}, t_max[max_size] = {};
+
+  // returns the new ray's lane
+  int add(Ray const &ray, interval ray_range) {
+    int lane = size++;
+    rays[lane] = ray;
+    for (int axis = 0; axis < 3; axis++) {
+      origin[axis][lane] = ray.getOrigin()[axis];
+      direction[axis][lane] = ray.getDirection()[axis];
+      inverse_direction[axis][lane] = 1.0 / ray.getDirection()[axis];
+    }
+    time[lane] = ray.getTime();
+    t_min[lane] = ray_range.min;
+    t_max[lane] = ray_range.max;
+    return lane;
+  }
+
+  uint32_t all_lanes() const { return (1u << size) - 1; }
+  interval range(int lane) const { return interval(t_min[lane], t_max[lane]); }
+
+  // lanes in mask, lowest first: for (int lane; next_lane(mask, lane);)
+  static bool next_lane(uint32_t &mask, int &lane) {
+    if (mask == 0)
+      return false;
+    lane = __builtin_ctz(mask);
+    mask &= mask - 1;
+    return true;
+  }
+
+  static int lane_count(uint32_t mask) { return __builtin_popcount(mask); }
+};
+
+#endif // RAY_PACKET_H
@@ -0,0 +1,63 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+uint64_t mix_seed(uint64_t value) {
+  // splitmix64 finalizer
+  value += 0x9e3779b97f4a7c15ULL;
+  value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+  return value ^ (value >> 31);
+}
+
+/*
+PCG32 (XSH-RR) random stream, https://www.pcg-random.org
+the increment selects one of 2^63 independent streams, the state is the
+position inside it. A stream is addressed by (seed, pixel, sample, dimension):
+the pixel picks the stream and the rest picks where in it we start, so any
+sample of any pixel can be regenerated without replaying the ones before it.
+*/
+class rng_stream {
+public:
+  rng_stream() : state(0x853c49e6748fea9bULL), increment(0xda3e39cb94b95bdbULL) {}
+  rng_stream(uint64_t seed, uint64_t pixel, uint64_t sample_index,
+             uint64_t dimension = 0) {
+    increment = (mix_seed(seed ^ mix_seed(pixel)) << 1) | 1u;
+    state = mix_seed(mix_seed(seed + sample_index) ^ (dimension << 32));
+    next_uint32();
+  }
+
+  uint32_t next_uint32() {
+    uint64_t old_state = state;
+    state = old_state * multiplier + increment;
+    uint32_t xorshifted = uint32_t(((old_state >> 18u) ^ old_state) >> 27u);
+    uint32_t rotation = uint32_t(old_state >> 59u);
+    return (xorshifted >> rotation) | (xorshifted << ((-rotation) & 31));
+  }
+
+  double next_double() {
+    // [0, 1) with the full 53 bits of mantissa
+    uint64_t high = next_uint32(), low = next_uint32();
+    return double((high << 21) | (low >> 11)) * (1.0 / 9007199254740992.0);
+  }
+
+private:
+  static uint64_t const multiplier = 6364136223846793005ULL;
+  uint64_t state;
+  uint64_t increment;
+};
+
+// the stream random_double() and friends draw from on this thread. Camera
+// rebinds it for every (pixel, sample), so code below the camera (materials,
+// pdfs, textures, media) stays deterministic without threading a generator
+// through every hit()/Scatter() signature.
+thread_local rng_stream thread_random_stream;
+
+rng_stream &current_random_stream() { return thread_random_stream; }
+
+void bind_random_stream(rng_stream const &stream) {
+  thread_random_stream = stream;
+}
+
+#endif // RNG_H
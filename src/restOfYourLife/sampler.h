@@ -0,0 +1,318 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "rng.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+where the random numbers of one sample come from. A sample is a point in a
+high-dimensional cube: the camera takes the first camera_dimensions (pixel
+footprint, lens, time), every bounce after that owns a window of
+dimensions_per_bounce, so bounce k of every sample draws from the same
+dimensions whatever happened before it. draws past the end of a window, or
+past what a sampler covers, come from the thread's independent stream.
+
+samplers are stateless apart from the current (pixel, sample, dimension): any
+sample can be generated in any order, progressive renders just keep counting
+sample indices.
+*/
+class sampler {
+public:
+  static int const camera_dimensions = 6; // pixel 0-1, lens 2-3, time 4
+  static int const dimensions_per_bounce = 8;
+
+  sampler(uint64_t seed, int samples_per_pixel)
+      : seed(seed), samples_per_pixel(std::max(1, samples_per_pixel)) {}
+  virtual ~sampler() = default;
+
+  void start_pixel_sample(uint64_t pixel, uint64_t sample_index) {
+    current_pixel = pixel;
+    current_sample = sample_index;
+    dimension = 0;
+    window_end = camera_dimensions;
+  }
+
+  void start_bounce(int depth) {
+    dimension = camera_dimensions + depth * dimensions_per_bounce;
+    window_end = dimension + dimensions_per_bounce;
+  }
+
+  double get_1d() {
+    if (dimension >= window_end || dimension >= max_dimension())
+      return current_random_stream().next_double();
+    return sample(dimension++);
+  }
+
+protected:
+  uint64_t seed;
+  int samples_per_pixel;
+  uint64_t current_pixel = 0, current_sample = 0;
+
+  // value of the current sample in the given dimension, in [0, 1)
+  virtual double sample(int dimension) const = 0;
+  virtual int max_dimension() const { return 1 << 30; }
+
+  uint64_t hash(uint64_t a, uint64_t b = 0, uint64_t c = 0) const {
+    return mix_seed(mix_seed(mix_seed(seed ^ a) ^ b) ^ c);
+  }
+
+  static double to_unit(uint32_t bits) { return bits * (1.0 / 4294967296.0); }
+
+  // a random permutation of [0, length) evaluated at index, without tables.
+  // Kensler, Correlated Multi-Jittered Sampling, 2013
+  static uint32_t permute(uint32_t index, uint32_t length, uint32_t key) {
+    uint32_t mask = length - 1;
+    mask |= mask >> 1;
+    mask |= mask >> 2;
+    mask |= mask >> 4;
+    mask |= mask >> 8;
+    mask |= mask >> 16;
+    do {
+      index ^= key;
+      index *= 0xe170893d;
+      index ^= key >> 16;
+      index ^= (index & mask) >> 4;
+      index ^= key >> 8;
+      index *= 0x0929eb3f;
+      index ^= key >> 23;
+      index ^= (index & mask) >> 1;
+      index *= 1 | key >> 27;
+      index *= 0x6935fa69;
+      index ^= (index & mask) >> 11;
+      index *= 0x74dcb303;
+      index ^= (index & mask) >> 2;
+      index *= 0x9e501cc3;
+      index ^= (index & mask) >> 2;
+      index *= 0xc860a3df;
+      index &= mask;
+      index ^= index >> 5;
+    } while (index >= length);
+    return (index + key) % length;
+  }
+
+private:
+  int dimension = 0;
+  int window_end = camera_dimensions;
+};
+
+// every dimension from the thread's stream, as if no sampler were bound
+class independent_sampler : public sampler {
+public:
+  independent_sampler(uint64_t seed, int samples_per_pixel)
+      : sampler(seed, samples_per_pixel) {}
+
+protected:
+  double sample(int dimension) const override {
+    return current_random_stream().next_double();
+  }
+};
+
+/*
+jittered strata per dimension: every run of samples_per_pixel consecutive
+samples puts one sample in each of samples_per_pixel strata of every
+dimension, strata shuffled independently per (pixel, dimension, run). this is
+latin hypercube sampling, it works for any sample count.
+*/
+class stratified_sampler : public sampler {
+public:
+  stratified_sampler(uint64_t seed, int samples_per_pixel)
+      : sampler(seed, samples_per_pixel) {}
+
+protected:
+  double sample(int dimension) const override {
+    uint64_t run = current_sample / uint64_t(samples_per_pixel);
+    uint32_t index = uint32_t(current_sample % uint64_t(samples_per_pixel));
+    uint64_t dimension_hash = hash(current_pixel, uint64_t(dimension), run);
+    uint32_t stratum =
+        permute(index, uint32_t(samples_per_pixel), uint32_t(dimension_hash));
+    double jitter = to_unit(uint32_t(mix_seed(dimension_hash ^ index) >> 32));
+    return (stratum + jitter) / samples_per_pixel;
+  }
+};
+
+/*
+owen-scrambled sobol, Burley, Practical Hash-based Owen Scrambling, 2020.
+dimensions are taken in pairs, each pair the first two sobol dimensions with
+its own scrambling and its own shuffle of the sample order, so pairs do not
+correlate with each other. prefixes of 2^k samples are stratified in both
+dimensions of every pair; other counts still are in each single dimension.
+*/
+class sobol_sampler : public sampler {
+public:
+  sobol_sampler(uint64_t seed, int samples_per_pixel)
+      : sampler(seed, samples_per_pixel) {}
+
+protected:
+  double sample(int dimension) const override {
+    uint64_t pair_hash = hash(current_pixel, uint64_t(dimension / 2));
+    uint32_t index =
+        nested_uniform_scramble(uint32_t(current_sample), uint32_t(pair_hash));
+    uint32_t point = sobol(index, dimension % 2);
+    return to_unit(nested_uniform_scramble(
+        point, uint32_t(pair_hash >> 32) + uint32_t(dimension % 2)));
+  }
+
+private:
+  static uint32_t sobol(uint32_t index, int sobol_dimension) {
+    // dimension 0 is van der Corput, dimension 1 has v_k = v_k-1 ^ v_k-1 >> 1
+    uint32_t result = 0, direction = 0x80000000u;
+    for (; index != 0; index >>= 1) {
+      if (index & 1)
+        result ^= direction;
+      direction = sobol_dimension == 0 ? direction >> 1
+                                       : direction ^ (direction >> 1);
+    }
+    return result;
+  }
+
+  static uint32_t reverse_bits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+  }
+
+  // an owen scramble of the bit-reversed value: each bit is flipped
+  // depending on the bits above it
+  static uint32_t laine_karras_permutation(uint32_t x, uint32_t key) {
+    x += key;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+  }
+
+  static uint32_t nested_uniform_scramble(uint32_t x, uint32_t key) {
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), key));
+  }
+};
+
+/*
+halton: dimension d is the radical inverse in the d-th prime, owen-scrambled:
+every digit goes through a random permutation picked by the digits before it,
+seeded per pixel. without it, neighbouring large primes march in lockstep for
+the first samples. covers as many dimensions as there are primes in the table.
+*/
+class halton_sampler : public sampler {
+public:
+  static int const prime_count = 256;
+
+  halton_sampler(uint64_t seed, int samples_per_pixel)
+      : sampler(seed, samples_per_pixel), primes(prime_table()) {}
+
+protected:
+  double sample(int dimension) const override {
+    uint32_t base = primes[dimension];
+    double inverse_base = 1.0 / base, digit_weight = inverse_base;
+    double result = 0.0;
+    uint64_t index = current_sample;
+    uint64_t prefix = hash(current_pixel, uint64_t(dimension));
+    // enough digits for 32 bits, also once the index has run out of them
+    while (digit_weight > 2.3e-10) {
+      uint32_t digit = uint32_t(index % base);
+      index /= base;
+      uint32_t permuted = permute(digit, base, uint32_t(prefix >> 32));
+      result += permuted * digit_weight;
+      digit_weight *= inverse_base;
+      prefix = mix_seed(prefix ^ digit);
+    }
+    return result < 1.0 ? result : 0.99999999999999989; // below 1 for sure
+  }
+
+  int max_dimension() const override { return prime_count; }
+
+private:
+  std::vector<uint32_t> const &primes;
+
+  static std::vector<uint32_t> const &prime_table() {
+    static std::vector<uint32_t> const table = [] {
+      std::vector<uint32_t> found;
+      for (uint32_t candidate = 2; found.size() < prime_count; candidate++) {
+        bool is_prime = true;
+        for (uint32_t p : found) {
+          if (p * p > candidate)
+            break;
+          if (candidate % p == 0) {
+            is_prime = false;
+            break;
+          }
+        }
+        if (is_prime)
+          found.push_back(candidate);
+      }
+      return found;
+    }();
+    return table;
+  }
+};
+
+enum class sampler_kind { independent, stratified, sobol, halton };
+
+bool parse_sampler_kind(std::string const &name, sampler_kind &kind) {
+  if (name == "independent")
+    kind = sampler_kind::independent;
+  else if (name == "stratified")
+    kind = sampler_kind::stratified;
+  else if (name == "sobol")
+    kind = sampler_kind::sobol;
+  else if (name == "halton")
+    kind = sampler_kind::halton;
+  else
+    return false;
+  return true;
+}
+
+char const *sampler_name(sampler_kind kind) {
+  switch (kind) {
+  case sampler_kind::independent:
+    return "independent";
+  case sampler_kind::stratified:
+    return "stratified";
+  case sampler_kind::sobol:
+    return "sobol";
+  default:
+    return "halton";
+  }
+}
+
+std::unique_ptr<sampler> make_sampler(sampler_kind kind, uint64_t seed,
+                                      int samples_per_pixel) {
+  switch (kind) {
+  case sampler_kind::independent:
+    return std::unique_ptr<sampler>(
+        new independent_sampler(seed, samples_per_pixel));
+  case sampler_kind::stratified:
+    return std::unique_ptr<sampler>(
+        new stratified_sampler(seed, samples_per_pixel));
+  case sampler_kind::sobol:
+    return std::unique_ptr<sampler>(new sobol_sampler(seed, samples_per_pixel));
+  default:
+    return std::unique_ptr<sampler>(
+        new halton_sampler(seed, samples_per_pixel));
+  }
+}
+
+// the sampler random_double() draws from on this thread, if any. Camera binds
+// one per tile, like the random stream
+thread_local sampler *thread_sampler = nullptr;
+
+void bind_sampler(sampler *bound) { thread_sampler = bound; }
+
+double next_sample_value() {
+  return thread_sampler ? thread_sampler->get_1d()
+                        : current_random_stream().next_double();
+}
+
+// moves the bound sampler to the dimensions of bounce depth
+void start_bounce_dimensions(int depth) {
+  if (thread_sampler)
+    thread_sampler->start_bounce(depth);
+}
+
+#endif // SAMPLER_H
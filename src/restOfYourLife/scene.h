@@ -0,0 +1,124 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "hittable.h"
+#include "material.h"
+#include "texture.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+objects that live as long as the scene, packed into large blocks instead of
+one heap allocation (and one refcount) each. destroyed together, in reverse
+order of creation.
+*/
+class scene_arena {
+public:
+  static size_t const block_size = 64 * 1024;
+
+  scene_arena() = default;
+  scene_arena(scene_arena const &) = delete;
+  scene_arena &operator=(scene_arena const &) = delete;
+
+  ~scene_arena() {
+    for (size_t i = destructors.size(); i > 0; i--)
+      destructors[i - 1].destroy(destructors[i - 1].object);
+  }
+
+  template <typename T, typename... Args> T *create(Args &&...args) {
+    void *memory = allocate(sizeof(T), alignof(T));
+    T *object = new (memory) T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value)
+      destructors.push_back({object, &destroy<T>});
+    return object;
+  }
+
+  size_t bytes_used() const { return used_bytes; }
+
+private:
+  class destructor {
+  public:
+    void *object;
+    void (*destroy)(void *);
+  };
+
+  std::vector<std::unique_ptr<char[]>> blocks;
+  std::vector<destructor> destructors;
+  size_t block_offset = block_size; // forces a block on the first allocation
+  size_t current_block_size = block_size;
+  size_t used_bytes = 0;
+
+  template <typename T> static void destroy(void *object) {
+    static_cast<T *>(object)->~T();
+  }
+
+  void *allocate(size_t size, size_t alignment) {
+    size_t offset = (block_offset + alignment - 1) / alignment * alignment;
+    if (blocks.empty() || offset + size > current_block_size) {
+      // oversized objects get a block of their own
+      current_block_size = std::max(size_t(block_size), size + alignment);
+      blocks.emplace_back(new char[current_block_size]);
+      size_t address = reinterpret_cast<size_t>(blocks.back().get());
+      offset = (alignment - address % alignment) % alignment;
+    }
+    block_offset = offset + size;
+    used_bytes += size;
+    return blocks.back().get() + offset;
+  }
+};
+
+/*
+owns everything a scene is built from: materials, textures and hittables are
+created in one arena and listed by kind. the usual constructors still take
+shared_ptrs, so create hands out shared_ptrs that own nothing: no control
+block, no refcount, valid as long as the scene. objects in the arena keep such
+pointers to each other, which therefore cannot keep the arena alive; it is
+destroyed with the scene. rendering refers to objects by raw pointer
+(hit_record::material, bvh leaves) either way.
+*/
+class scene {
+public:
+  scene() : arena(new scene_arena()) {}
+
+  template <typename T, typename... Args>
+  shared_ptr<T> create(Args &&...args) {
+    T *object = arena->create<T>(std::forward<Args>(args)...);
+    register_object(object);
+    return shared_ptr<T>(shared_ptr<T>(), object);
+  }
+
+  std::vector<Material const *> const &materials() const {
+    return material_pointers;
+  }
+  std::vector<texture const *> const &textures() const {
+    return texture_pointers;
+  }
+  std::vector<hittable const *> const &hittables() const {
+    return hittable_pointers;
+  }
+  size_t bytes_used() const { return arena->bytes_used(); }
+
+private:
+  std::unique_ptr<scene_arena> arena;
+  std::vector<Material const *> material_pointers;
+  std::vector<texture const *> texture_pointers;
+  std::vector<hittable const *> hittable_pointers;
+
+  void register_object(Material const *object) {
+    material_pointers.push_back(object);
+  }
+  void register_object(texture const *object) {
+    texture_pointers.push_back(object);
+  }
+  void register_object(hittable const *object) {
+    hittable_pointers.push_back(object);
+  }
+  void register_object(void const *) {} // pdfs and other helpers
+};
+
+#endif // SCENE_H
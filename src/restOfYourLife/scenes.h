@@ -0,0 +1,238 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "light_tree.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "mesh.h"
+#include "mesh_io.h"
+#include "quad.h"
+#include "rng.h"
+#include "scene.h"
+#include "sphere.h"
+#include "texture.h"
+#include "tlas.h"
+#include "transform.h"
+#include <cmath>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// the world is returned wrapped in a bvh, the light quad is added to lights.
+// lights carry their emitting material, for next event estimation. a mesh
+// file, if given, stands in for the tall box: scaled to fit it, on the floor
+hittable_list cornell_box_world(scene &objects, hittable_list &lights,
+                                std::string const &mesh_file = "") {
+  hittable_list world;
+
+  auto red = objects.create<lambertian>(color3(.65, .05, .05));
+  auto white = objects.create<lambertian>(color3(.73, .73, .73));
+  auto green = objects.create<lambertian>(color3(.12, .45, .15));
+  auto light = objects.create<diffuse_light>(color3(15, 15, 15));
+
+  world.add(objects.create<quad>(point3(555, 0, 0), vec3(0, 555, 0),
+                                 vec3(0, 0, 555), green));
+  world.add(objects.create<quad>(point3(0, 0, 0), vec3(0, 555, 0),
+                                 vec3(0, 0, 555), red));
+  world.add(objects.create<quad>(point3(343, 554, 332), vec3(-130, 0, 0),
+                                 vec3(0, 0, -105), light));
+  world.add(objects.create<quad>(point3(0, 0, 0), vec3(555, 0, 0),
+                                 vec3(0, 0, 555), white));
+  world.add(objects.create<quad>(point3(555, 555, 555), vec3(-555, 0, 0),
+                                 vec3(0, 0, -555), white));
+  world.add(objects.create<quad>(point3(0, 0, 555), vec3(555, 0, 0),
+                                 vec3(0, 555, 0), white));
+
+  auto placement = affine_transform::translation(vec3(265, 0, 295)) *
+                   affine_transform::rotation_y(15);
+  if (mesh_file.empty()) {
+    shared_ptr<hittable> box1 =
+        box(point3(0.0, 0.0, 0.0), point3(165, 330, 165), white, &objects);
+    world.add(objects.create<transform_instance>(box1, placement));
+  } else {
+    auto model = objects.create<triangle_mesh>(load_mesh(mesh_file), white);
+    aabb bounds = model->bounding_box();
+    double scale = INFINITY_DOUBLE;
+    double const fit[3] = {165, 330, 165};
+    for (int axis = 0; axis < 3; axis++) {
+      interval const &extent = bounds.get_axis_interval(axis);
+      if (extent.max > extent.min)
+        scale = std::min(scale, fit[axis] / (extent.max - extent.min));
+    }
+    if (scale == INFINITY_DOUBLE)
+      scale = 1.0;
+    point3 center = bounds.centroid();
+    auto fitted =
+        affine_transform::translation(vec3(82.5, 0, 82.5)) *
+        affine_transform::scaling(vec3(scale, scale, scale)) *
+        affine_transform::translation(
+            vec3(-center.x, -bounds.get_axis_interval(1).min, -center.z));
+    if (model->triangle_count() > 0)
+      world.add(objects.create<transform_instance>(model, placement * fitted));
+  }
+
+  auto glass = objects.create<dielectric>(1.5);
+  world.add(objects.create<sphere>(point3(190, 90, 190), 90, glass));
+
+  world = hittable_list(objects.create<linear_bvh>(world));
+
+  // light sources
+  lights.add(objects.create<quad>(point3(343, 554, 332), vec3(-130, 0.0, 0.0),
+                                  vec3(0.0, 0.0, -105), light));
+
+  return world;
+}
+
+// two perlin-textured spheres lit by a quad and a sphere light
+hittable_list simple_light_world(scene &objects, hittable_list &lights) {
+  hittable_list world;
+
+  auto pertext = objects.create<perlin_noise_texture>(4);
+  world.add(objects.create<sphere>(point3(0, -1000, 0), 1000,
+                                   objects.create<lambertian>(pertext)));
+  world.add(objects.create<sphere>(point3(0, 2, 0), 2,
+                                   objects.create<lambertian>(pertext)));
+
+  auto difflight = objects.create<diffuse_light>(color3(4, 4, 4));
+  auto light_quad = objects.create<quad>(point3(3, 1, -2), vec3(2, 0, 0),
+                                         vec3(0, 2, 0), difflight);
+  auto light_sphere = objects.create<sphere>(point3(0, 7, 0), 2, difflight);
+  world.add(light_quad);
+  world.add(light_sphere);
+  lights.add(light_quad);
+  lights.add(light_sphere);
+
+  return world;
+}
+
+// a hall lit by light_count small ceiling panels of very different strength,
+// a quarter of them facing up and useless to the floor. the panels are added
+// to lights; wrap them in a light_tree to sample them by importance
+hittable_list many_lights_world(scene &objects, hittable_list &lights,
+                                int light_count = 256) {
+  bind_random_stream(rng_stream(5, 0, 0));
+  hittable_list world;
+
+  auto white = objects.create<lambertian>(color3(.73, .73, .73));
+  auto red = objects.create<lambertian>(color3(.65, .05, .05));
+  world.add(objects.create<quad>(point3(-50, 0, -50), vec3(0, 0, 100),
+                                 vec3(100, 0, 0), white));
+  for (int i = 0; i < 16; i++) {
+    point3 center(random_double(-40, 40), 0, random_double(-40, 40));
+    world.add(objects.create<sphere>(center + vec3(0, 3, 0), 3,
+                                     i % 2 ? white : red));
+  }
+
+  for (int i = 0; i < light_count; i++) {
+    double size = random_double(0.5, 1.5);
+    double strength = 40 * std::pow(random_double(), 4) + 1;
+    auto emitter = objects.create<diffuse_light>(
+        color3(random_double(0.5, 1), random_double(0.5, 1), 1) * strength);
+    point3 corner(random_double(-50, 48), random_double(10, 20),
+                  random_double(-50, 48));
+    vec3 u(size, 0, 0), v(0, 0, size);
+    if (i % 4 == 3)
+      std::swap(u, v); // normal cross(u, v) points up
+    auto panel = objects.create<quad>(corner, u, v, emitter);
+    world.add(panel);
+    lights.add(panel);
+  }
+
+  world = hittable_list(objects.create<linear_bvh>(world));
+  return world;
+}
+
+// tree_count trees, each a crown and a trunk instance of three shared meshes,
+// scattered over a square with random size, turn and foliage colour
+shared_ptr<tlas> forest_instances(scene &objects, int tree_count) {
+  bind_random_stream(rng_stream(6, 0, 0));
+  auto forest = objects.create<tlas>();
+
+  auto bark = objects.create<lambertian>(color3(.3, .2, .12));
+  auto leaves = objects.create<lambertian>(color3(.1, .35, .1));
+  std::vector<point3> const spruce = {
+      point3(0, 1.5, 0), point3(2.2, 1.5, 0), point3(1.2, 4.5, 0),
+      point3(1.8, 4.5, 0), point3(0.9, 7.5, 0), point3(1.3, 7.5, 0),
+      point3(0, 10.5, 0)};
+  std::vector<point3> round_crown;
+  for (int i = 0; i <= 8; i++) {
+    double angle = PI * i / 8;
+    round_crown.push_back(
+        point3(2.5 * std::sin(angle), 6.0 - 3.5 * std::cos(angle), 0));
+  }
+  std::vector<point3> const trunk = {point3(0, 0, 0), point3(0.35, 0, 0),
+                                     point3(0.25, 3.0, 0), point3(0, 3.0, 0)};
+  uint32_t crowns[2] = {
+      forest->add_geometry(
+          objects.create<triangle_mesh>(lathe_mesh(spruce, 24), leaves)),
+      forest->add_geometry(
+          objects.create<triangle_mesh>(lathe_mesh(round_crown, 24), leaves))};
+  uint32_t stem = forest->add_geometry(
+      objects.create<triangle_mesh>(lathe_mesh(trunk, 12), bark));
+
+  color3 const foliage[] = {color3(.08, .3, .08), color3(.15, .4, .1),
+                            color3(.05, .25, .12), color3(.55, .3, .05),
+                            color3(.6, .15, .05), color3(.5, .45, .08)};
+  uint32_t colours[6];
+  for (int i = 0; i < 6; i++)
+    colours[i] =
+        forest->add_material(objects.create<lambertian>(foliage[i]));
+
+  // jittered grid, about 4.5 units between trees
+  int side = int(std::ceil(std::sqrt(double(tree_count))));
+  double spacing = 4.5, extent = side * spacing;
+  for (int i = 0; i < tree_count; i++) {
+    point3 where(-0.5 * extent + spacing * (i % side + random_double()), 0,
+                 -0.5 * extent + spacing * (i / side + random_double()));
+    double size = random_double(0.6, 1.4);
+    affine_transform placement =
+        affine_transform::translation(where) *
+        affine_transform::rotation_y(random_double(0, 360)) *
+        affine_transform::scaling(vec3(size, size, size));
+    // deciduous crowns turn to autumn colours, spruces stay green
+    int kind = random_double() < 0.4 ? 1 : 0;
+    int colour = kind == 1 ? random_int(0, 5) : random_int(0, 2);
+    forest->add_instance(crowns[kind], placement, colours[colour]);
+    forest->add_instance(stem, placement);
+  }
+  forest->build();
+  return forest;
+}
+
+// wind at a time in seconds: every tree leans about its base by up to four
+// degrees, in waves running across the forest along x. rest holds the
+// transforms forest_instances() made; call forest.update() afterwards
+void sway_forest(tlas &forest, std::vector<affine_transform> const &rest,
+                 double time) {
+  for (size_t i = 0; i < rest.size(); i++) {
+    vec3 base(rest[i].m[0][3], rest[i].m[1][3], rest[i].m[2][3]);
+    double lean = 4.0 * std::sin(2 * PI * (0.5 * time - base.x / 80.0));
+    forest.set_transform(
+        i, affine_transform::translation(base) *
+               affine_transform::rotation(vec3(0, 0, 1), lean) *
+               affine_transform::translation(-base) * rest[i]);
+  }
+}
+
+// the forest on a plain under a low sun and a blue sky background. the sun
+// is added to lights
+hittable_list forest_world(scene &objects, hittable_list &lights,
+                           shared_ptr<tlas> forest) {
+  hittable_list world;
+  world.add(forest);
+
+  auto ground = objects.create<lambertian>(color3(.35, .3, .2));
+  world.add(objects.create<quad>(point3(-5000, 0, -5000), vec3(0, 0, 10000),
+                                 vec3(10000, 0, 0), ground));
+  auto sunlight = objects.create<diffuse_light>(color3(40, 36, 30));
+  auto sun = objects.create<sphere>(point3(-6000, 5000, 3000), 400, sunlight);
+  world.add(sun);
+  lights.add(sun);
+  return world;
+}
+
+#endif // SCENES_H
@@ -0,0 +1,44 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/*
+the instruction sets the simd kernels (wide_bvh's node tests, ray packets)
+are written for. the build targets plain x86-64, so each kernel is compiled
+for its own level with a target attribute and picked at run time.
+*/
+enum class simd_level { scalar, sse4, avx2 };
+
+char const *simd_level_name(simd_level level) {
+  switch (level) {
+  case simd_level::sse4:
+    return "sse4";
+  case simd_level::avx2:
+    return "avx2";
+  default:
+    return "scalar";
+  }
+}
+
+simd_level detect_simd_level() {
+#ifdef X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return simd_level::avx2;
+  if (__builtin_cpu_supports("sse4.1"))
+    return simd_level::sse4;
+#endif
+  return simd_level::scalar;
+}
+
+// detect_simd_level(), looked up once
+simd_level current_simd_level() {
+  static simd_level const level = detect_simd_level();
+  return level;
+}
+
+#endif // SIMD_H
@@ -8,6 +8,7 @@
 #include "nextWeek/common.h"
 #include "ray.h"
 #include "restOfYourLife/orthonormalbasis.h"
+#include "simd.h"
 #include "texture.h"
 #include "vec3.h"
 
@@ -35,11 +36,18 @@ public:
 
   aabb bounding_box() const override { return bbox; }
 
+  // the center moves in a straight line, so the box in between is exact
+  void motion_bounds(aabb &at_open, aabb &at_close) const override {
+    vec3 r(radius, radius, radius);
+    at_open = aabb(center.at(0) - r, center.at(0) + r);
+    at_close = aabb(center.at(1) - r, center.at(1) + r);
+  }
+
   hit_record generate_hit_record(Ray const &ray,
                                  double factorOfDirection) const {
     hit_record record;
 
-    record.material = material;
+    record.material = material.get();
     record.factorOfDirection = factorOfDirection;
     record.hitPoint = ray.at(factorOfDirection);
     vec3 unitOutwardNormal =
@@ -52,18 +60,36 @@ public:
     return record;
   }
 
-  virtual bool hit(const Ray &ray, interval ray_range,
-                   hit_record &record) const override {
-
+  bool intersect(const Ray &ray, interval ray_range,
+                 hit_info &info) const override {
     double factorOfDirection;
-    if (solveIntersection(ray, ray_range, factorOfDirection)) {
-      record = generate_hit_record(ray, factorOfDirection);
+    if (!solveIntersection(ray, ray_range, factorOfDirection))
+      return false;
 
-      return true;
+    info.record_hit(this, factorOfDirection);
+    return true;
+  }
+
+  void intersect_packet(ray_packet &packet, uint32_t mask, hit_info *infos,
+                        uint32_t &hits) const override {
+#ifdef X86_SIMD
+    if (current_simd_level() == simd_level::avx2) {
+      intersect_packet_avx2(packet, mask, infos, hits);
+      return;
     }
+#endif
+    hittable::intersect_packet(packet, mask, infos, hits);
+  }
+
+  void materialize(const Ray &ray, hit_info const &info,
+                   hit_record &record) const override {
+    record = generate_hit_record(ray, info.factorOfDirection);
+  }
 
-    return false;
-  };
+  bool occluded(const Ray &ray, interval ray_range) const override {
+    double factorOfDirection;
+    return solveIntersection(ray, ray_range, factorOfDirection);
+  }
 
   static void get_sphere_uv(texture_coordinate &tex_coordinate) {
     auto point = tex_coordinate.point;
@@ -77,9 +103,7 @@ public:
   }
 
   double pdf_value(point3 const &origin, vec3 const &direction) const override {
-    hit_record record;
-    if (!this->hit(Ray(origin, direction), interval(0.001, INFINITY_DOUBLE),
-                   record))
+    if (!occluded(Ray(origin, direction), interval(0.001, INFINITY_DOUBLE)))
       return 0;
 
     auto distance_squared = (center.at(0) - origin).norm_square();
@@ -96,12 +120,88 @@ public:
     return uvw.transform(random_to_sphere(radius, distance_squared));
   }
 
+  // emits outwards in every direction
+  bool emitter(emitter_shape &shape) const override {
+    shape.bounds = bbox;
+    shape.axis = vec3(0, 1, 0);
+    shape.cos_theta_normals = -1.0;
+    shape.cos_theta_emission = 0.0;
+    shape.area = 4 * PI * radius * radius;
+    shape.material = material.get();
+    shape.texture_point = texture_coordinate(0.5, 0.5);
+    shape.point = center.at(0) + vec3(0, radius, 0);
+    return true;
+  }
+
 private:
   moving_center center;
   double radius;
   std::shared_ptr<Material> material;
   aabb bbox;
 
+#ifdef X86_SIMD
+  // solveIntersection() for four lanes at a time, operation for operation,
+  // so a packet finds exactly what its rays would alone. a negative
+  // discriminant gives nan roots, which no range holds
+  __attribute__((target("avx2"))) void
+  intersect_packet_avx2(ray_packet &packet, uint32_t mask, hit_info *infos,
+                        uint32_t &hits) const {
+    vec3 const &motion = center.get_displacement();
+    __m256d const radius_squared = _mm256_set1_pd(radius * radius);
+    for (int first = 0; first < packet.size; first += 4) {
+      uint32_t lanes = (mask >> first) & 0xf;
+      if (lanes == 0)
+        continue;
+      __m256d time = _mm256_loadu_pd(packet.time + first);
+      __m256d to_center[3], direction[3];
+      for (int axis = 0; axis < 3; axis++) {
+        __m256d now = _mm256_add_pd(
+            _mm256_set1_pd(center.origin[axis]),
+            _mm256_mul_pd(time, _mm256_set1_pd(motion[axis])));
+        to_center[axis] =
+            _mm256_sub_pd(now, _mm256_loadu_pd(packet.origin[axis] + first));
+        direction[axis] = _mm256_loadu_pd(packet.direction[axis] + first);
+      }
+      __m256d a = dot(direction, direction);
+      __m256d negative_half_b = dot(direction, to_center);
+      __m256d c = _mm256_sub_pd(dot(to_center, to_center), radius_squared);
+      __m256d delta2 = _mm256_sub_pd(_mm256_mul_pd(negative_half_b,
+                                                   negative_half_b),
+                                     _mm256_mul_pd(a, c));
+      __m256d delta2_sqrt = _mm256_sqrt_pd(delta2);
+      __m256d near = _mm256_loadu_pd(packet.t_min + first);
+      __m256d far = _mm256_loadu_pd(packet.t_max + first);
+      __m256d root1 =
+          _mm256_div_pd(_mm256_sub_pd(negative_half_b, delta2_sqrt), a);
+      __m256d root2 =
+          _mm256_div_pd(_mm256_add_pd(negative_half_b, delta2_sqrt), a);
+      __m256d in1 = _mm256_and_pd(_mm256_cmp_pd(root1, near, _CMP_GT_OQ),
+                                  _mm256_cmp_pd(root1, far, _CMP_LT_OQ));
+      __m256d in2 = _mm256_and_pd(_mm256_cmp_pd(root2, near, _CMP_GT_OQ),
+                                  _mm256_cmp_pd(root2, far, _CMP_LT_OQ));
+      lanes &= uint32_t(_mm256_movemask_pd(_mm256_or_pd(in1, in2)));
+      if (lanes == 0)
+        continue;
+      double roots[4];
+      _mm256_storeu_pd(roots, _mm256_blendv_pd(root2, root1, in1));
+      for (int k; ray_packet::next_lane(lanes, k);) {
+        int lane = first + k;
+        infos[lane].record_hit(this, roots[k]);
+        packet.t_max[lane] = roots[k];
+        hits |= 1u << lane;
+      }
+    }
+  }
+
+  // (x * x + y * y) + z * z, as vec3's dot product adds
+  __attribute__((target("avx2"))) static __m256d dot(__m256d const a[3],
+                                                     __m256d const b[3]) {
+    return _mm256_add_pd(
+        _mm256_add_pd(_mm256_mul_pd(a[0], b[0]), _mm256_mul_pd(a[1], b[1])),
+        _mm256_mul_pd(a[2], b[2]));
+  }
+#endif
+
   bool solveIntersection(Ray const &ray, interval ray_range,
                          double &factorOfDirection) const {
     // solve quadratic formula
@@ -128,7 +228,7 @@ private:
 
   void calculate_bbox() {
     vec3 r(radius, radius, radius);
-    aabb bbox_t0 = aabb(center.at(0) - r, center.at(1) + r);
+    aabb bbox_t0 = aabb(center.at(0) - r, center.at(0) + r);
     aabb bbox_t1 = aabb(center.at(1) - r, center.at(1) + r);
     bbox = aabb(bbox_t0, bbox_t1);
   }
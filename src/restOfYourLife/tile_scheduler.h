@@ -0,0 +1,151 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class tile {
+public:
+  int x_begin, y_begin; // inclusive
+  int x_end, y_end;     // exclusive
+
+  tile() : x_begin(0), y_begin(0), x_end(0), y_end(0) {}
+  tile(int x_begin, int y_begin, int x_end, int y_end)
+      : x_begin(x_begin), y_begin(y_begin), x_end(x_end), y_end(y_end) {}
+
+  int pixel_count() const { return (x_end - x_begin) * (y_end - y_begin); }
+};
+
+std::vector<tile> split_into_tiles(int image_width, int image_height,
+                                   int tile_size) {
+  std::vector<tile> tiles;
+  for (int y = 0; y < image_height; y += tile_size)
+    for (int x = 0; x < image_width; x += tile_size)
+      tiles.push_back(tile(x, y, std::min(x + tile_size, image_width),
+                           std::min(y + tile_size, image_height)));
+  return tiles;
+}
+
+/*
+owner pushes/pops at the back (LIFO keeps its working set warm),
+thieves take from the front so they grab the tiles the owner would touch last
+*/
+class work_stealing_deque {
+public:
+  void push(tile const &t) {
+    std::lock_guard<std::mutex> lock(mutex);
+    tiles.push_back(t);
+  }
+
+  bool pop(tile &t) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (tiles.empty())
+      return false;
+    t = tiles.back();
+    tiles.pop_back();
+    return true;
+  }
+
+  bool steal(tile &t) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (tiles.empty())
+      return false;
+    t = tiles.front();
+    tiles.pop_front();
+    return true;
+  }
+
+private:
+  std::mutex mutex;
+  std::deque<tile> tiles;
+};
+
+class tile_scheduler {
+public:
+  tile_scheduler(std::vector<tile> const &tiles, int thread_count)
+      : tile_count(tiles.size()), thread_count(std::max(1, thread_count)),
+        queues(std::max(1, thread_count)) {
+    // deal tiles round-robin, so neighbouring (similarly expensive) tiles end
+    // up on different workers from the start
+    for (size_t i = 0; i < tiles.size(); i++)
+      queues[i % queues.size()].push(tiles[i]);
+    finished_tiles = 0;
+  }
+
+  // runs render_tile over every tile and blocks until all tiles are done.
+  // the calling thread works as worker 0 and is the only one that reports
+  // on_progress(finished, total), so the callback needs no locking.
+  void run(std::function<void(tile const &)> const &render_tile,
+           std::function<void(size_t, size_t)> const &on_progress) {
+    std::function<void(size_t, size_t)> silent;
+    std::vector<std::thread> workers;
+    for (int id = 1; id < thread_count; id++)
+      workers.push_back(std::thread(&tile_scheduler::work, this, id,
+                                    std::cref(render_tile), std::cref(silent)));
+
+    work(0, render_tile, on_progress);
+    for (auto &worker : workers)
+      worker.join();
+
+    if (on_progress)
+      on_progress(finished_tiles.load(), tile_count);
+  }
+
+  size_t size() const { return tile_count; }
+
+private:
+  size_t tile_count;
+  int thread_count;
+  std::vector<work_stealing_deque> queues;
+  std::atomic<size_t> finished_tiles;
+
+  void work(int id, std::function<void(tile const &)> const &render_tile,
+            std::function<void(size_t, size_t)> const &on_progress) {
+    tile t;
+    while (next_tile(id, t)) {
+      render_tile(t);
+      size_t finished = ++finished_tiles;
+      if (on_progress)
+        on_progress(finished, tile_count);
+    }
+  }
+
+  bool next_tile(int id, tile &t) {
+    if (queues[id].pop(t))
+      return true;
+
+    // tiles are never produced during the render, so once every queue is
+    // empty there is nothing left to steal
+    int queue_count = int(queues.size());
+    for (int offset = 1; offset < queue_count; offset++) {
+      if (queues[(id + offset) % queue_count].steal(t))
+        return true;
+    }
+    return false;
+  }
+};
+
+int resolve_thread_count(int requested) {
+  // explicit request > RT_THREADS environment variable > hardware concurrency
+  if (requested > 0)
+    return requested;
+
+  char const *from_env = std::getenv("RT_THREADS");
+  if (from_env) {
+    int value = std::atoi(from_env);
+    if (value > 0)
+      return value;
+  }
+
+  int hardware = int(std::thread::hardware_concurrency());
+  return hardware > 0 ? hardware : 1;
+}
+
+#endif // TILE_SCHEDULER_H
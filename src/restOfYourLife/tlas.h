@@ -0,0 +1,208 @@
+#ifndef TLAS_H
+#define TLAS_H
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "index_bvh.h"
+#include "interval.h"
+#include "material.h"
+#include "ray.h"
+#include "transform.h"
+#include "vec3.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+one placement of a tlas geometry. it is a hittable only so it can stand in
+hit_info's instance chain; tlas traverses it directly. the geometry and the
+material belong to the tlas.
+*/
+class blas_instance : public hittable {
+public:
+  blas_instance(hittable const *geometry, affine_transform const &to_world,
+                Material const *material)
+      : geometry(geometry), material(material), to_world(to_world),
+        to_object(to_world.inverse()),
+        depth(nested_instance_depth(*geometry)) {}
+
+  bool intersect(const Ray &ray, interval ray_range,
+                 hit_info &info) const override {
+    if (!geometry->intersect(to_instance_space(ray), ray_range, info))
+      return false;
+
+    info.push_instance(this);
+    return true;
+  }
+
+  bool occluded(const Ray &ray, interval ray_range) const override {
+    return geometry->occluded(to_instance_space(ray), ray_range);
+  }
+
+  Ray to_instance_space(const Ray &ray) const override {
+    return Ray(to_object.point(ray.getOrigin()),
+               to_object.vector(ray.getDirection()), ray.getTime());
+  }
+
+  // the override replaces whatever the geometry was made of
+  void to_world_space(hit_record &record) const override {
+    record.hitPoint = to_world.point(record.hitPoint);
+    record.normalAgainstRay =
+        unit_vector(to_object.transposed_vector(record.normalAgainstRay));
+    if (material)
+      record.material = material;
+  }
+
+  aabb bounding_box() const override {
+    return to_world.bounds(geometry->bounding_box());
+  }
+
+  int instance_depth() const override { return depth; }
+
+  hittable const &blas() const { return *geometry; }
+  affine_transform const &object_to_world() const { return to_world; }
+
+  void set_transform(affine_transform const &new_to_world) {
+    to_object = new_to_world.inverse();
+    to_world = new_to_world;
+  }
+
+private:
+  hittable const *geometry;
+  Material const *material; // null: the geometry's own
+  affine_transform to_world, to_object;
+  int depth;
+};
+
+/*
+a two-level acceleration structure. each unique geometry (a bottom level,
+e.g. a triangle_mesh or a linear_bvh of a cluster of objects) is added and
+built once; instances place it with an affine transform and optionally
+another material. the top level is an index_bvh over the instances' world
+bounds, and a ray entering an instance is transformed into the geometry's
+space there. memory grows with the unique geometry plus a fixed record per
+instance:
+
+  tlas forest;
+  uint32_t tree = forest.add_geometry(tree_mesh);
+  uint32_t autumn = forest.add_material(orange);
+  forest.add_instance(tree, affine_transform::translation(where), autumn);
+  forest.build();
+
+instances added after build() are not seen until it is called again. for
+animation, move instances with set_transform() and call update() once per
+frame: it refits the top level and rebuilds only the parts of it the motion
+has made much worse (see index_bvh::update).
+*/
+class tlas : public hittable {
+public:
+  static uint32_t const own_material = 0xffffffffu;
+
+  uint32_t add_geometry(shared_ptr<hittable> blas) {
+    geometries.push_back(blas);
+    return uint32_t(geometries.size() - 1);
+  }
+
+  uint32_t add_material(shared_ptr<Material> material) {
+    materials.push_back(material);
+    return uint32_t(materials.size() - 1);
+  }
+
+  // throws for an unknown geometry or material, a singular transform, or a
+  // geometry nesting instances as deep as hit_info can record
+  void add_instance(uint32_t geometry, affine_transform const &to_world,
+                    uint32_t material = own_material) {
+    if (geometry >= geometries.size())
+      throw std::invalid_argument("tlas: no geometry " +
+                                  std::to_string(geometry));
+    if (material != own_material && material >= materials.size())
+      throw std::invalid_argument("tlas: no material " +
+                                  std::to_string(material));
+    instances.push_back(blas_instance(
+        geometries[geometry].get(), to_world,
+        material == own_material ? nullptr : materials[material].get()));
+  }
+
+  void build(bvh_build_options const &options = bvh_build_options()) {
+    build_options = options;
+    instances.shrink_to_fit();
+    std::vector<index_bvh_item> items(instances.size());
+    for (size_t i = 0; i < instances.size(); i++)
+      items[i] = index_bvh_item(instances[i].bounding_box(), uint32_t(i));
+    top.build(items, options);
+    bbox = top.bounds();
+  }
+
+  // throws for a singular transform
+  void set_transform(size_t instance, affine_transform const &to_world) {
+    instances[instance].set_transform(to_world);
+  }
+
+  // after instances moved: refit, rebuilding subtrees whose sah cost grew by
+  // more than rebuild_threshold times
+  index_bvh::update_result update(double rebuild_threshold = 1.5,
+                                  int thread_count = 1) {
+    auto result = top.update(
+        [&](uint32_t id) { return instances[id].bounding_box(); },
+        build_options, rebuild_threshold, thread_count);
+    bbox = top.bounds();
+    return result;
+  }
+
+  bool intersect(const Ray &ray, interval ray_range,
+                 hit_info &info) const override {
+    return top.closest(ray, ray_range, [&](uint32_t id, interval &range) {
+      if (!instances[id].intersect(ray, range, info))
+        return false;
+      range.max = info.factorOfDirection;
+      return true;
+    });
+  }
+
+  bool occluded(const Ray &ray, interval ray_range) const override {
+    return top.any(ray, ray_range, [&](uint32_t id, interval range) {
+      return instances[id].occluded(ray, range);
+    });
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  bool random_intersections() const override {
+    return any_random_intersections(geometries);
+  }
+
+  int instance_depth() const override {
+    int depth = 0;
+    for (auto const &instance : instances)
+      depth = std::max(depth, instance.instance_depth());
+    return depth;
+  }
+
+  size_t instance_count() const { return instances.size(); }
+  size_t geometry_count() const { return geometries.size(); }
+  blas_instance const &instance(size_t i) const { return instances[i]; }
+  shared_ptr<hittable> const &geometry(size_t i) const {
+    return geometries[i];
+  }
+
+  double sah_cost() const { return top.sah_cost(build_options.traversal_cost); }
+
+  // the instance records and top level, not the geometry they share
+  size_t memory_bytes() const {
+    return instances.size() * sizeof(blas_instance) + top.memory_bytes();
+  }
+
+private:
+  std::vector<shared_ptr<hittable>> geometries;
+  std::vector<shared_ptr<Material>> materials;
+  std::vector<blas_instance> instances;
+  index_bvh top; // over instance ids
+  bvh_build_options build_options;
+  aabb bbox = aabb::Empty_bbox;
+};
+
+#endif // TLAS_H
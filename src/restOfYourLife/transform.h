@@ -0,0 +1,292 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "aabb.h"
+#include "common.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "vec3.h"
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+
+/*
+an affine map as a 3x4 matrix: the linear part in the first three columns,
+the translation in the last. a * b applies b first.
+*/
+class affine_transform {
+public:
+  double m[3][4];
+
+  affine_transform() {
+    for (int row = 0; row < 3; row++)
+      for (int column = 0; column < 4; column++)
+        m[row][column] = row == column ? 1.0 : 0.0;
+  }
+
+  static affine_transform translation(vec3 const &offset) {
+    affine_transform t;
+    for (int row = 0; row < 3; row++)
+      t.m[row][3] = offset[row];
+    return t;
+  }
+
+  // the same rotation as rotate_y
+  static affine_transform rotation_y(double angle) {
+    double radians = degrees_to_radians(angle);
+    double sin_theta = std::sin(radians), cos_theta = std::cos(radians);
+    return from_rotation_y(sin_theta, cos_theta);
+  }
+
+  static affine_transform from_rotation_y(double sin_theta, double cos_theta) {
+    affine_transform t;
+    t.m[0][0] = cos_theta;
+    t.m[0][2] = sin_theta;
+    t.m[2][0] = -sin_theta;
+    t.m[2][2] = cos_theta;
+    return t;
+  }
+
+  // counterclockwise around axis, Rodrigues' formula
+  static affine_transform rotation(vec3 const &axis, double angle) {
+    vec3 k = unit_vector(axis);
+    double radians = degrees_to_radians(angle);
+    double s = std::sin(radians), c = std::cos(radians);
+    affine_transform t;
+    for (int row = 0; row < 3; row++)
+      for (int column = 0; column < 3; column++)
+        t.m[row][column] =
+            (row == column ? c : 0.0) + (1 - c) * k[row] * k[column];
+    t.m[0][1] -= s * k.z;
+    t.m[0][2] += s * k.y;
+    t.m[1][0] += s * k.z;
+    t.m[1][2] -= s * k.x;
+    t.m[2][0] -= s * k.y;
+    t.m[2][1] += s * k.x;
+    return t;
+  }
+
+  static affine_transform scaling(vec3 const &factors) {
+    affine_transform t;
+    for (int row = 0; row < 3; row++)
+      t.m[row][row] = factors[row];
+    return t;
+  }
+
+  affine_transform operator*(affine_transform const &b) const {
+    affine_transform result;
+    for (int row = 0; row < 3; row++) {
+      for (int column = 0; column < 4; column++) {
+        double sum = column == 3 ? m[row][3] : 0.0;
+        for (int k = 0; k < 3; k++)
+          sum += m[row][k] * b.m[k][column];
+        result.m[row][column] = sum;
+      }
+    }
+    return result;
+  }
+
+  point3 point(point3 const &p) const {
+    return point3(row(0, p) + m[0][3], row(1, p) + m[1][3],
+                  row(2, p) + m[2][3]);
+  }
+
+  vec3 vector(vec3 const &v) const {
+    return vec3(row(0, v), row(1, v), row(2, v));
+  }
+
+  // a normal goes through the transposed linear part; give it the inverse
+  // to map normals the way this transform maps points
+  vec3 transposed_vector(vec3 const &v) const {
+    return vec3(m[0][0] * v.x + m[1][0] * v.y + m[2][0] * v.z,
+                m[0][1] * v.x + m[1][1] * v.y + m[2][1] * v.z,
+                m[0][2] * v.x + m[1][2] * v.y + m[2][2] * v.z);
+  }
+
+  double determinant() const {
+    return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+           m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+           m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+  }
+
+  // throws for a singular linear part
+  affine_transform inverse() const {
+    double det = determinant();
+    if (det == 0.0)
+      throw std::invalid_argument("affine_transform: singular matrix");
+    affine_transform result;
+    for (int row = 0; row < 3; row++) {
+      for (int column = 0; column < 3; column++) {
+        // cofactor of (column, row), which is the adjugate at (row, column)
+        int r0 = (column + 1) % 3, r1 = (column + 2) % 3;
+        int c0 = (row + 1) % 3, c1 = (row + 2) % 3;
+        result.m[row][column] =
+            (m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0]) / det;
+      }
+    }
+    vec3 offset = result.vector(vec3(m[0][3], m[1][3], m[2][3]));
+    for (int row = 0; row < 3; row++)
+      result.m[row][3] = -offset[row];
+    return result;
+  }
+
+  // rotations and translations only: lengths and angles are kept
+  bool is_rigid() const {
+    for (int a = 0; a < 3; a++) {
+      for (int b = 0; b < 3; b++) {
+        double dot = m[0][a] * m[0][b] + m[1][a] * m[1][b] + m[2][a] * m[2][b];
+        if (std::fabs(dot - (a == b ? 1.0 : 0.0)) > 1e-9)
+          return false;
+      }
+    }
+    return true;
+  }
+
+  // the exact bounds of the transformed box, Arvo, Graphics Gems 1990
+  aabb bounds(aabb const &box) const {
+    interval axes[3];
+    for (int row = 0; row < 3; row++) {
+      double low = m[row][3], high = m[row][3];
+      for (int k = 0; k < 3; k++) {
+        interval const &extent = box.get_axis_interval(k);
+        double a = m[row][k] * extent.min, b = m[row][k] * extent.max;
+        low += std::fmin(a, b);
+        high += std::fmax(a, b);
+      }
+      axes[row] = interval(low, high);
+    }
+    return aabb(axes[0], axes[1], axes[2]);
+  }
+
+private:
+  double row(int r, vec3 const &v) const {
+    return m[r][0] * v.x + m[r][1] * v.y + m[r][2] * v.z;
+  }
+};
+
+/*
+one instance for any affine transform of its child, in place of a chain of
+translate and rotate_y wrappers. chains below it (translate, rotate_y and
+other transform_instances) are folded into its matrix when it is built, so a
+ray is transformed once. bounds are those of the child's bounds, or of each
+of a hittable_list's members, under the whole transform, which is tighter
+than boxing a box per level. light sampling goes through it: directions are
+mapped into the child's space and the pdf scaled by the change of solid angle.
+*/
+class transform_instance : public hittable {
+public:
+  transform_instance(shared_ptr<hittable> object,
+                     affine_transform const &to_world = affine_transform())
+      : object(object), to_world(to_world) {
+    collapse();
+    depth = nested_instance_depth(*this->object);
+    to_object = this->to_world.inverse();
+    inverse_determinant = std::fabs(to_object.determinant());
+    rigid = this->to_world.is_rigid();
+    bbox = transformed_bounds(*this->object);
+  }
+
+  bool intersect(const Ray &ray, interval ray_range,
+                 hit_info &info) const override {
+    if (!object->intersect(to_instance_space(ray), ray_range, info))
+      return false;
+
+    info.push_instance(this);
+    return true;
+  }
+
+  bool occluded(const Ray &ray, interval ray_range) const override {
+    return object->occluded(to_instance_space(ray), ray_range);
+  }
+
+  // the direction is not normalized, so distances along the ray stay the same
+  Ray to_instance_space(const Ray &ray) const override {
+    return Ray(to_object.point(ray.getOrigin()),
+               to_object.vector(ray.getDirection()), ray.getTime());
+  }
+
+  void to_world_space(hit_record &record) const override {
+    record.hitPoint = to_world.point(record.hitPoint);
+    record.normalAgainstRay =
+        unit_vector(to_object.transposed_vector(record.normalAgainstRay));
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  bool random_intersections() const override {
+    return object->random_intersections();
+  }
+
+  int instance_depth() const override { return depth; }
+
+  double pdf_value(point3 const &origin, vec3 const &direction) const override {
+    vec3 local_direction = to_object.vector(unit_vector(direction));
+    double length = local_direction.norm();
+    return object->pdf_value(to_object.point(origin), local_direction) *
+           inverse_determinant / (length * length * length);
+  }
+
+  vec3 random(point3 const &origin) const override {
+    return unit_vector(
+        to_world.vector(object->random(to_object.point(origin))));
+  }
+
+  // a scaled emitter's cone and area are only estimated: the light tree
+  // takes them as importance, the pdf above stays exact
+  bool emitter(emitter_shape &shape) const override {
+    if (!object->emitter(shape))
+      return false;
+    shape.bounds = to_world.bounds(shape.bounds);
+    shape.axis = unit_vector(to_object.transposed_vector(shape.axis));
+    shape.point = to_world.point(shape.point);
+    if (!rigid) {
+      shape.cos_theta_normals = -1.0;
+      shape.area *= std::pow(1.0 / inverse_determinant, 2.0 / 3.0);
+    }
+    return true;
+  }
+
+  affine_transform const &object_to_world() const { return to_world; }
+  hittable const &child() const { return *object; }
+
+private:
+  shared_ptr<hittable> object;
+  affine_transform to_world, to_object;
+  double inverse_determinant;
+  bool rigid;
+  aabb bbox;
+  int depth;
+
+  void collapse() {
+    for (;;) {
+      hittable const *child = object.get();
+      if (auto inner = dynamic_cast<transform_instance const *>(child)) {
+        to_world = to_world * inner->to_world;
+        object = inner->object;
+      } else if (auto inner = dynamic_cast<translate const *>(child)) {
+        to_world =
+            to_world * affine_transform::translation(inner->get_offset());
+        object = inner->get_object();
+      } else if (auto inner = dynamic_cast<rotate_y const *>(child)) {
+        to_world = to_world *
+                   affine_transform::from_rotation_y(inner->get_sin_theta(),
+                                                     inner->get_cos_theta());
+        object = inner->get_object();
+      } else {
+        return;
+      }
+    }
+  }
+
+  aabb transformed_bounds(hittable const &child) const {
+    auto list = dynamic_cast<hittable_list const *>(&child);
+    if (!list || list->objects.empty())
+      return to_world.bounds(child.bounding_box());
+    aabb bounds = aabb::Empty_bbox;
+    for (auto const &member : list->objects)
+      bounds = aabb(bounds, to_world.bounds(member->bounding_box()));
+    return bounds;
+  }
+};
+
+#endif // TRANSFORM_H
@@ -0,0 +1,432 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "interval.h"
+#include "ray.h"
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+/*
+bvh4/bvh8: the binary tree collapsed into nodes with up to 4 or 8 children,
+child boxes stored as float arrays per coordinate (SoA), so one node visit
+tests every child box with a single sse/avx slab test.
+*/
+
+template <int width> class wide_bvh_node {
+public:
+  float min_x[width], min_y[width], min_z[width];
+  float max_x[width], max_y[width], max_z[width];
+  uint32_t child[width];           // node index, or first primitive of a leaf
+  uint16_t primitive_count[width]; // 0: child is an interior node
+  uint8_t child_count;             // slots [0, child_count) are used
+};
+
+// the ray as the kernels want it: floats, reciprocal direction
+class wide_ray {
+public:
+  float origin[3];
+  float inverse_direction[3];
+};
+
+// every kernel returns a bit per child whose box the ray enters within
+// [t_min, t_max] and writes the entry distances to t_near
+template <int width>
+int intersect_children_scalar(wide_bvh_node<width> const &node,
+                              wide_ray const &ray, float t_min, float t_max,
+                              float *t_near) {
+  float const *bounds_min[3] = {node.min_x, node.min_y, node.min_z};
+  float const *bounds_max[3] = {node.max_x, node.max_y, node.max_z};
+  int mask = 0;
+  for (int i = 0; i < node.child_count; i++) {
+    float near = t_min, far = t_max;
+    for (int axis = 0; axis < 3; axis++) {
+      float root1 = (bounds_min[axis][i] - ray.origin[axis]) *
+                    ray.inverse_direction[axis];
+      float root2 = (bounds_max[axis][i] - ray.origin[axis]) *
+                    ray.inverse_direction[axis];
+      float t0 = root1 < root2 ? root1 : root2;
+      float t1 = root1 < root2 ? root2 : root1;
+      // NaN (ray inside a slab plane) never wins a comparison
+      near = t0 > near ? t0 : near;
+      far = t1 < far ? t1 : far;
+    }
+    t_near[i] = near;
+    if (near <= far)
+      mask |= 1 << i;
+  }
+  return mask;
+}
+
+#ifdef X86_SIMD
+// _mm_min_ps/_mm_max_ps return the second operand when either one is NaN, so
+// the running value always goes second: a NaN slab never shrinks the range
+
+__attribute__((target("sse4.1"))) int
+intersect_children_sse4(wide_bvh_node<4> const &node, wide_ray const &ray,
+                        float t_min, float t_max, float *t_near) {
+  __m128 near = _mm_set1_ps(t_min), far = _mm_set1_ps(t_max);
+  float const *bounds_min[3] = {node.min_x, node.min_y, node.min_z};
+  float const *bounds_max[3] = {node.max_x, node.max_y, node.max_z};
+  for (int axis = 0; axis < 3; axis++) {
+    __m128 origin = _mm_set1_ps(ray.origin[axis]);
+    __m128 inverse = _mm_set1_ps(ray.inverse_direction[axis]);
+    __m128 root1 = _mm_mul_ps(
+        _mm_sub_ps(_mm_loadu_ps(bounds_min[axis]), origin), inverse);
+    __m128 root2 = _mm_mul_ps(
+        _mm_sub_ps(_mm_loadu_ps(bounds_max[axis]), origin), inverse);
+    near = _mm_max_ps(_mm_min_ps(root1, root2), near);
+    far = _mm_min_ps(_mm_max_ps(root1, root2), far);
+  }
+  _mm_storeu_ps(t_near, near);
+  int mask = _mm_movemask_ps(_mm_cmple_ps(near, far));
+  return mask & ((1 << node.child_count) - 1);
+}
+
+__attribute__((target("avx2"))) int
+intersect_children_avx2(wide_bvh_node<8> const &node, wide_ray const &ray,
+                        float t_min, float t_max, float *t_near) {
+  __m256 near = _mm256_set1_ps(t_min), far = _mm256_set1_ps(t_max);
+  float const *bounds_min[3] = {node.min_x, node.min_y, node.min_z};
+  float const *bounds_max[3] = {node.max_x, node.max_y, node.max_z};
+  for (int axis = 0; axis < 3; axis++) {
+    __m256 origin = _mm256_set1_ps(ray.origin[axis]);
+    __m256 inverse = _mm256_set1_ps(ray.inverse_direction[axis]);
+    __m256 root1 = _mm256_mul_ps(
+        _mm256_sub_ps(_mm256_loadu_ps(bounds_min[axis]), origin), inverse);
+    __m256 root2 = _mm256_mul_ps(
+        _mm256_sub_ps(_mm256_loadu_ps(bounds_max[axis]), origin), inverse);
+    near = _mm256_max_ps(_mm256_min_ps(root1, root2), near);
+    far = _mm256_min_ps(_mm256_max_ps(root1, root2), far);
+  }
+  _mm256_storeu_ps(t_near, near);
+  int mask = _mm256_movemask_ps(_mm256_cmp_ps(near, far, _CMP_LE_OQ));
+  return mask & ((1 << node.child_count) - 1);
+}
+#endif
+
+template <int width> class wide_bvh : public hittable {
+public:
+  typedef int (*intersect_kernel)(wide_bvh_node<width> const &,
+                                  wide_ray const &, float, float, float *);
+
+  static int const stack_capacity = 256;
+
+  // use_simd = false forces the scalar kernel (for comparisons)
+  wide_bvh(hittable_list const &list, bool use_simd = true)
+      : wide_bvh(bvh_node(list), use_simd) {}
+
+  wide_bvh(bvh_node const &tree, bool use_simd = true) {
+    choose_kernel(use_simd);
+    build(tree);
+    if (max_depth * (width - 1) + 1 > stack_capacity) {
+      // as linear_bvh does: sah can chain 1 vs n-1 splits on odd inputs,
+      // median never goes deeper than log2(n)
+      hittable_list list;
+      collect_objects(tree, list);
+      bvh_build_options median;
+      median.split_method = bvh_split_method::median;
+      build(bvh_node(list, median));
+    }
+  }
+
+  bool intersect(const Ray &ray, interval ray_range,
+                 hit_info &info) const override {
+    if (nodes.empty())
+      return false;
+
+    wide_ray packed;
+    for (int axis = 0; axis < 3; axis++) {
+      packed.origin[axis] = float(ray.getOrigin()[axis]);
+      packed.inverse_direction[axis] = float(1.0 / ray.getDirection()[axis]);
+    }
+
+    stack_entry stack[stack_capacity];
+    int stack_size = 1;
+    stack[0].index = 0;
+    stack[0].primitive_count = 0;
+    bool hit_anything = false;
+    float t_near[width];
+
+    while (stack_size > 0) {
+      stack_entry entry = stack[--stack_size];
+
+      if (entry.primitive_count > 0) {
+        for (uint32_t i = 0; i < entry.primitive_count; i++) {
+          if (primitives[entry.index + i]->intersect(ray, ray_range, info)) {
+            hit_anything = true;
+            ray_range.max = info.factorOfDirection;
+          }
+        }
+        continue;
+      }
+
+      wide_bvh_node<width> const &node = nodes[entry.index];
+      int mask =
+          intersect_children(node, packed, float_below(ray_range.min),
+                             float_above(ray_range.max), t_near);
+      if (mask == 0)
+        continue;
+
+      // push the hit children far to near, so the nearest is popped first
+      int order[width], count = 0;
+      for (int i = 0; i < node.child_count; i++) {
+        if (!(mask & (1 << i)))
+          continue;
+        int j = count++;
+        while (j > 0 && t_near[order[j - 1]] < t_near[i]) {
+          order[j] = order[j - 1];
+          j--;
+        }
+        order[j] = i;
+      }
+      for (int k = 0; k < count; k++) {
+        stack[stack_size].index = node.child[order[k]];
+        stack[stack_size].primitive_count = node.primitive_count[order[k]];
+        stack_size++;
+      }
+    }
+
+    return hit_anything;
+  }
+
+  bool occluded(const Ray &ray, interval ray_range) const override {
+    if (nodes.empty())
+      return false;
+
+    wide_ray packed;
+    for (int axis = 0; axis < 3; axis++) {
+      packed.origin[axis] = float(ray.getOrigin()[axis]);
+      packed.inverse_direction[axis] = float(1.0 / ray.getDirection()[axis]);
+    }
+    float range_min = float_below(ray_range.min);
+    float range_max = float_above(ray_range.max);
+
+    // any hit ends the query, so children are pushed in any order
+    stack_entry stack[stack_capacity];
+    int stack_size = 1;
+    stack[0].index = 0;
+    stack[0].primitive_count = 0;
+    float t_near[width];
+
+    while (stack_size > 0) {
+      stack_entry entry = stack[--stack_size];
+
+      if (entry.primitive_count > 0) {
+        for (uint32_t i = 0; i < entry.primitive_count; i++)
+          if (primitives[entry.index + i]->occluded(ray, ray_range))
+            return true;
+        continue;
+      }
+
+      wide_bvh_node<width> const &node = nodes[entry.index];
+      int mask = intersect_children(node, packed, range_min, range_max, t_near);
+      for (int i = 0; i < node.child_count; i++) {
+        if (!(mask & (1 << i)))
+          continue;
+        stack[stack_size].index = node.child[i];
+        stack[stack_size].primitive_count = node.primitive_count[i];
+        stack_size++;
+      }
+    }
+
+    return false;
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  bool random_intersections() const override {
+    return any_random_intersections(owners);
+  }
+
+  int instance_depth() const override { return deepest_instance(owners); }
+
+  size_t node_count() const { return nodes.size(); }
+  size_t memory_bytes() const {
+    return nodes.size() * sizeof(wide_bvh_node<width>) +
+           primitives.size() * sizeof(hittable const *);
+  }
+  simd_level kernel_level() const { return level; }
+
+private:
+  class stack_entry {
+  public:
+    uint32_t index;
+    uint32_t primitive_count;
+  };
+
+  std::vector<wide_bvh_node<width>> nodes;
+  std::vector<hittable const *> primitives;
+  std::vector<shared_ptr<hittable>> owners;
+  aabb bbox;
+  intersect_kernel intersect_children;
+  simd_level level;
+  double padding = 0.0;
+  int max_depth = 0;
+
+  void choose_kernel(bool use_simd);
+
+  void build(bvh_node const &tree) {
+    nodes.clear();
+    primitives.clear();
+    owners.clear();
+    max_depth = 0;
+    bbox = tree.bounding_box();
+
+    // rays are tested in float, with the origin rounded to float as well.
+    // widen every box by a few float ulps of the scene's coordinates so that
+    // rounding never turns a hit into a miss
+    double largest_coordinate = 1.0;
+    for (int axis = 0; axis < 3; axis++) {
+      interval const &extent = bbox.get_axis_interval(axis);
+      if (extent.min <= extent.max)
+        largest_coordinate = std::max(
+            largest_coordinate,
+            std::max(std::fabs(extent.min), std::fabs(extent.max)));
+    }
+    padding = std::ldexp(largest_coordinate, -20);
+
+    if (tree.is_leaf() && tree.leaf_objects().empty())
+      return;
+
+    if (tree.is_leaf()) {
+      // a single leaf still needs a node above it
+      nodes.push_back(wide_bvh_node<width>());
+      nodes[0].child_count = 1;
+      set_child(0, 0, tree);
+    } else {
+      emit(tree);
+    }
+  }
+
+  static void collect_objects(bvh_node const &tree, hittable_list &list) {
+    if (!tree.is_leaf()) {
+      collect_objects(tree.left_child(), list);
+      collect_objects(tree.right_child(), list);
+      return;
+    }
+    for (auto const &object : tree.leaf_objects())
+      list.add(object);
+  }
+
+  uint32_t emit(bvh_node const &tree_node, int depth = 1) {
+    max_depth = std::max(max_depth, depth);
+
+    // open the largest interior child until the node is full
+    std::vector<bvh_node const *> children;
+    children.push_back(&tree_node.left_child());
+    children.push_back(&tree_node.right_child());
+    while (int(children.size()) < width) {
+      int largest = -1;
+      double largest_area = -1.0;
+      for (int i = 0; i < int(children.size()); i++) {
+        double area = children[i]->bounding_box().surface_area();
+        if (!children[i]->is_leaf() && area > largest_area) {
+          largest = i;
+          largest_area = area;
+        }
+      }
+      if (largest < 0)
+        break;
+      bvh_node const *opened = children[largest];
+      children[largest] = &opened->left_child();
+      children.push_back(&opened->right_child());
+    }
+
+    uint32_t index = uint32_t(nodes.size());
+    nodes.push_back(wide_bvh_node<width>());
+    nodes[index].child_count = uint8_t(children.size());
+    for (int i = 0; i < width; i++) {
+      if (i < int(children.size()))
+        continue;
+      // unused slots: never read thanks to child_count, keep them sane
+      nodes[index].min_x[i] = nodes[index].min_y[i] = nodes[index].min_z[i] =
+          INFINITY;
+      nodes[index].max_x[i] = nodes[index].max_y[i] = nodes[index].max_z[i] =
+          -INFINITY;
+      nodes[index].child[i] = 0;
+      nodes[index].primitive_count[i] = 0;
+    }
+
+    for (int i = 0; i < int(children.size()); i++) {
+      if (children[i]->is_leaf()) {
+        set_child(index, i, *children[i]);
+      } else {
+        uint32_t child_index = emit(*children[i], depth + 1);
+        set_child(index, i, *children[i]);
+        nodes[index].child[i] = child_index;
+      }
+    }
+    return index;
+  }
+
+  void set_child(uint32_t index, int slot, bvh_node const &child) {
+    aabb const box = child.bounding_box();
+    wide_bvh_node<width> &node = nodes[index];
+    node.min_x[slot] = float_below(box.x_interval.min - padding);
+    node.min_y[slot] = float_below(box.y_interval.min - padding);
+    node.min_z[slot] = float_below(box.z_interval.min - padding);
+    node.max_x[slot] = float_above(box.x_interval.max + padding);
+    node.max_y[slot] = float_above(box.y_interval.max + padding);
+    node.max_z[slot] = float_above(box.z_interval.max + padding);
+    node.primitive_count[slot] = 0;
+
+    if (!child.is_leaf())
+      return;
+    auto const &objects = child.leaf_objects();
+    if (objects.empty() || objects.size() > 0xffff)
+      throw std::invalid_argument("wide_bvh: unsupported leaf size");
+    node.child[slot] = uint32_t(primitives.size());
+    node.primitive_count[slot] = uint16_t(objects.size());
+    for (auto const &object : objects) {
+      primitives.push_back(object.get());
+      owners.push_back(object);
+    }
+  }
+
+  // float bounds and distances rounded outwards, so the float test never
+  // rejects what the double test accepts
+  static float float_below(double value) {
+    float f = float(value);
+    return double(f) > value ? std::nextafter(f, -INFINITY) : f;
+  }
+  static float float_above(double value) {
+    float f = float(value);
+    return double(f) < value ? std::nextafter(f, INFINITY) : f;
+  }
+};
+
+template <> void wide_bvh<4>::choose_kernel(bool use_simd) {
+  intersect_children = intersect_children_scalar<4>;
+  level = simd_level::scalar;
+#ifdef X86_SIMD
+  if (use_simd && detect_simd_level() != simd_level::scalar) {
+    intersect_children = intersect_children_sse4;
+    level = simd_level::sse4;
+  }
+#endif
+}
+
+template <> void wide_bvh<8>::choose_kernel(bool use_simd) {
+  intersect_children = intersect_children_scalar<8>;
+  level = simd_level::scalar;
+#ifdef X86_SIMD
+  if (use_simd && detect_simd_level() == simd_level::avx2) {
+    intersect_children = intersect_children_avx2;
+    level = simd_level::avx2;
+  }
+#endif
+}
+
+using bvh4 = wide_bvh<4>;
+using bvh8 = wide_bvh<8>;
+
+#endif // WIDE_BVH_H